@@ -0,0 +1,262 @@
+/*
+ * Copyright (c) 2021-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#include "History.h"
+
+#include <magnifier/FunctionSlice.h>
+#include <magnifier/ISubstitutionObserver.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/InstIterator.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/FormatVariadic.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <optional>
+#include <random>
+#include <vector>
+
+#include "Memory.h"
+#include "Resolver.h"
+#include "bin/magnifier-gen/Generator.h"
+
+namespace {
+
+enum class Operation : unsigned {
+    kForEachFunction,
+    kPrintFunction,
+    kSubstituteInstruction,
+    kSubstituteArgument,
+    kInline,
+    kDevirtualize,
+    kOptimize,
+    kDelete,
+    // What the UI's `dec` command does before decompiling.
+    kSliceFunction,
+};
+
+constexpr size_t kOperationCount = static_cast<size_t>(Operation::kSliceFunction) + 1;
+
+constexpr std::array<const char *, kOperationCount> kOperationNames = {
+        "for_each_function", "print_function", "substitute_instruction", "substitute_argument", "inline",
+        "devirtualize", "optimize", "delete", "slice_function",
+};
+
+// How often each operation is picked, relative to the others.
+constexpr std::array<double, kOperationCount> kOperationWeights = {2, 2, 3, 3, 2, 1, 1, 1, 1};
+
+struct Window {
+    std::chrono::nanoseconds total{0};
+    uint64_t count{0};
+};
+
+class HistoryReplay {
+    const HistoryOptions &options;
+    std::mt19937_64 random;
+    llvm::LLVMContext context;
+    magnifier::BitcodeExplorer explorer;
+    magnifier::NullSubstitutionObserver observer;
+    FunctionResolver resolver;
+    // Every function the operations can pick, including the versions created
+    // by earlier operations.
+    std::vector<magnifier::ValueId> functions;
+    std::array<Window, kOperationCount> windows;
+
+    template <typename T>
+    T &Pick(std::vector<T> &values) {
+        return values[std::uniform_int_distribution<size_t>(0, values.size() - 1)(random)];
+    }
+
+    void AddVersion(magnifier::ValueId function_id) {
+        if (function_id != magnifier::kInvalidValueId) {
+            functions.push_back(function_id);
+        }
+    }
+
+    // Returns the id of a random instruction of `function` that `predicate`
+    // accepts, or `kInvalidValueId` if there is none.
+    template <typename Predicate>
+    magnifier::ValueId PickInstruction(llvm::Function &function, Predicate &&predicate) {
+        std::vector<llvm::Instruction *> candidates;
+        for (llvm::Instruction &instruction : llvm::instructions(function)) {
+            if (predicate(instruction)) {
+                candidates.push_back(&instruction);
+            }
+        }
+        if (candidates.empty()) {
+            return magnifier::kInvalidValueId;
+        }
+        return explorer.GetId(*Pick(candidates), magnifier::ValueIdKind::kDerived);
+    }
+
+    // Run `operation` on a random function and returns the time it took, or
+    // nothing if the function has nothing the operation can work on.
+    std::optional<std::chrono::nanoseconds> Run(Operation operation) {
+        magnifier::ValueId function_id = Pick(functions);
+        std::optional<llvm::Function *> function = explorer.GetFunctionById(function_id);
+        if (!function) {
+            std::erase(functions, function_id);
+            return std::nullopt;
+        }
+
+        magnifier::ValueId target_id = magnifier::kInvalidValueId;
+        switch (operation) {
+            case Operation::kSubstituteInstruction:
+                target_id = PickInstruction(**function, [](llvm::Instruction &instruction) {
+                    return instruction.getType()->isIntegerTy();
+                });
+                break;
+            case Operation::kInline:
+                target_id = PickInstruction(**function, [](llvm::Instruction &instruction) {
+                    auto call_base = llvm::dyn_cast<llvm::CallBase>(&instruction);
+                    return call_base && call_base->getCalledFunction();
+                });
+                break;
+            case Operation::kDevirtualize:
+                target_id = PickInstruction(**function, [](llvm::Instruction &instruction) {
+                    auto call_base = llvm::dyn_cast<llvm::CallBase>(&instruction);
+                    return call_base && call_base->isIndirectCall();
+                });
+                break;
+            default:
+                break;
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        switch (operation) {
+            case Operation::kForEachFunction: {
+                size_t count = 0;
+                explorer.ForEachFunction([&count](magnifier::ValueId, llvm::Function &, magnifier::FunctionKind) { count++; });
+                break;
+            }
+            case Operation::kPrintFunction:
+                explorer.PrintFunction(function_id, llvm::nulls());
+                break;
+            case Operation::kSubstituteInstruction: {
+                if (target_id == magnifier::kInvalidValueId) {
+                    return std::nullopt;
+                }
+                start = std::chrono::steady_clock::now();
+                auto result = explorer.SubstituteInstructionWithValue(target_id, random() % 1000, observer);
+                AddVersion(result.Succeeded() ? result.Value() : magnifier::kInvalidValueId);
+                break;
+            }
+            case Operation::kSubstituteArgument: {
+                magnifier::ValueId argument_id = function_id + 1 + random() % (*function)->arg_size();
+                auto result = explorer.SubstituteArgumentWithValue(argument_id, random() % 1000, observer);
+                AddVersion(result.Succeeded() ? result.Value() : magnifier::kInvalidValueId);
+                break;
+            }
+            case Operation::kInline: {
+                if (target_id == magnifier::kInvalidValueId) {
+                    return std::nullopt;
+                }
+                start = std::chrono::steady_clock::now();
+                auto result = explorer.InlineFunctionCall(target_id, resolver, observer);
+                AddVersion(result.Succeeded() ? result.Value() : magnifier::kInvalidValueId);
+                break;
+            }
+            case Operation::kDevirtualize: {
+                if (target_id == magnifier::kInvalidValueId) {
+                    return std::nullopt;
+                }
+                magnifier::ValueId callee_id = Pick(functions);
+                start = std::chrono::steady_clock::now();
+                auto result = explorer.DevirtualizeFunction(target_id, callee_id, observer);
+                AddVersion(result.Succeeded() ? result.Value() : magnifier::kInvalidValueId);
+                break;
+            }
+            case Operation::kOptimize: {
+                auto result = explorer.OptimizeFunction(function_id, llvm::OptimizationLevel::O1);
+                AddVersion(result.Succeeded() ? result.Value() : magnifier::kInvalidValueId);
+                break;
+            }
+            case Operation::kDelete: {
+                if (!explorer.DeleteFunction(function_id)) {
+                    std::erase(functions, function_id);
+                }
+                break;
+            }
+            case Operation::kSliceFunction: {
+                llvm::ValueToValueMapTy value_map;
+                std::unique_ptr<llvm::Module> slice = magnifier::SliceFunction(**function, value_map);
+                break;
+            }
+        }
+        return std::chrono::steady_clock::now() - start;
+    }
+
+    void WriteHeader(llvm::raw_ostream &output) {
+        output << "operations,functions";
+        for (const char *name : kOperationNames) {
+            output << "," << name << "_us";
+        }
+        output << ",rss_kib,heap_kib\n";
+    }
+
+    void WriteRow(llvm::raw_ostream &output, unsigned operation_count) {
+        output << operation_count << "," << functions.size();
+        for (Window &window : windows) {
+            output << ",";
+            if (window.count != 0) {
+                output << llvm::formatv("{0:f1}", window.total.count() / 1000.0 / window.count);
+            }
+            window = {};
+        }
+        output << "," << GetResidentKib() << "," << GetAllocatedBytes() / 1024 << "\n";
+        output.flush();
+    }
+
+public:
+    explicit HistoryReplay(const HistoryOptions &options)
+        : options(options), random(options.seed), explorer(context) {
+        GeneratorOptions generator_options;
+        generator_options.function_count = options.function_count;
+        generator_options.function_size = options.function_size;
+        generator_options.call_depth = options.call_depth;
+        generator_options.seed = options.seed;
+        explorer.TakeModule(GenerateModule(context, generator_options));
+        explorer.SetVerificationPolicy({options.verification});
+        explorer.ForEachFunction([this](magnifier::ValueId function_id, llvm::Function &, magnifier::FunctionKind) {
+            functions.push_back(function_id);
+        });
+    }
+
+    void Replay(llvm::raw_ostream &output) {
+        std::discrete_distribution<unsigned> pick_operation(kOperationWeights.begin(), kOperationWeights.end());
+        unsigned sample_interval = std::max(1u, options.sample_interval);
+
+        WriteHeader(output);
+        WriteRow(output, 0);
+        unsigned operation_count = 0;
+        while (operation_count < options.operation_count && !functions.empty()) {
+            auto operation = static_cast<Operation>(pick_operation(random));
+            std::optional<std::chrono::nanoseconds> latency = Run(operation);
+            if (!latency) {
+                continue;
+            }
+
+            Window &window = windows[static_cast<size_t>(operation)];
+            window.total += *latency;
+            window.count++;
+            if (++operation_count % sample_interval == 0) {
+                WriteRow(output, operation_count);
+            }
+        }
+    }
+};
+
+}
+
+void RunHistoryBenchmark(const HistoryOptions &options, llvm::raw_ostream &output) {
+    HistoryReplay(options).Replay(output);
+}
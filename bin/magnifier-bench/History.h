@@ -0,0 +1,38 @@
+/*
+ * Copyright (c) 2021-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <magnifier/BitcodeExplorer.h>
+
+#include <cstdint>
+
+namespace llvm {
+class raw_ostream;
+}
+
+struct HistoryOptions {
+    // Number of random operations to replay.
+    unsigned operation_count{1000};
+    // Number of operations between two rows of output.
+    unsigned sample_interval{100};
+    // Shape of the module the operations start from.
+    unsigned function_count{64};
+    unsigned function_size{64};
+    unsigned call_depth{4};
+    magnifier::VerificationLevel verification{magnifier::VerificationLevel::kFunction};
+    uint64_t seed{0};
+};
+
+// Replay a random sequence of explorer operations on a generated module and
+// write, every `sample_interval` operations, the mean latency of each kind of
+// operation since the last row together with the number of functions and the
+// memory in use, as CSV to `output`. Every operation can pick any function
+// created so far, so the rows show how latency and memory scale with the
+// length of the session's history.
+void RunHistoryBenchmark(const HistoryOptions &options, llvm::raw_ostream &output);
@@ -0,0 +1,20 @@
+/*
+ * Copyright (c) 2021-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstddef>
+
+// Bytes currently allocated with malloc.
+size_t GetAllocatedBytes();
+
+// Resident set size of the process in KiB.
+size_t GetResidentKib();
+
+// Peak resident set size of the process in KiB.
+size_t GetPeakRssKib();
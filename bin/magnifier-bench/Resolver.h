@@ -0,0 +1,20 @@
+/*
+ * Copyright (c) 2021-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <magnifier/IFunctionResolver.h>
+
+// Resolves every call to the function it calls directly, so that indirect
+// calls are left alone.
+class FunctionResolver : public magnifier::IFunctionResolver {
+public:
+    llvm::Function *ResolveCallSite(llvm::CallBase *, llvm::Function *called_function) override {
+        return called_function;
+    }
+};
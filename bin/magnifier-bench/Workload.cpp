@@ -0,0 +1,92 @@
+/*
+ * Copyright (c) 2021-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#include "Workload.h"
+
+#include <llvm/IR/DerivedTypes.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+
+#include <vector>
+
+namespace {
+
+// Fill `function` with `size` arithmetic instructions over its arguments,
+// calling `callee` halfway through if it is given.
+void BuildArithmeticChain(llvm::Function *function, unsigned size, llvm::Function *callee) {
+    llvm::LLVMContext &context = function->getContext();
+    llvm::IRBuilder<> builder(llvm::BasicBlock::Create(context, "entry", function));
+
+    std::vector<llvm::Value *> values = {function->getArg(0), function->getArg(1)};
+    for (unsigned i = 0; i < size; ++i) {
+        llvm::Value *lhs = values[values.size() - 1];
+        llvm::Value *rhs = values[values.size() - 2];
+        if (callee && i == size / 2) {
+            values.push_back(builder.CreateCall(callee, {lhs, rhs}));
+            continue;
+        }
+
+        // Alternate between operations so that substituted values fold all
+        // the way down the chain.
+        switch (i % 4) {
+            case 0:
+                values.push_back(builder.CreateAdd(lhs, rhs));
+                break;
+            case 1:
+                values.push_back(builder.CreateMul(lhs, builder.getInt32(i + 3)));
+                break;
+            case 2:
+                values.push_back(builder.CreateXor(lhs, rhs));
+                break;
+            default:
+                values.push_back(builder.CreateSub(lhs, builder.getInt32(i)));
+                break;
+        }
+    }
+
+    if (callee && size == 0) {
+        values.push_back(builder.CreateCall(callee, {values[0], values[1]}));
+    }
+    builder.CreateRet(values.back());
+}
+
+}
+
+std::string GetLevelFunctionName(unsigned level) {
+    return "level_" + std::to_string(level);
+}
+
+std::unique_ptr<llvm::Module> BuildWorkload(llvm::LLVMContext &context, const WorkloadShape &shape) {
+    auto module = std::make_unique<llvm::Module>("workload", context);
+    llvm::Type *int_type = llvm::Type::getInt32Ty(context);
+    llvm::FunctionType *function_type = llvm::FunctionType::get(int_type, {int_type, int_type}, false);
+
+    llvm::Function *callee = nullptr;
+    for (unsigned level = 0; level < shape.call_depth; ++level) {
+        llvm::Function *function = llvm::Function::Create(
+                function_type, llvm::GlobalValue::ExternalLinkage, GetLevelFunctionName(level), *module);
+        BuildArithmeticChain(function, shape.function_size, callee);
+        callee = function;
+    }
+
+    llvm::Function *entry = llvm::Function::Create(
+            function_type, llvm::GlobalValue::ExternalLinkage, kEntryFunctionName, *module);
+    BuildArithmeticChain(entry, shape.function_size, callee);
+
+    llvm::FunctionType *dispatch_type =
+            llvm::FunctionType::get(int_type, {function_type->getPointerTo(), int_type}, false);
+    llvm::Function *dispatch = llvm::Function::Create(
+            dispatch_type, llvm::GlobalValue::ExternalLinkage, kDispatchFunctionName, *module);
+    llvm::IRBuilder<> builder(llvm::BasicBlock::Create(context, "entry", dispatch));
+    llvm::Value *argument = dispatch->getArg(1);
+    builder.CreateRet(builder.CreateCall(function_type, dispatch->getArg(0), {argument, argument}));
+
+    return module;
+}
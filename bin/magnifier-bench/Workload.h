@@ -0,0 +1,38 @@
+/*
+ * Copyright (c) 2021-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <memory>
+#include <string>
+
+namespace llvm {
+class LLVMContext;
+class Module;
+}
+
+// The shape of a module built by `BuildWorkload`.
+struct WorkloadShape {
+    // Number of arithmetic instructions in every function.
+    unsigned function_size{64};
+    // Length of the call chain below the entry function.
+    unsigned call_depth{4};
+};
+
+// Every workload module has an `entry` function calling `level_<depth - 1>`,
+// which calls `level_<depth - 2>` and so on down to `level_0`. Each function
+// takes two `i32` arguments and computes a chain of integer arithmetic on
+// them, calling the next level halfway through. A `dispatch` function makes a
+// single indirect call through its first argument, which can be
+// devirtualized to any of the levels.
+static constexpr const char *kEntryFunctionName = "entry";
+static constexpr const char *kDispatchFunctionName = "dispatch";
+
+std::string GetLevelFunctionName(unsigned level);
+
+std::unique_ptr<llvm::Module> BuildWorkload(llvm::LLVMContext &context, const WorkloadShape &shape);
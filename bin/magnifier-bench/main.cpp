@@ -0,0 +1,294 @@
+/*
+ * Copyright (c) 2021-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#include <magnifier/BitcodeExplorer.h>
+
+#include <magnifier/ISubstitutionObserver.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/InstIterator.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/FormatVariadic.h>
+#include <llvm/Support/InitLLVM.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "History.h"
+#include "Memory.h"
+#include "Resolver.h"
+#include "Workload.h"
+
+namespace {
+
+llvm::cl::list<unsigned> sizes("sizes", llvm::cl::desc("Instructions per function"), llvm::cl::CommaSeparated);
+llvm::cl::list<unsigned> depths("depths", llvm::cl::desc("Call depths below the entry function"), llvm::cl::CommaSeparated);
+llvm::cl::opt<unsigned> iterations("iterations", llvm::cl::desc("Measured iterations per case"), llvm::cl::init(20));
+llvm::cl::opt<std::string> filter("filter", llvm::cl::desc("Only run benchmarks whose name contains this string"));
+llvm::cl::opt<unsigned> history("history", llvm::cl::desc("Replay this many random operations instead and report how "
+                                                          "latency and memory grow with the session's history"),
+                                llvm::cl::init(0));
+llvm::cl::opt<unsigned> sample_interval("sample-interval", llvm::cl::desc("Operations between rows of --history output"),
+                                        llvm::cl::init(100));
+llvm::cl::opt<unsigned> history_functions("history-functions", llvm::cl::desc("Functions in the --history module"),
+                                          llvm::cl::init(64));
+llvm::cl::opt<uint64_t> seed("seed", llvm::cl::desc("Random seed of --history"), llvm::cl::init(0));
+llvm::cl::opt<magnifier::VerificationLevel> verification(
+        "verify", llvm::cl::desc("Verification level of --history"), llvm::cl::init(magnifier::VerificationLevel::kFunction),
+        llvm::cl::values(clEnumValN(magnifier::VerificationLevel::kOff, "off", "No verification"),
+                         clEnumValN(magnifier::VerificationLevel::kSampled, "sampled", "Verify some new versions"),
+                         clEnumValN(magnifier::VerificationLevel::kFunction, "function", "Verify every new version"),
+                         clEnumValN(magnifier::VerificationLevel::kModule, "module", "Verify whole modules")));
+
+// An explorer with a workload module taken, and the ids the benchmarks work on.
+struct Session {
+    magnifier::BitcodeExplorer explorer;
+    magnifier::ValueId entry_id{magnifier::kInvalidValueId};
+    magnifier::ValueId dispatch_id{magnifier::kInvalidValueId};
+    // The call to the next level in `entry`, if the call depth is not zero.
+    magnifier::ValueId call_id{magnifier::kInvalidValueId};
+    // The first instruction of `entry`.
+    magnifier::ValueId instruction_id{magnifier::kInvalidValueId};
+    // The indirect call in `dispatch`.
+    magnifier::ValueId indirect_call_id{magnifier::kInvalidValueId};
+
+    Session(llvm::LLVMContext &context, const WorkloadShape &shape) : explorer(context) {
+        explorer.TakeModule(BuildWorkload(context, shape));
+        explorer.ForEachFunction([this](magnifier::ValueId function_id, llvm::Function &function, magnifier::FunctionKind) {
+            if (function.getName() == kEntryFunctionName) {
+                entry_id = function_id;
+                instruction_id = explorer.GetId(*llvm::inst_begin(function), magnifier::ValueIdKind::kDerived);
+                for (llvm::Instruction &instruction : llvm::instructions(function)) {
+                    if (llvm::isa<llvm::CallBase>(instruction)) {
+                        call_id = explorer.GetId(instruction, magnifier::ValueIdKind::kDerived);
+                    }
+                }
+            } else if (function.getName() == kDispatchFunctionName) {
+                dispatch_id = function_id;
+                indirect_call_id = explorer.GetId(*llvm::inst_begin(function), magnifier::ValueIdKind::kDerived);
+            }
+        });
+    }
+};
+
+// Runs one iteration of a benchmark and returns the time spent in the
+// measured operation. Anything else the iteration needs is left out.
+using Iteration = std::function<std::chrono::nanoseconds(llvm::LLVMContext &, const WorkloadShape &, Session &)>;
+
+struct Benchmark {
+    const char *name;
+    Iteration iteration;
+    // Skip shapes the benchmark cannot run on.
+    bool needs_call{false};
+};
+
+template <typename Callable>
+std::chrono::nanoseconds Measure(Callable &&callable) {
+    auto start = std::chrono::steady_clock::now();
+    callable();
+    return std::chrono::steady_clock::now() - start;
+}
+
+const std::vector<Benchmark> &GetBenchmarks() {
+    static magnifier::NullSubstitutionObserver observer;
+    static FunctionResolver resolver;
+    static const std::vector<Benchmark> benchmarks = {
+            {"TakeModule", [](llvm::LLVMContext &context, const WorkloadShape &shape, Session &) {
+                magnifier::BitcodeExplorer explorer(context);
+                std::unique_ptr<llvm::Module> module = BuildWorkload(context, shape);
+                return Measure([&] { explorer.TakeModule(std::move(module)); });
+            }},
+            {"ForEachFunction", [](llvm::LLVMContext &, const WorkloadShape &, Session &session) {
+                size_t count = 0;
+                return Measure([&] {
+                    session.explorer.ForEachFunction([&count](magnifier::ValueId, llvm::Function &, magnifier::FunctionKind) { count++; });
+                });
+            }},
+            {"PrintFunction", [](llvm::LLVMContext &, const WorkloadShape &, Session &session) {
+                return Measure([&] { session.explorer.PrintFunction(session.entry_id, llvm::nulls()); });
+            }},
+            {"InlineFunctionCall", [](llvm::LLVMContext &, const WorkloadShape &, Session &session) {
+                return Measure([&] {
+                    auto result = session.explorer.InlineFunctionCall(session.call_id, resolver, observer);
+                    result.Succeeded();
+                });
+            }, true},
+            {"SubstituteInstructionWithValue", [](llvm::LLVMContext &, const WorkloadShape &, Session &session) {
+                return Measure([&] {
+                    auto result = session.explorer.SubstituteInstructionWithValue(session.instruction_id, 7, observer);
+                    result.Succeeded();
+                });
+            }},
+            {"SubstituteArgumentWithValue", [](llvm::LLVMContext &, const WorkloadShape &, Session &session) {
+                return Measure([&] {
+                    auto result = session.explorer.SubstituteArgumentWithValue(session.entry_id + 1, 7, observer);
+                    result.Succeeded();
+                });
+            }},
+            {"OptimizeFunction", [](llvm::LLVMContext &, const WorkloadShape &, Session &session) {
+                return Measure([&] {
+                    auto result = session.explorer.OptimizeFunction(session.entry_id, llvm::OptimizationLevel::O2);
+                    result.Succeeded();
+                });
+            }},
+            {"DevirtualizeFunction", [](llvm::LLVMContext &, const WorkloadShape &, Session &session) {
+                return Measure([&] {
+                    auto result = session.explorer.DevirtualizeFunction(session.indirect_call_id, session.entry_id, observer);
+                    result.Succeeded();
+                });
+            }},
+            {"DeleteFunction", [](llvm::LLVMContext &, const WorkloadShape &, Session &session) {
+                auto result = session.explorer.SubstituteArgumentWithValue(session.entry_id + 1, 7, observer);
+                if (!result.Succeeded()) {
+                    return std::chrono::nanoseconds(0);
+                }
+                return Measure([&] { session.explorer.DeleteFunction(result.Value()); });
+            }},
+    };
+    return benchmarks;
+}
+
+struct CaseResult {
+    double median_us{0};
+    double mean_us{0};
+    size_t peak_rss_kib{0};
+    // Memory still held once the explorer and its modules are destroyed, i.e.
+    // what the benchmark left behind in the `LLVMContext`.
+    int64_t context_growth_kib{0};
+};
+
+CaseResult RunCase(const Benchmark &benchmark, const WorkloadShape &shape) {
+    CaseResult result;
+    std::vector<std::chrono::nanoseconds> samples;
+
+    llvm::LLVMContext context;
+    size_t allocated_before = GetAllocatedBytes();
+    {
+        Session session(context, shape);
+        // One untimed run to build pipelines, hook functions and the like.
+        benchmark.iteration(context, shape, session);
+        for (unsigned i = 0; i < iterations; ++i) {
+            samples.push_back(benchmark.iteration(context, shape, session));
+        }
+    }
+    result.context_growth_kib = (static_cast<int64_t>(GetAllocatedBytes()) - static_cast<int64_t>(allocated_before)) / 1024;
+    result.peak_rss_kib = GetPeakRssKib();
+
+    std::sort(samples.begin(), samples.end());
+    std::chrono::nanoseconds total{0};
+    for (std::chrono::nanoseconds sample : samples) {
+        total += sample;
+    }
+    if (!samples.empty()) {
+        result.median_us = samples[samples.size() / 2].count() / 1000.0;
+        result.mean_us = total.count() / 1000.0 / samples.size();
+    }
+    return result;
+}
+
+// Run the case in a child process, so that peak RSS and allocator state are
+// not affected by the cases that ran before.
+std::optional<CaseResult> RunCaseIsolated(const Benchmark &benchmark, const WorkloadShape &shape) {
+    int fds[2];
+    if (pipe(fds) != 0) {
+        return std::nullopt;
+    }
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        close(fds[0]);
+        close(fds[1]);
+        return std::nullopt;
+    }
+    if (pid == 0) {
+        close(fds[0]);
+        CaseResult result = RunCase(benchmark, shape);
+        bool written = write(fds[1], &result, sizeof(result)) == sizeof(result);
+        _exit(written ? 0 : 1);
+    }
+
+    close(fds[1]);
+    CaseResult result;
+    bool read_all = read(fds[0], &result, sizeof(result)) == sizeof(result);
+    close(fds[0]);
+
+    int status = 0;
+    waitpid(pid, &status, 0);
+    if (!read_all || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        return std::nullopt;
+    }
+    return result;
+}
+
+}
+
+int main(int argc, char **argv) {
+    llvm::InitLLVM x(argc, argv);
+    llvm::cl::ParseCommandLineOptions(argc, argv, "magnifier benchmarks\n");
+
+    if (history != 0) {
+        HistoryOptions options;
+        options.operation_count = history;
+        options.sample_interval = sample_interval;
+        options.function_count = history_functions;
+        options.function_size = sizes.empty() ? options.function_size : sizes.front();
+        options.call_depth = depths.empty() ? options.call_depth : depths.front();
+        options.verification = verification;
+        options.seed = seed;
+        RunHistoryBenchmark(options, llvm::outs());
+        return 0;
+    }
+
+    std::vector<unsigned> function_sizes(sizes.begin(), sizes.end());
+    if (function_sizes.empty()) {
+        function_sizes = {16, 256, 4096};
+    }
+    std::vector<unsigned> call_depths(depths.begin(), depths.end());
+    if (call_depths.empty()) {
+        call_depths = {1, 8};
+    }
+
+    llvm::outs() << llvm::formatv("{0,-32} {1,6} {2,6} {3,12} {4,12} {5,14} {6,16}\n", "benchmark", "size", "depth",
+                                  "median us", "mean us", "peak rss KiB", "context KiB");
+    for (const Benchmark &benchmark : GetBenchmarks()) {
+        if (!filter.empty() && std::string(benchmark.name).find(filter) == std::string::npos) {
+            continue;
+        }
+
+        for (unsigned function_size : function_sizes) {
+            for (unsigned call_depth : call_depths) {
+                WorkloadShape shape{function_size, call_depth};
+                if (benchmark.needs_call && call_depth == 0) {
+                    continue;
+                }
+
+                std::optional<CaseResult> result = RunCaseIsolated(benchmark, shape);
+                if (!result) {
+                    llvm::outs() << llvm::formatv("{0,-32} {1,6} {2,6} failed\n", benchmark.name, function_size, call_depth);
+                    continue;
+                }
+                llvm::outs() << llvm::formatv("{0,-32} {1,6} {2,6} {3,12:f1} {4,12:f1} {5,14} {6,16}\n", benchmark.name,
+                                              function_size, call_depth, result->median_us, result->mean_us,
+                                              result->peak_rss_kib, result->context_growth_kib);
+                llvm::outs().flush();
+            }
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,170 @@
+/*
+ * Copyright (c) 2021-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#include "Generator.h"
+
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/DerivedTypes.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/GlobalVariable.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+
+#include <algorithm>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+// Upper bound on the number of functions in a table of indirect call targets.
+constexpr unsigned kMaxTableSize = 16;
+
+class ModuleGenerator {
+    const GeneratorOptions &options;
+    std::mt19937_64 random;
+    llvm::Module &module;
+    llvm::FunctionType *function_type;
+    std::vector<llvm::Function *> functions;
+    // The first function of every level, followed by `functions.size()`.
+    std::vector<size_t> level_begin;
+    // Indirect call targets of every level. Root functions are never called,
+    // so the first level has no table.
+    std::vector<llvm::GlobalVariable *> tables;
+
+    uint64_t RandomBetween(uint64_t low, uint64_t high) {
+        return std::uniform_int_distribution<uint64_t>(low, high)(random);
+    }
+
+    void CreateFunctions() {
+        unsigned level_count = std::max(1u, std::min(options.call_depth + 1, options.function_count));
+        for (unsigned level = 0; level <= level_count; ++level) {
+            level_begin.push_back(uint64_t(level) * options.function_count / level_count);
+        }
+
+        functions.reserve(options.function_count);
+        for (unsigned i = 0; i < options.function_count; ++i) {
+            functions.push_back(llvm::Function::Create(
+                    function_type, llvm::GlobalValue::ExternalLinkage, "fn_" + std::to_string(i), module));
+        }
+    }
+
+    void CreateTables() {
+        llvm::PointerType *pointer_type = function_type->getPointerTo();
+        tables.push_back(nullptr);
+        for (size_t level = 1; level + 1 < level_begin.size(); ++level) {
+            std::vector<llvm::Constant *> targets;
+            size_t size = std::min<size_t>(kMaxTableSize, level_begin[level + 1] - level_begin[level]);
+            for (size_t i = 0; i < size; ++i) {
+                targets.push_back(functions[RandomBetween(level_begin[level], level_begin[level + 1] - 1)]);
+            }
+
+            llvm::ArrayType *table_type = llvm::ArrayType::get(pointer_type, targets.size());
+            tables.push_back(new llvm::GlobalVariable(
+                    module, table_type, true, llvm::GlobalValue::InternalLinkage,
+                    llvm::ConstantArray::get(table_type, targets), "table_" + std::to_string(level)));
+        }
+    }
+
+    llvm::Value *CreateCall(llvm::IRBuilder<> &builder, size_t callee_level, llvm::Value *lhs, llvm::Value *rhs) {
+        std::bernoulli_distribution indirect(options.indirect_call_density);
+        if (!indirect(random)) {
+            llvm::Function *callee =
+                    functions[RandomBetween(level_begin[callee_level], level_begin[callee_level + 1] - 1)];
+            return builder.CreateCall(callee, {lhs, rhs});
+        }
+
+        llvm::GlobalVariable *table = tables[callee_level];
+        uint64_t table_size = table->getValueType()->getArrayNumElements();
+        llvm::Value *index = builder.CreateURem(lhs, builder.getInt32(table_size));
+        llvm::Value *slot = builder.CreateInBoundsGEP(
+                table->getValueType(), table, {builder.getInt32(0), index});
+        llvm::Value *callee = builder.CreateLoad(function_type->getPointerTo(), slot);
+        return builder.CreateCall(function_type, callee, {lhs, rhs});
+    }
+
+    llvm::Value *CreateArithmetic(llvm::IRBuilder<> &builder, llvm::Value *value) {
+        switch (RandomBetween(0, 5)) {
+            case 0:
+                return builder.CreateAdd(value, builder.getInt32(RandomBetween(1, 1000)));
+            case 1:
+                return builder.CreateSub(value, builder.getInt32(RandomBetween(1, 1000)));
+            case 2:
+                return builder.CreateMul(value, builder.getInt32(RandomBetween(2, 17)));
+            case 3:
+                return builder.CreateXor(value, builder.getInt32(RandomBetween(1, 0xffff)));
+            case 4:
+                return builder.CreateShl(value, builder.getInt32(RandomBetween(1, 7)));
+            default:
+                return builder.CreateOr(value, builder.getInt32(RandomBetween(1, 0xff)));
+        }
+    }
+
+    void BuildBody(llvm::Function *function, size_t level) {
+        llvm::IRBuilder<> builder(llvm::BasicBlock::Create(module.getContext(), "entry", function));
+        bool has_callees = level + 2 < level_begin.size();
+        unsigned call_count = has_callees ? std::min(options.fan_out, options.function_size) : 0;
+        unsigned chain_length = std::max(1u, options.chain_length);
+
+        llvm::Value *current = function->getArg(0);
+        llvm::Value *previous = function->getArg(1);
+        unsigned next_call = 0;
+        unsigned chain_position = 0;
+        unsigned chain_count = 0;
+        for (unsigned i = 0; i < options.function_size; ++i) {
+            // Spread the calls evenly over the body.
+            if (next_call < call_count &&
+                i == uint64_t(next_call + 1) * options.function_size / (call_count + 1)) {
+                llvm::Value *result = CreateCall(builder, level + 1, current, previous);
+                previous = current;
+                current = result;
+                next_call++;
+                continue;
+            }
+
+            if (chain_position == chain_length) {
+                // Start a new chain from an argument, combined with the result
+                // of the chain before it.
+                previous = current;
+                current = builder.CreateAdd(function->getArg(++chain_count % 2), previous);
+                chain_position = 1;
+                continue;
+            }
+
+            current = CreateArithmetic(builder, current);
+            chain_position++;
+        }
+        builder.CreateRet(current);
+    }
+
+public:
+    ModuleGenerator(const GeneratorOptions &options, llvm::Module &module)
+        : options(options), random(options.seed), module(module) {
+        llvm::Type *int_type = llvm::Type::getInt32Ty(module.getContext());
+        function_type = llvm::FunctionType::get(int_type, {int_type, int_type}, false);
+    }
+
+    void Generate() {
+        CreateFunctions();
+        CreateTables();
+        for (size_t level = 0; level + 1 < level_begin.size(); ++level) {
+            for (size_t i = level_begin[level]; i < level_begin[level + 1]; ++i) {
+                BuildBody(functions[i], level);
+            }
+        }
+    }
+};
+
+}
+
+std::unique_ptr<llvm::Module> GenerateModule(llvm::LLVMContext &context, const GeneratorOptions &options) {
+    auto module = std::make_unique<llvm::Module>("generated", context);
+    ModuleGenerator(options, *module).Generate();
+    return module;
+}
@@ -0,0 +1,43 @@
+/*
+ * Copyright (c) 2021-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+
+namespace llvm {
+class LLVMContext;
+class Module;
+}
+
+struct GeneratorOptions {
+    // Number of functions in the module.
+    unsigned function_count{1000};
+    // Number of arithmetic instructions and calls in every function. Indirect
+    // calls add a few instructions to load the callee on top of this.
+    unsigned function_size{64};
+    // Number of calls made by every function that is not a leaf.
+    unsigned fan_out{2};
+    // Number of call graph levels below the root functions.
+    unsigned call_depth{4};
+    // Fraction of calls, from 0 to 1, that go through a function pointer.
+    double indirect_call_density{0.1};
+    // Number of instructions in a chain of dependent arithmetic on constants.
+    // Chains start from an argument, so substituting the arguments of a
+    // function folds whole chains.
+    unsigned chain_length{16};
+    uint64_t seed{0};
+};
+
+// Generate a module of `fn_<n>` functions taking and returning `i32`s. The
+// functions are split evenly between `call_depth + 1` levels, and each
+// function calls `fan_out` random functions of the next level, so the call
+// graph is acyclic. Indirect calls load their callee from the `table_<level>`
+// global holding functions of the level being called.
+std::unique_ptr<llvm::Module> GenerateModule(llvm::LLVMContext &context, const GeneratorOptions &options);
@@ -0,0 +1,84 @@
+/*
+ * Copyright (c) 2021-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/Verifier.h>
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/InitLLVM.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <memory>
+#include <string>
+#include <system_error>
+
+#include "Generator.h"
+
+namespace {
+
+llvm::cl::opt<std::string> output_path("o", llvm::cl::desc("Output file"), llvm::cl::value_desc("path"),
+                                       llvm::cl::init("generated.bc"));
+llvm::cl::opt<bool> emit_text("S", llvm::cl::desc("Write textual IR instead of bitcode"));
+llvm::cl::opt<unsigned> functions("functions", llvm::cl::desc("Number of functions"), llvm::cl::init(1000));
+llvm::cl::opt<unsigned> instructions("instructions", llvm::cl::desc("Instructions per function"), llvm::cl::init(64));
+llvm::cl::opt<unsigned> fan_out("fan-out", llvm::cl::desc("Calls made by every non-leaf function"), llvm::cl::init(2));
+llvm::cl::opt<unsigned> depth("depth", llvm::cl::desc("Call graph levels below the roots"), llvm::cl::init(4));
+llvm::cl::opt<double> indirect_calls("indirect-calls", llvm::cl::desc("Fraction of calls made through a pointer"),
+                                     llvm::cl::init(0.1));
+llvm::cl::opt<unsigned> chain_length("chain-length", llvm::cl::desc("Length of dependent arithmetic chains"),
+                                     llvm::cl::init(16));
+llvm::cl::opt<uint64_t> seed("seed", llvm::cl::desc("Random seed"), llvm::cl::init(0));
+
+}
+
+int main(int argc, char **argv) {
+    llvm::InitLLVM x(argc, argv);
+    llvm::cl::ParseCommandLineOptions(argc, argv, "magnifier synthetic bitcode generator\n");
+
+    if (functions == 0) {
+        llvm::errs() << "At least one function is required\n";
+        return 1;
+    }
+    if (indirect_calls < 0 || indirect_calls > 1) {
+        llvm::errs() << "Indirect call density must be between 0 and 1\n";
+        return 1;
+    }
+
+    GeneratorOptions options;
+    options.function_count = functions;
+    options.function_size = instructions;
+    options.fan_out = fan_out;
+    options.call_depth = depth;
+    options.indirect_call_density = indirect_calls;
+    options.chain_length = chain_length;
+    options.seed = seed;
+
+    llvm::LLVMContext context;
+    std::unique_ptr<llvm::Module> module = GenerateModule(context, options);
+    if (llvm::verifyModule(*module, &llvm::errs())) {
+        llvm::errs() << "Generated module is invalid\n";
+        return 1;
+    }
+
+    std::error_code error_code;
+    llvm::raw_fd_ostream output(output_path, error_code,
+                                emit_text ? llvm::sys::fs::OF_TextWithCRLF : llvm::sys::fs::OF_None);
+    if (error_code) {
+        llvm::errs() << "Unable to open " << output_path << ": " << error_code.message() << "\n";
+        return 1;
+    }
+
+    if (emit_text) {
+        module->print(output, nullptr);
+    } else {
+        llvm::WriteBitcodeToFile(*module, output);
+    }
+    return 0;
+}
@@ -0,0 +1,79 @@
+/*
+ * Copyright (c) 2021-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#include "ChunkedUpload.h"
+
+#include <llvm/Bitcode/BitcodeReader.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/IRReader/IRReader.h>
+#include <llvm/Support/Error.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/SHA256.h>
+#include <llvm/Support/SourceMgr.h>
+
+#include <cstring>
+
+ChunkedUpload::ChunkedUpload(size_t size, bool lazy)
+    : buffer(llvm::WritableMemoryBuffer::getNewUninitMemBuffer(size, "upload")), lazy(lazy) {}
+
+ChunkedUpload::~ChunkedUpload() = default;
+
+size_t ChunkedUpload::Size() const {
+    return buffer ? buffer->getBufferSize() : 0;
+}
+
+bool ChunkedUpload::Append(std::string_view chunk) {
+    if (!buffer || chunk.size() > buffer->getBufferSize() - received) {
+        return false;
+    }
+    std::memcpy(buffer->getBufferStart() + received, chunk.data(), chunk.size());
+    received += chunk.size();
+    return true;
+}
+
+bool ChunkedUpload::IsBitcode() const {
+    return buffer && llvm::isBitcode(reinterpret_cast<const unsigned char *>(buffer->getBufferStart()),
+                                     reinterpret_cast<const unsigned char *>(buffer->getBufferEnd()));
+}
+
+std::string ChunkedUpload::Digest() const {
+    if (!buffer || !IsComplete()) {
+        return "";
+    }
+    return llvm::toHex(llvm::SHA256::hash(llvm::arrayRefFromStringRef(buffer->getMemBufferRef().getBuffer())), true);
+}
+
+std::unique_ptr<llvm::Module> ChunkedUpload::Load(llvm::LLVMContext &context) {
+    if (!buffer || !IsComplete()) {
+        return nullptr;
+    }
+
+    if (lazy) {
+        // The module owns the buffer and reads bodies from it as they are needed
+        auto module = llvm::getOwningLazyBitcodeModule(std::move(buffer), context, true);
+        if (!module) {
+            llvm::consumeError(module.takeError());
+            return nullptr;
+        }
+        return std::move(*module);
+    }
+
+    llvm::SMDiagnostic diagnostic;
+    std::unique_ptr<llvm::Module> module = llvm::parseIR(buffer->getMemBufferRef(), diagnostic, context);
+    buffer.reset();
+    return module;
+}
+
+std::unique_ptr<llvm::MemoryBuffer> ChunkedUpload::TakeBuffer() {
+    if (!IsComplete()) {
+        return nullptr;
+    }
+    return std::move(buffer);
+}
@@ -0,0 +1,61 @@
+/*
+ * Copyright (c) 2021-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <string_view>
+
+namespace llvm {
+class LLVMContext;
+class MemoryBuffer;
+class Module;
+class WritableMemoryBuffer;
+}
+
+// A module uploaded as a sequence of binary chunks, assembled straight into a
+// buffer of the size announced up front. Nothing but the buffer is kept, so the
+// memory used does not depend on how the module is split.
+class ChunkedUpload {
+    std::unique_ptr<llvm::WritableMemoryBuffer> buffer;
+    size_t received{0};
+    // Whether function bodies are read from the buffer on first use
+    bool lazy;
+
+public:
+    ChunkedUpload(size_t size, bool lazy);
+    ~ChunkedUpload();
+
+    // False if the buffer could not be allocated
+    [[nodiscard]] bool IsValid() const { return buffer != nullptr; }
+
+    // Copy `chunk` after the bytes received so far. Returns false if it does
+    // not fit in the announced size.
+    bool Append(std::string_view chunk);
+
+    [[nodiscard]] size_t Received() const { return received; }
+    [[nodiscard]] size_t Size() const;
+    [[nodiscard]] bool IsComplete() const { return received == Size(); }
+    [[nodiscard]] bool IsLazy() const { return lazy; }
+
+    // Whether the upload holds bitcode rather than textual IR
+    [[nodiscard]] bool IsBitcode() const;
+
+    // Hex SHA-256 of the complete upload, identifying the module it holds
+    [[nodiscard]] std::string Digest() const;
+
+    // Parse the complete upload as bitcode or textual IR. Lazily loaded
+    // modules take the buffer over; otherwise it is freed once parsed.
+    // Returns nullptr if the upload is not a valid module.
+    std::unique_ptr<llvm::Module> Load(llvm::LLVMContext &context);
+
+    // Take the complete upload over, e.g. to load it with `BitcodeExplorer::LoadModule`
+    std::unique_ptr<llvm::MemoryBuffer> TakeBuffer();
+};
@@ -0,0 +1,267 @@
+/*
+ * Copyright (c) 2021-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#include "Rendering.h"
+
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/ADT/StringMap.h>
+
+#include <algorithm>
+#include <iterator>
+
+namespace {
+
+llvm::json::Array LinesToJson(const std::vector<std::string> &lines) {
+    llvm::json::Array array;
+    array.reserve(lines.size());
+    for (const std::string &line : lines) {
+        array.push_back(line);
+    }
+    return array;
+}
+
+// Ids of consecutive values are mostly consecutive too, so they are sent as [first, count] runs
+llvm::json::Array IdsToJson(const std::vector<magnifier::ValueId> &ids) {
+    llvm::json::Array runs;
+    for (size_t i = 0; i < ids.size();) {
+        size_t count = 1;
+        while (i + count < ids.size() && ids[i + count] == ids[i] + count) {
+            count++;
+        }
+        runs.push_back(llvm::json::Array{static_cast<int64_t>(ids[i]), static_cast<int64_t>(count)});
+        i += count;
+    }
+    return runs;
+}
+
+llvm::json::Array ProvenanceToJson(const std::vector<std::pair<std::string, std::string>> &provenance) {
+    llvm::json::Array array;
+    array.reserve(provenance.size());
+    for (const auto &[ir_span, code_span] : provenance) {
+        array.push_back(llvm::json::Array{ir_span, code_span});
+    }
+    return array;
+}
+
+bool LinesFromJson(const llvm::json::Array *array, std::vector<std::string> &lines) {
+    if (!array) {
+        return false;
+    }
+    for (const llvm::json::Value &line : *array) {
+        auto text = line.getAsString();
+        if (!text) {
+            return false;
+        }
+        lines.push_back(text->str());
+    }
+    return true;
+}
+
+bool IdsFromJson(const llvm::json::Array *runs, std::vector<magnifier::ValueId> &ids) {
+    if (!runs) {
+        return false;
+    }
+    for (const llvm::json::Value &run : *runs) {
+        const llvm::json::Array *bounds = run.getAsArray();
+        if (!bounds || bounds->size() != 2) {
+            return false;
+        }
+        auto first = (*bounds)[0].getAsInteger();
+        auto count = (*bounds)[1].getAsInteger();
+        if (!first || !count) {
+            return false;
+        }
+        for (int64_t i = 0; i < *count; ++i) {
+            ids.push_back(*first + i);
+        }
+    }
+    return true;
+}
+
+bool ProvenanceFromJson(const llvm::json::Array *array, std::vector<std::pair<std::string, std::string>> &provenance) {
+    if (!array) {
+        return false;
+    }
+    for (const llvm::json::Value &pair : *array) {
+        const llvm::json::Array *spans = pair.getAsArray();
+        if (!spans || spans->size() != 2 || !(*spans)[0].getAsString() || !(*spans)[1].getAsString()) {
+            return false;
+        }
+        provenance.emplace_back((*spans)[0].getAsString()->str(), (*spans)[1].getAsString()->str());
+    }
+    return true;
+}
+
+// The operations building `lines` from `base`, see `DiffRendering`. Lines are aligned on their text, which holds span
+// ids derived from source ids, so each line is matched with the one of the same value in `base`.
+llvm::json::Array DiffLines(const std::vector<std::string> &base, const std::vector<std::string> &lines) {
+    // Indices of every line of `base`, ascending
+    llvm::StringMap<std::vector<size_t>> base_indices;
+    for (size_t i = 0; i < base.size(); ++i) {
+        base_indices[base[i]].push_back(i);
+    }
+
+    llvm::json::Array operations;
+    size_t copy_start = 0;
+    size_t copy_count = 0;
+    auto flush_copy = [&operations, &copy_start, &copy_count]() {
+        if (copy_count != 0) {
+            operations.push_back(llvm::json::Array{static_cast<int64_t>(copy_start), static_cast<int64_t>(copy_count)});
+            copy_count = 0;
+        }
+    };
+
+    for (const std::string &line : lines) {
+        size_t next = copy_start + copy_count;
+        if (copy_count != 0 && next < base.size() && base[next] == line) {
+            copy_count++;
+            continue;
+        }
+        flush_copy();
+
+        auto indices = base_indices.find(line);
+        if (indices == base_indices.end()) {
+            operations.push_back(line);
+            continue;
+        }
+        // Lines such as `}` appear many times, take the first one after the last copied line to extend the run
+        auto index = std::lower_bound(indices->second.begin(), indices->second.end(), next);
+        copy_start = index != indices->second.end() ? *index : indices->second.front();
+        copy_count = 1;
+    }
+    flush_copy();
+    return operations;
+}
+
+}  // namespace
+
+std::vector<std::string> SplitLines(llvm::StringRef text) {
+    llvm::SmallVector<llvm::StringRef> parts;
+    text.split(parts, '\n', -1, true);
+    std::vector<std::string> lines;
+    lines.reserve(parts.size());
+    for (llvm::StringRef part : parts) {
+        lines.push_back(part.str());
+    }
+    return lines;
+}
+
+std::vector<std::pair<std::string, std::string>> NameCodeSpans(
+        std::string &code, const std::unordered_map<uint64_t, std::string> &ir_spans,
+        const std::vector<std::pair<uint64_t, uint64_t>> &links) {
+    // The IR span each C address was decompiled from. The smallest span id is taken when there are several, so that
+    // the choice does not depend on the order of `links`
+    std::unordered_map<uint64_t, const std::string *> anchors;
+    for (auto [first, second] : links) {
+        uint64_t code_address = second;
+        auto ir_span = ir_spans.find(first);
+        if (ir_span == ir_spans.end()) {
+            code_address = first;
+            ir_span = ir_spans.find(second);
+        }
+        if (ir_span == ir_spans.end()) {
+            continue;
+        }
+        const std::string *&anchor = anchors[code_address];
+        if (!anchor || ir_span->second < *anchor) {
+            anchor = &ir_span->second;
+        }
+    }
+
+    static constexpr llvm::StringLiteral kIdAttribute = "id=\"";
+    std::unordered_map<uint64_t, std::string> code_spans;
+    // Number of spans named after each IR span so far, spans after the first one get a suffix
+    llvm::StringMap<unsigned> anchor_uses;
+    unsigned unlinked_count = 0;
+
+    std::string named;
+    named.reserve(code.size());
+    size_t position = 0;
+    for (size_t found; (found = code.find(kIdAttribute.data(), position)) != std::string::npos;) {
+        size_t start = found + kIdAttribute.size();
+        size_t end = code.find('"', start);
+        if (end == std::string::npos) {
+            break;
+        }
+        named.append(code, position, start - position);
+        position = end;
+
+        uint64_t address;
+        if (llvm::StringRef(code).slice(start, end).getAsInteger(16, address)) {
+            named.append(code, start, end - start);
+            continue;
+        }
+
+        auto [code_span, inserted] = code_spans.try_emplace(address);
+        if (inserted) {
+            auto anchor = anchors.find(address);
+            if (anchor != anchors.end()) {
+                unsigned uses = anchor_uses[*anchor->second]++;
+                code_span->second = "c" + *anchor->second + (uses ? "-" + std::to_string(uses) : "");
+            } else {
+                code_span->second = "cn" + std::to_string(unlinked_count++);
+            }
+        }
+        named += code_span->second;
+    }
+    named.append(code, position, std::string::npos);
+    code = std::move(named);
+
+    std::vector<std::pair<std::string, std::string>> provenance;
+    for (auto [first, second] : links) {
+        auto ir_span = ir_spans.find(first);
+        auto code_span = code_spans.find(second);
+        if (ir_span == ir_spans.end()) {
+            ir_span = ir_spans.find(second);
+            code_span = code_spans.find(first);
+        }
+        if (ir_span != ir_spans.end() && code_span != code_spans.end()) {
+            provenance.emplace_back(ir_span->second, code_span->second);
+        }
+    }
+    std::sort(provenance.begin(), provenance.end());
+    provenance.erase(std::unique(provenance.begin(), provenance.end()), provenance.end());
+    return provenance;
+}
+
+llvm::json::Object RenderingToJson(const Rendering &rendering) {
+    return llvm::json::Object{{"ir", LinesToJson(rendering.ir)},
+                              {"ir_ids", IdsToJson(rendering.ir_ids)},
+                              {"code", LinesToJson(rendering.code)},
+                              {"provenance", ProvenanceToJson(rendering.provenance)}};
+}
+
+std::optional<Rendering> RenderingFromJson(const llvm::json::Value &json) {
+    const llvm::json::Object *object = json.getAsObject();
+    if (!object) {
+        return std::nullopt;
+    }
+    Rendering rendering;
+    if (!LinesFromJson(object->getArray("ir"), rendering.ir) ||
+        !IdsFromJson(object->getArray("ir_ids"), rendering.ir_ids) ||
+        !LinesFromJson(object->getArray("code"), rendering.code) ||
+        !ProvenanceFromJson(object->getArray("provenance"), rendering.provenance)) {
+        return std::nullopt;
+    }
+    return rendering;
+}
+
+llvm::json::Object DiffRendering(const Rendering &base, const Rendering &rendering) {
+    std::vector<std::pair<std::string, std::string>> added;
+    std::set_difference(rendering.provenance.begin(), rendering.provenance.end(), base.provenance.begin(),
+                        base.provenance.end(), std::back_inserter(added));
+    std::vector<std::pair<std::string, std::string>> removed;
+    std::set_difference(base.provenance.begin(), base.provenance.end(), rendering.provenance.begin(),
+                        rendering.provenance.end(), std::back_inserter(removed));
+
+    return llvm::json::Object{{"ir", DiffLines(base.ir, rendering.ir)},
+                              {"ir_ids", IdsToJson(rendering.ir_ids)},
+                              {"code", DiffLines(base.code, rendering.code)},
+                              {"provenance", llvm::json::Object{{"added", ProvenanceToJson(added)},
+                                                                {"removed", ProvenanceToJson(removed)}}}};
+}
@@ -0,0 +1,62 @@
+/*
+ * Copyright (c) 2021-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <magnifier/BitcodeExplorer.h>
+
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/JSON.h>
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Written in IR lines in place of ids. Every version has ids of its own, while the rest of a line usually stays the
+// same, so keeping them apart lets lines be shared between versions. The IR printer escapes control characters, so it
+// never appears otherwise.
+static constexpr char kIdPlaceholder = '\x1f';
+
+// The output of `dec` for one function version, split into lines so that it can be sent as a delta against another
+// version. Span ids are derived from source ids rather than addresses, so that they are the same in every version.
+struct Rendering {
+    // Lines of annotated IR, with `kIdPlaceholder` in place of each id
+    std::vector<std::string> ir;
+    // The ids of the placeholders, in order
+    std::vector<magnifier::ValueId> ir_ids;
+    // Lines of annotated C
+    std::vector<std::string> code;
+    // Pairs of the span ids of an IR value and of a C declaration or statement it was decompiled to, sorted
+    std::vector<std::pair<std::string, std::string>> provenance;
+};
+
+// Split `text` on newlines, keeping empty lines so that joining them gives `text` back
+std::vector<std::string> SplitLines(llvm::StringRef text);
+
+// Replace the addresses used as span ids in `code` with ids derived from the IR spans they were decompiled from, or
+// numbered in order of appearance if there is none. `ir_spans` gives the span ids of IR values by address and `links`
+// pairs the addresses of IR values and of C declarations and statements, in any order. Returns the provenance of the
+// spans of `code`.
+std::vector<std::pair<std::string, std::string>> NameCodeSpans(
+        std::string &code, const std::unordered_map<uint64_t, std::string> &ir_spans,
+        const std::vector<std::pair<uint64_t, uint64_t>> &links);
+
+// The full `dec` payload of `rendering`: `ir` and `code` as arrays of lines, `ir_ids` as [first, count] runs of
+// consecutive ids and `provenance` as an array of pairs
+llvm::json::Object RenderingToJson(const Rendering &rendering);
+
+// Read back a rendering written with `RenderingToJson`
+std::optional<Rendering> RenderingFromJson(const llvm::json::Value &json);
+
+// The `dec` payload of `rendering` for a client holding `base`. Lines of `ir` and `code` are given as operations to
+// apply to the lines of `base` in order: a [start, count] array copies `count` lines of `base` from `start`, a string
+// is a new line. `ir_ids` is sent whole, and `provenance` as `added` and `removed` pairs.
+llvm::json::Object DiffRendering(const Rendering &base, const Rendering &rendering);
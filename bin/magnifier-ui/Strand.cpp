@@ -0,0 +1,59 @@
+/*
+ * Copyright (c) 2021-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#include "Strand.h"
+
+#include <llvm/Support/ThreadPool.h>
+
+#include <atomic>
+#include <utility>
+
+Strand::Strand(llvm::ThreadPool &pool) : pool(pool) {}
+
+void Strand::Post(std::function<void()> task) {
+    PostAsync([task = std::move(task)](const Resume &resume) {
+        task();
+        resume();
+    });
+}
+
+void Strand::PostAsync(Task task) {
+    std::lock_guard<std::mutex> lock(mutex);
+    tasks.push_back(std::move(task));
+    if (!running) {
+        running = true;
+        // The strand is kept alive until its queue is empty
+        pool.async([self = shared_from_this()] { self->Drain(); });
+    }
+}
+
+void Strand::Drain() {
+    while (true) {
+        Task task;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (tasks.empty()) {
+                running = false;
+                return;
+            }
+            task = std::move(tasks.front());
+            tasks.pop_front();
+        }
+
+        // Whichever of the task returning and the task resuming the strand comes second goes on with the next task
+        auto pending = std::make_shared<std::atomic<bool>>(true);
+        task([self = shared_from_this(), pending] {
+            if (!pending->exchange(false)) {
+                self->pool.async([self] { self->Drain(); });
+            }
+        });
+        if (pending->exchange(false)) {
+            return;
+        }
+    }
+}
@@ -0,0 +1,48 @@
+/*
+ * Copyright (c) 2021-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+
+namespace llvm {
+class ThreadPool;
+}
+
+// Runs the tasks posted to it one at a time and in order on the threads of a
+// shared pool, so that tasks of different strands run in parallel while the
+// state a strand is used for only ever has a single writer.
+class Strand : public std::enable_shared_from_this<Strand> {
+public:
+    // Called by a task posted with `PostAsync` once it is done.
+    using Resume = std::function<void()>;
+
+private:
+    using Task = std::function<void(Resume)>;
+
+    llvm::ThreadPool &pool;
+    std::mutex mutex;
+    std::deque<Task> tasks;
+    // Whether a task of this strand is running or waiting to be resumed.
+    bool running{false};
+
+    void Drain();
+
+public:
+    explicit Strand(llvm::ThreadPool &pool);
+
+    void Post(std::function<void()> task);
+
+    // Like `Post`, but the next task only starts once `task` called the
+    // `Resume` it is given. `task` may return before that, e.g. after posting
+    // its work to another strand, so that no thread waits for it meanwhile.
+    void PostAsync(Task task);
+};
@@ -0,0 +1,34 @@
+/*
+ * Copyright (c) 2021-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#include "Workspace.h"
+
+#include <llvm/IR/LLVMContext.h>
+
+#include <utility>
+
+Workspace::Workspace(llvm::ThreadPool &pool)
+    : llvm_context(std::make_unique<llvm::LLVMContext>()),
+      explorer(std::make_unique<magnifier::BitcodeExplorer>(*llvm_context)),
+      strand(std::make_shared<Strand>(pool)) {}
+
+Workspace::~Workspace() = default;
+
+std::shared_ptr<Workspace> WorkspaceRegistry::Acquire(const std::string &digest, llvm::ThreadPool &pool) {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::erase_if(workspaces, [](const auto &entry) { return entry.second.expired(); });
+
+    std::weak_ptr<Workspace> &entry = workspaces[digest];
+    if (std::shared_ptr<Workspace> workspace = entry.lock()) {
+        return workspace;
+    }
+    auto workspace = std::make_shared<Workspace>(pool);
+    workspace->digest = digest;
+    entry = workspace;
+    return workspace;
+}
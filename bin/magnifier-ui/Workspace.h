@@ -0,0 +1,63 @@
+/*
+ * Copyright (c) 2021-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <magnifier/BitcodeExplorer.h>
+#include <magnifier/RenderCache.h>
+
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "Strand.h"
+
+// The modules explored by one or more sessions, along with the context they live in. Sessions that upload the same
+// module share a workspace, so it is only parsed and indexed once. The versions produced by each session are added
+// to the shared modules, but are only visible to the session that produced them.
+//
+// Sessions do not get a private overlay over a read-only base: there is a single explorer, and every command using it
+// runs on `strand`. Commands of sessions sharing a workspace are therefore serialized, so a slow `o3` or `dec` of one
+// session delays the commands of every other session on the same module. They wait in the queue of the strand rather
+// than on a thread of the pool, which keeps running the commands of the other workspaces.
+struct Workspace {
+    enum class State {
+        kEmpty,    // Nothing was uploaded into the workspace yet
+        kLoaded,
+        kInvalid,  // The upload the workspace was created for is not a valid module
+    };
+
+    std::unique_ptr<llvm::LLVMContext> llvm_context;
+    std::unique_ptr<magnifier::BitcodeExplorer> explorer;
+    // Serialized `dec` responses of recently decompiled functions
+    magnifier::RenderCache decompilations;
+    // Runs the commands using the workspace, one at a time
+    std::shared_ptr<Strand> strand;
+    // Digest of the upload the workspace was loaded from if it is shared, empty otherwise
+    std::string digest;
+    // Set by the first session that gets to a shared workspace on its strand, which loads the module from its upload
+    State state{State::kEmpty};
+
+    explicit Workspace(llvm::ThreadPool &pool);
+    ~Workspace();
+
+    [[nodiscard]] bool IsShared() const { return !digest.empty(); }
+};
+
+// Workspaces loaded from uploads, by the digest of the upload. A workspace is freed once no session uses it.
+class WorkspaceRegistry {
+    std::mutex mutex;
+    std::unordered_map<std::string, std::weak_ptr<Workspace>> workspaces;
+
+public:
+    // Return the workspace for the upload with `digest`, creating an empty one if no session uses it. Sessions load it
+    // from their own copy of the upload on its strand, so that only the first one to get there parses the module
+    std::shared_ptr<Workspace> Acquire(const std::string &digest, llvm::ThreadPool &pool);
+};
@@ -6,11 +6,8 @@
  * the LICENSE file found in the root directory of this source tree.
  */
 
-
-
 #include <magnifier/IFunctionResolver.h>
 #include <magnifier/ISubstitutionObserver.h>
-#include <llvm/ADT/StringExtras.h>
 #include <llvm/Bitcode/BitcodeReader.h>
 #include <llvm/IR/AssemblyAnnotationWriter.h>
 #include <llvm/IR/Constants.h>
@@ -18,21 +15,25 @@
 #include <llvm/IR/Instruction.h>
 #include <llvm/IR/LLVMContext.h>
 #include <llvm/Support/Error.h>
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/Endian.h>
 #include <llvm/Support/FormattedStream.h>
 #include <llvm/Support/InitLLVM.h>
 #include <llvm/Support/JSON.h>
 #include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/ThreadPool.h>
 #include <llvm/Support/ToolOutputFile.h>
-#include <llvm/Transforms/Utils/Cloning.h>
 
 #include <uwebsockets/App.h>
 #include <rellic/Decompiler.h>
-#include <rellic/BC/Util.h>
 #include <magnifier/BitcodeExplorer.h>
-
+#include <magnifier/FunctionSlice.h>
+#include <magnifier/ModuleCache.h>
 
 #include <iostream>
 #include <memory>
+#include <optional>
 #include <string>
 #include <vector>
 #include <sstream>
@@ -40,7 +41,15 @@
 #include <functional>
 #include <fstream>
 #include <charconv>
+#include <mutex>
+#include <thread>
+#include <algorithm>
+#include <utility>
+#include "ChunkedUpload.h"
 #include "Printer.h"
+#include "Rendering.h"
+#include "Strand.h"
+#include "Workspace.h"
 
 std::vector<std::string> split(const std::string &input, char delimiter) {
     std::stringstream ss(input);
@@ -71,6 +80,7 @@ public:
                 {magnifier::SubstitutionKind::kConstantFolding, "Constant folding"},
                 {magnifier::SubstitutionKind::kValueSubstitution, "Value substitution"},
                 {magnifier::SubstitutionKind::kFunctionDevirtualization, "Function devirtualization"},
+                {magnifier::SubstitutionKind::kInstructionSimplification, "Instruction simplification"},
         };
         output_stream << "perform substitution: ";
         instr->print(output_stream);
@@ -79,27 +89,45 @@ public:
     }
 };
 
+// Annotates the disassembly of an indexed function. Each value is tagged with a span id derived from its source id,
+// recorded for its copy in `value_map`, which is the module handed to rellic. Ids are written as `kIdPlaceholder` and
+// collected in `ids`, see `Rendering`.
 class AAW : public llvm::AssemblyAnnotationWriter {
 private:
     magnifier::BitcodeExplorer &explorer;
+    const llvm::ValueToValueMapTy &value_map;
+    // Number of values tagged with each source id so far, values after the first one get a suffix
+    std::unordered_map<magnifier::ValueId, unsigned> source_uses;
+
+    void EmitSpan(const llvm::Value *value, std::string span, llvm::formatted_raw_ostream &os) {
+        os << "</span><span class=\"llvm\" id=\"" << span << "\">";
+        spans[(uint64_t)(llvm::Value *)value_map.lookup(value)] = std::move(span);
+    }
+
+    void EmitId(magnifier::ValueId id, llvm::formatted_raw_ostream &os) {
+        os << kIdPlaceholder;
+        ids.push_back(id);
+    }
+
 public:
-    explicit AAW(magnifier::BitcodeExplorer &explorer) : explorer(explorer) {}
+    // Span ids by the address of the copy of the value they tag
+    std::unordered_map<uint64_t, std::string> spans;
+    std::vector<magnifier::ValueId> ids;
 
-    void emitInstructionAnnot(const llvm::Instruction *instruction, llvm::formatted_raw_ostream &os) override {
-        os << "</span><span class=\"llvm\" id=\"";
-        os.write_hex((unsigned long long)instruction);
-        os << "\">";
+    explicit AAW(magnifier::BitcodeExplorer &explorer, const llvm::ValueToValueMapTy &value_map) : explorer(explorer), value_map(value_map) {}
 
+    void emitInstructionAnnot(const llvm::Instruction *instruction, llvm::formatted_raw_ostream &os) override {
         magnifier::ValueId instruction_id = explorer.GetId(*instruction, magnifier::ValueIdKind::kDerived);
         magnifier::ValueId source_id = explorer.GetId(*instruction, magnifier::ValueIdKind::kOriginal);
 
-        os << instruction_id << "|" << source_id;
+        unsigned uses = source_uses[source_id]++;
+        EmitSpan(instruction, "v" + std::to_string(source_id) + (uses ? "." + std::to_string(uses) : ""), os);
+        EmitId(instruction_id, os);
+        os << "|" << source_id;
     }
 
     void emitFunctionAnnot(const llvm::Function *function, llvm::formatted_raw_ostream &os) override {
-        os << "</span><span class=\"llvm\" id=\"";
-        os.write_hex((unsigned long long)function);
-        os << "\">";
+        EmitSpan(function, "f", os);
 
         magnifier::ValueId function_id = explorer.GetId(*function, magnifier::ValueIdKind::kDerived);
         magnifier::ValueId source_id = explorer.GetId(*function, magnifier::ValueIdKind::kOriginal);
@@ -107,12 +135,15 @@ public:
         if (!function->arg_empty()) {
             os << "Function argument ids: ";
             for (const llvm::Argument &argument : function->args()) {
-                os << "(%" << argument.getName().str() << " = " << (function_id+argument.getArgNo()+1) << ") ";
+                os << "(%" << argument.getName().str() << " = ";
+                EmitId(function_id + argument.getArgNo() + 1, os);
+                os << ") ";
             }
             os << "\n";
         }
 
-        os << function_id << "|" << source_id;
+        EmitId(function_id, os);
+        os << "|" << source_id;
     }
 
     void emitBasicBlockStartAnnot(const llvm::BasicBlock *block, llvm::formatted_raw_ostream &os) override {
@@ -120,13 +151,17 @@ public:
 
         const llvm::Instruction *terminator = block->getTerminator();
         if (!terminator) { return; }
-        os << "--- start block: " << explorer.GetId(*terminator, magnifier::ValueIdKind::kBlock) << " ---\n";
+        os << "--- start block: ";
+        EmitId(explorer.GetId(*terminator, magnifier::ValueIdKind::kBlock), os);
+        os << " ---\n";
     }
 
     void emitBasicBlockEndAnnot(const llvm::BasicBlock *block, llvm::formatted_raw_ostream &os) override {
         const llvm::Instruction *terminator = block->getTerminator();
         if (!terminator) { return; }
-        os << "--- end block: " << explorer.GetId(*terminator, magnifier::ValueIdKind::kBlock) << " ---\n";
+        os << "--- end block: ";
+        EmitId(explorer.GetId(*terminator, magnifier::ValueIdKind::kBlock), os);
+        os << " ---\n";
 
         os << "</span><span>";
     }
@@ -137,11 +172,48 @@ public:
 };
 
 struct UserData {
-    std::unique_ptr<llvm::LLVMContext> llvm_context;
-    std::unique_ptr<magnifier::BitcodeExplorer> explorer;
+    // Private until a module is uploaded into it, at which point the session may switch to a workspace it shares
+    // with the other sessions that uploaded the same module
+    std::shared_ptr<Workspace> workspace;
     std::unique_ptr<rellic::DecompilationResult> rellic_result;
+    // Ranges [first, last) of the ids assigned while the session ran its commands, i.e. of the versions it produced
+    std::vector<std::pair<magnifier::ValueId, magnifier::ValueId>> produced_ids;
+    // Whether the socket is still open. Only accessed on the event loop thread
+    bool connected{true};
+    // The module being uploaded, if any
+    std::unique_ptr<ChunkedUpload> upload;
+};
+
+// Commands run on worker threads and may outlive their socket, so they share the session with it
+struct SocketData {
+    std::shared_ptr<UserData> data;
+    // Runs the session's commands one at a time and in order
+    std::shared_ptr<Strand> strand;
 };
 
+// Whether the session produced the function with `function_id`
+bool IsProducedBy(const UserData *data, magnifier::ValueId function_id) {
+    return std::any_of(data->produced_ids.begin(), data->produced_ids.end(), [function_id](const auto &range) {
+        return function_id >= range.first && function_id < range.second;
+    });
+}
+
+// Whether the session may see the function with `function_id`. Versions produced by other sessions sharing the
+// workspace are hidden from it
+bool IsVisibleTo(const UserData *data, magnifier::ValueId function_id) {
+    if (!data->workspace->IsShared()) {
+        return true;
+    }
+    std::optional<magnifier::FunctionVersion> version = data->workspace->explorer->GetFunctionVersion(function_id);
+    return !version || version->operation == magnifier::VersionOperation::kOriginal || IsProducedBy(data, function_id);
+}
+
+// Whether the session may use the function, argument, block or instruction with `value_id`, i.e. see the function it
+// belongs to. Ids that are not indexed are left for the command to reject
+bool IsValueVisibleTo(const UserData *data, magnifier::ValueId value_id) {
+    magnifier::ValueId function_id = data->workspace->explorer->GetOwningFunctionId(value_id);
+    return function_id == magnifier::kInvalidValueId || IsVisibleTo(data, function_id);
+}
 
 std::string JsonToString(llvm::json::Object &&value) {
     std::string s;
@@ -151,42 +223,71 @@ std::string JsonToString(llvm::json::Object &&value) {
     return s;
 }
 
-llvm::json::Value GetRellicProvenance(rellic::DecompilationResult &result) {
-    llvm::json::Array stmt_provenance;
+// Pairs of the addresses of IR values and of the declarations and statements rellic decompiled them to. Types and uses
+// are not tagged in the IR, so their provenance is left out
+std::vector<std::pair<uint64_t, uint64_t>> GetRellicProvenance(rellic::DecompilationResult &result) {
+    std::vector<std::pair<uint64_t, uint64_t>> links;
     for (auto elem : result.stmt_provenance_map) {
-        stmt_provenance.push_back(llvm::json::Array(
-                {(unsigned long long)elem.first, (unsigned long long)elem.second}));
+        links.emplace_back((uint64_t)elem.first, (uint64_t)elem.second);
     }
-
-    llvm::json::Array type_decls;
-    for (auto elem : result.type_to_decl_map) {
-        type_decls.push_back(llvm::json::Array(
-                {(unsigned long long)elem.first, (unsigned long long)elem.second}));
-    }
-
-    llvm::json::Array value_decls;
     for (auto elem : result.value_to_decl_map) {
-        value_decls.push_back(llvm::json::Array(
-                {(unsigned long long)elem.first, (unsigned long long)elem.second}));
+        links.emplace_back((uint64_t)elem.first, (uint64_t)elem.second);
     }
+    return links;
+}
 
-    llvm::json::Array use_provenance;
-    for (auto elem : result.use_expr_map) {
-        if (!elem.second) {
-            continue;
-        }
-        use_provenance.push_back(
-                llvm::json::Array({(unsigned long long)elem.first,
-                                   (unsigned long long)elem.second}));
-    }
+// Functions listed by `lfp` when no count is given, and at most
+static constexpr size_t kDefaultCatalogPageSize = 1000;
+static constexpr size_t kMaxCatalogPageSize = 10000;
+
+llvm::json::Object FunctionInfoToJson(const magnifier::FunctionInfo &info) {
+    return llvm::json::Object{{"id", static_cast<int64_t>(info.function_id)},
+                              {"name", info.name},
+                              {"kind", info.kind == magnifier::FunctionKind::kOriginal ? "original" : "generated"},
+                              {"parent", static_cast<int64_t>(info.parent_id)},
+                              {"size", static_cast<int64_t>(info.instruction_count)},
+                              {"module", info.module->getModuleIdentifier()}};
+}
+
+llvm::cl::opt<uint64_t> max_upload_size("max-upload-size", llvm::cl::desc("Largest module a client may upload, in MiB"),
+                                        llvm::cl::init(50));
+
+llvm::cl::opt<std::string> snapshot_dir("snapshot-dir",
+                                        llvm::cl::desc("Directory `save` and `restore` keep snapshots in, they are "
+                                                       "disabled without it"),
+                                        llvm::cl::value_desc("path"));
 
-    llvm::json::Object msg{{"stmt_provenance", std::move(stmt_provenance)},
-                           {"type_decls", std::move(type_decls)},
-                           {"value_decls", std::move(value_decls)},
-                           {"use_provenance", std::move(use_provenance)}};
-    return msg;
+// The path of the snapshot called `name` in `snapshot_dir`. Clients only name snapshots, so that they cannot write or
+// probe files outside of the directory. Returns nothing if `name` is not a plain file name
+std::optional<std::string> GetSnapshotPath(const std::string &name) {
+    if (name.empty() || name == "." || name == ".." || name.find_first_of("/\\") != std::string::npos) {
+        return std::nullopt;
+    }
+    llvm::SmallString<256> path(snapshot_dir.getValue());
+    llvm::sys::path::append(path, name);
+    return std::string(path);
 }
 
+// Messages for the errors of `save` and `restore`
+static const std::unordered_map<magnifier::SnapshotError, std::string> snapshot_error_map = {
+        {magnifier::SnapshotError::kCannotWriteFile,     "Snapshot file could not be written"},
+        {magnifier::SnapshotError::kCannotReadFile,      "Snapshot file not found or unreadable"},
+        {magnifier::SnapshotError::kInvalidSnapshot,     "File is not a valid snapshot"},
+        {magnifier::SnapshotError::kExplorerNotEmpty,    "Snapshots can only be restored before loading any module"},
+        {magnifier::SnapshotError::kCannotReadFunction,  "The body of a lazily loaded function could not be read"},
+};
+
+// Messages for the errors of `ic` and `ict`
+static const std::unordered_map<magnifier::InlineError, std::string> inline_error_map = {
+        {magnifier::InlineError::kNotACallBaseInstruction, "Not a CallBase instruction"},
+        {magnifier::InlineError::kInstructionNotFound,     "Instruction not found"},
+        {magnifier::InlineError::kCannotResolveFunction,   "Cannot resolve function"},
+        {magnifier::InlineError::kInlineOperationFailed,   "Inline operation failed"},
+        {magnifier::InlineError::kVariadicFunction,        "Inlining variadic function is yet to be supported"},
+        {magnifier::InlineError::kResolveFunctionTypeMismatch, "Resolve function type mismatch"},
+        {magnifier::InlineError::kNoCallInlined,           "No call could be inlined within the budget"},
+};
+
 void RunOptimization(magnifier::BitcodeExplorer &explorer, llvm::raw_ostream &tool_output, magnifier::ValueId function_id, llvm::OptimizationLevel level) {
     static const std::unordered_map<magnifier::OptimizationError, std::string> optimization_error_map = {
             {magnifier::OptimizationError::kInvalidOptimizationLevel, "The provided optimization level is not allowed"},
@@ -201,7 +302,43 @@ void RunOptimization(magnifier::BitcodeExplorer &explorer, llvm::raw_ostream &to
     }
 }
 
+llvm::json::Object HistogramToJson(const magnifier::LatencyHistogram &histogram) {
+    llvm::json::Array buckets;
+    for (uint64_t bucket : histogram.Buckets()) {
+        buckets.push_back(static_cast<int64_t>(bucket));
+    }
+    return llvm::json::Object{{"count", static_cast<int64_t>(histogram.Count())},
+                              {"total_ns", static_cast<int64_t>(histogram.Total().count())},
+                              {"min_ns", static_cast<int64_t>(histogram.Min().count())},
+                              {"max_ns", static_cast<int64_t>(histogram.Max().count())},
+                              {"p50_ns", static_cast<int64_t>(histogram.Percentile(50).count())},
+                              {"p99_ns", static_cast<int64_t>(histogram.Percentile(99).count())},
+                              {"buckets", std::move(buckets)}};
+}
 
+llvm::json::Object StatsToJson(const magnifier::ExplorerStats &stats) {
+    llvm::json::Object operations;
+    for (size_t i = 0; i < magnifier::kExplorerOperationCount; ++i) {
+        auto operation = static_cast<magnifier::ExplorerOperation>(i);
+        operations[magnifier::GetOperationName(operation)] = HistogramToJson(stats[operation]);
+    }
+    llvm::json::Object phases;
+    for (size_t i = 0; i < magnifier::kExplorerPhaseCount; ++i) {
+        auto phase = static_cast<magnifier::ExplorerPhase>(i);
+        phases[magnifier::GetPhaseName(phase)] = HistogramToJson(stats[phase]);
+    }
+    return llvm::json::Object{{"operations", std::move(operations)},
+                              {"phases", std::move(phases)},
+                              {"instructions_cloned", static_cast<int64_t>(stats.instructions_cloned)},
+                              {"instructions_inlined", static_cast<int64_t>(stats.instructions_inlined)},
+                              {"instructions_folded", static_cast<int64_t>(stats.instructions_folded)},
+                              {"instructions_indexed", static_cast<int64_t>(stats.instructions_indexed)},
+                              {"verification_failures", static_cast<int64_t>(stats.verification_failures)},
+                              {"print_cache_hits", static_cast<int64_t>(stats.print_cache_hits)},
+                              {"print_cache_misses", static_cast<int64_t>(stats.print_cache_misses)},
+                              {"module_cache_hits", static_cast<int64_t>(stats.module_cache_hits)},
+                              {"module_cache_misses", static_cast<int64_t>(stats.module_cache_misses)}};
+}
 
 llvm::json::Object HandleRequest(UserData *data, const llvm::json::Object &json) {
     static std::unordered_map<std::string, std::function<llvm::json::Value(UserData *, const llvm::json::Object &, const std::vector<std::string> &)>> cmd_map = {
@@ -227,10 +364,51 @@ llvm::json::Object HandleRequest(UserData *data, const llvm::json::Object &json)
 
             //     for (auto &llvm_mod: llvm_bitcode_contents.Mods) {
             //         std::unique_ptr<llvm::Module> mod = llvm_exit_on_err(llvm_mod.parseModule(*data->llvm_context));
-            //         data->explorer->TakeModule(std::move(mod));
+            //         data->workspace->explorer->TakeModule(std::move(mod));
             //     }
             //     return "Successfully loaded: " + filename + "\n";
             // }},
+            // Save session: `save <name>`
+            {"save", [](UserData *data, const llvm::json::Object &json, const std::vector<std::string> &args) -> llvm::json::Value {
+                if (args.size() != 2) {
+                    return "Usage: save <name> - Save the modules, ids and function versions to a snapshot\n";
+                }
+                if (snapshot_dir.empty()) {
+                    return "Save snapshot failed (error: Snapshots are disabled, see --snapshot-dir)\n";
+                }
+                std::optional<std::string> path = GetSnapshotPath(args[1]);
+                if (!path) {
+                    return "Save snapshot failed (error: Snapshot names cannot be paths)\n";
+                }
+                if (data->workspace->IsShared()) {
+                    return "Save snapshot failed (error: The module is shared with other sessions)\n";
+                }
+
+                std::optional<magnifier::SnapshotError> result = data->workspace->explorer->SaveSnapshot(*path);
+                if (result) {
+                    return "Save snapshot failed (error: " + snapshot_error_map.at(result.value()) + ")\n";
+                }
+                return "Saved snapshot: " + args[1] + "\n";
+            }},
+            // Restore session: `restore <name>`
+            {"restore", [](UserData *data, const llvm::json::Object &json, const std::vector<std::string> &args) -> llvm::json::Value {
+                if (args.size() != 2) {
+                    return "Usage: restore <name> - Restore a snapshot saved with `save`\n";
+                }
+                if (snapshot_dir.empty()) {
+                    return "Restore snapshot failed (error: Snapshots are disabled, see --snapshot-dir)\n";
+                }
+                std::optional<std::string> path = GetSnapshotPath(args[1]);
+                if (!path) {
+                    return "Restore snapshot failed (error: Snapshot names cannot be paths)\n";
+                }
+
+                magnifier::Result<size_t, magnifier::SnapshotError> result = data->workspace->explorer->RestoreSnapshot(*path);
+                if (!result.Succeeded()) {
+                    return "Restore snapshot failed (error: " + snapshot_error_map.at(result.Error()) + ")\n";
+                }
+                return "Restored " + std::to_string(result.Value()) + " modules\n";
+            }},
             // List functions: `lf`
             {"lf", [](UserData *data, const llvm::json::Object &json, const std::vector<std::string> &args) -> llvm::json::Value {
                 if (args.size() != 1) {
@@ -240,7 +418,7 @@ llvm::json::Object HandleRequest(UserData *data, const llvm::json::Object &json)
                 std::string tool_str;
                 llvm::raw_string_ostream tool_output(tool_str);
 
-                data->explorer->ForEachFunction([&tool_output](magnifier::ValueId function_id, llvm::Function &function, magnifier::FunctionKind kind) -> void {
+                data->workspace->explorer->ForEachFunction([&tool_output](magnifier::ValueId function_id, llvm::Function &function, magnifier::FunctionKind kind) -> void {
                     if (function.hasName() && kind == magnifier::FunctionKind::kOriginal) {
                         tool_output << function_id << " " << function.getName().str() << "\n";
                     }
@@ -258,8 +436,8 @@ llvm::json::Object HandleRequest(UserData *data, const llvm::json::Object &json)
                 std::string tool_str;
                 llvm::raw_string_ostream tool_output(tool_str);
 
-                data->explorer->ForEachFunction([&tool_output](magnifier::ValueId function_id, llvm::Function &function, magnifier::FunctionKind kind) -> void {
-                    if (function.hasName()) {
+                data->workspace->explorer->ForEachFunction([data, &tool_output](magnifier::ValueId function_id, llvm::Function &function, magnifier::FunctionKind kind) -> void {
+                    if (function.hasName() && IsVisibleTo(data, function_id)) {
                         tool_output << function_id << " " << function.getName().str() << "\n";
                     }
                 });
@@ -267,6 +445,76 @@ llvm::json::Object HandleRequest(UserData *data, const llvm::json::Object &json)
                 tool_output.flush();
                 return tool_str;
             }},
+            // List a page of the function catalog: `lfp [<after_id> [<count>]]`, see `BitcodeExplorer::ListFunctions`
+            {"lfp", [](UserData *data, const llvm::json::Object &json, const std::vector<std::string> &args) -> llvm::json::Value {
+                if (args.size() > 3) {
+                    return "Usage: lfp [<after_id> [<count>]] - List up to count functions with ids above after_id, along with the catalog version\n";
+                }
+
+                magnifier::ValueId after_id = magnifier::kInvalidValueId;
+                size_t count = kDefaultCatalogPageSize;
+                try {
+                    if (args.size() >= 2) {
+                        after_id = std::stoul(args[1], nullptr, 10);
+                    }
+                    if (args.size() == 3) {
+                        count = std::stoul(args[2], nullptr, 10);
+                    }
+                } catch (...) {
+                    return "Invalid args";
+                }
+                if (count == 0 || count > kMaxCatalogPageSize) {
+                    return "Invalid args";
+                }
+
+                magnifier::FunctionPage page = data->workspace->explorer->ListFunctions(after_id, count);
+                llvm::json::Array functions;
+                for (const magnifier::FunctionInfo &info : page.functions) {
+                    if (!info.name.empty() && IsVisibleTo(data, info.function_id)) {
+                        functions.push_back(FunctionInfoToJson(info));
+                    }
+                }
+                return llvm::json::Object{{"version", static_cast<int64_t>(page.catalog_version)},
+                                          {"functions", std::move(functions)},
+                                          {"next", static_cast<int64_t>(page.next)}};
+            }},
+            // List the changes of the function catalog: `lfc <version>`, see `BitcodeExplorer::GetCatalogChanges`
+            {"lfc", [](UserData *data, const llvm::json::Object &json, const std::vector<std::string> &args) -> llvm::json::Value {
+                if (args.size() != 2) {
+                    return "Usage: lfc <version> - List the functions added, changed or deleted since a catalog version\n";
+                }
+
+                uint64_t since;
+                try {
+                    since = std::stoull(args[1], nullptr, 10);
+                } catch (...) {
+                    return "Invalid args";
+                }
+
+                // Clients holding a version whose changes are no longer tracked list the functions again with `lfp`
+                std::optional<magnifier::CatalogChanges> changes = data->workspace->explorer->GetCatalogChanges(since);
+                if (!changes) {
+                    return llvm::json::Object{{"version", static_cast<int64_t>(data->workspace->explorer->GetCatalogVersion())},
+                                              {"reset", true}};
+                }
+
+                llvm::json::Array updated;
+                for (const magnifier::FunctionInfo &info : changes->updated) {
+                    if (!info.name.empty() && IsVisibleTo(data, info.function_id)) {
+                        updated.push_back(FunctionInfoToJson(info));
+                    }
+                }
+                // Only versions are removed from a shared workspace, and those of other sessions were never listed
+                llvm::json::Array removed;
+                for (magnifier::ValueId function_id : changes->removed) {
+                    if (!data->workspace->IsShared() || IsProducedBy(data, function_id)) {
+                        removed.push_back(static_cast<int64_t>(function_id));
+                    }
+                }
+                return llvm::json::Object{{"version", static_cast<int64_t>(changes->catalog_version)},
+                                          {"updated", std::move(updated)},
+                                          {"removed", std::move(removed)}};
+            }},
             // Print function: `pf <function_id>`
             {"pf", [](UserData *data, const llvm::json::Object &json, const std::vector<std::string> &args) -> llvm::json::Value {
                 if (args.size() != 2) {
@@ -283,7 +531,7 @@ llvm::json::Object HandleRequest(UserData *data, const llvm::json::Object &json)
                     return "Invalid args";
                 }
 
-                if (data->explorer->PrintFunction(function_id, tool_output)) {
+                if (IsVisibleTo(data, function_id) && data->workspace->explorer->PrintFunction(function_id, tool_output)) {
                     tool_output.flush();
                     return tool_str;
                 } else {
@@ -317,12 +565,17 @@ llvm::json::Object HandleRequest(UserData *data, const llvm::json::Object &json)
                     return "Invalid args";
                 }
 
+                if (!IsValueVisibleTo(data, instruction_id)) {
+                    return "Devirtualize function call failed for id: " + std::to_string(instruction_id) + " (error: " + devirtualize_error_map.at(magnifier::DevirtualizeError::kInstructionNotFound) + ")\n";
+                }
+                if (!IsVisibleTo(data, function_id)) {
+                    return "Devirtualize function call failed for id: " + std::to_string(instruction_id) + " (error: " + devirtualize_error_map.at(magnifier::DevirtualizeError::kFunctionNotFound) + ")\n";
+                }
 
-                magnifier::Result<magnifier::ValueId, magnifier::DevirtualizeError> result = data->explorer->DevirtualizeFunction(instruction_id, function_id, substitution_observer);
-
+                magnifier::Result<magnifier::ValueId, magnifier::DevirtualizeError> result = data->workspace->explorer->DevirtualizeFunction(instruction_id, function_id, substitution_observer);
 
                 if (result.Succeeded()) {
-                    data->explorer->PrintFunction(result.Value(), tool_output);
+                    data->workspace->explorer->PrintFunction(result.Value(), tool_output);
                 } else {
                     tool_output << "Devirtualize function call failed for id: " << instruction_id << " (error: " << devirtualize_error_map.at(result.Error()) << ")\n";
                 }
@@ -350,8 +603,13 @@ llvm::json::Object HandleRequest(UserData *data, const llvm::json::Object &json)
                 } catch (...) {
                     return "Invalid args";
                 }
-                std::optional<magnifier::DeletionError> result = data->explorer->DeleteFunction(function_id);
+                // Only the versions a session produced may be deleted from a shared module
+                if (data->workspace->IsShared() && !IsProducedBy(data, function_id)) {
+                    return "Delete function failed for id: " + std::to_string(function_id) + " (error: Function not produced by this session)\n";
+                }
+                std::optional<magnifier::DeletionError> result = data->workspace->explorer->DeleteFunction(function_id);
                 if (!result) {
+                    data->workspace->decompilations.Erase(function_id);
                     tool_output << "Deleted function with id: " << function_id << "\n";
                 } else {
                     tool_output << "Delete function failed for id: " << function_id << " (error: " << deletion_error_map.at(result.value()) << ")\n";
@@ -360,17 +618,67 @@ llvm::json::Object HandleRequest(UserData *data, const llvm::json::Object &json)
                 tool_output.flush();
                 return tool_str;
             }},
+            // Collect unused generated functions: `gc [<versions_per_lineage>]`
+            {"gc", [](UserData *data, const llvm::json::Object &json, const std::vector<std::string> &args) -> llvm::json::Value {
+                if (args.size() > 2) {
+                    return "Usage: gc [<versions_per_lineage>] - Delete generated functions outside of the retention policy\n";
+                }
+                // The collector would also reclaim the versions of other sessions
+                if (data->workspace->IsShared()) {
+                    return "The module is shared with other sessions, delete versions with `df!` instead\n";
+                }
+
+                if (args.size() == 2) {
+                    magnifier::RetentionPolicy policy = data->workspace->explorer->GetRetentionPolicy();
+                    try {
+                        policy.versions_per_lineage = std::stoul(args[1], nullptr, 10);
+                    } catch (...) {
+                        return "Invalid args";
+                    }
+                    data->workspace->explorer->SetRetentionPolicy(policy);
+                }
+
+                magnifier::CollectionStats stats = data->workspace->explorer->CollectGarbage();
+                return "Reclaimed " + std::to_string(stats.functions_erased) + " functions (" + std::to_string(stats.instructions_erased) + " instructions)\n";
+            }},
+            // Pin function: `pin <function_id>`
+            {"pin", [](UserData *data, const llvm::json::Object &json, const std::vector<std::string> &args) -> llvm::json::Value {
+                if (args.size() != 2) {
+                    return "Usage: pin <function_id> - Keep function during garbage collection\n";
+                }
+
+                magnifier::ValueId function_id;
+                try {
+                    function_id = std::stoul(args[1], nullptr, 10);
+                } catch (...) {
+                    return "Invalid args";
+                }
+
+                if (IsVisibleTo(data, function_id) && data->workspace->explorer->PinFunction(function_id)) {
+                    return "Pinned function with id: " + std::to_string(function_id) + "\n";
+                }
+                return "Function not found: " + std::to_string(function_id) + "\n";
+            }},
+            // Unpin function: `unpin <function_id>`
+            {"unpin", [](UserData *data, const llvm::json::Object &json, const std::vector<std::string> &args) -> llvm::json::Value {
+                if (args.size() != 2) {
+                    return "Usage: unpin <function_id> - Allow garbage collection of function\n";
+                }
+
+                magnifier::ValueId function_id;
+                try {
+                    function_id = std::stoul(args[1], nullptr, 10);
+                } catch (...) {
+                    return "Invalid args";
+                }
+
+                if (IsVisibleTo(data, function_id) && data->workspace->explorer->UnpinFunction(function_id)) {
+                    return "Unpinned function with id: " + std::to_string(function_id) + "\n";
+                }
+                return "Function is not pinned: " + std::to_string(function_id) + "\n";
+            }},
             // Inline function call: `ic <instruction_id>`
             {"ic", [](UserData *data, const llvm::json::Object &json, const std::vector<std::string> &args) -> llvm::json::Value {
-                static const std::unordered_map<magnifier::InlineError, std::string> inline_error_map = {
-                        {magnifier::InlineError::kNotACallBaseInstruction, "Not a CallBase instruction"},
-                        {magnifier::InlineError::kInstructionNotFound,     "Instruction not found"},
-                        {magnifier::InlineError::kCannotResolveFunction,   "Cannot resolve function"},
-                        {magnifier::InlineError::kInlineOperationFailed,   "Inline operation failed"},
-                        {magnifier::InlineError::kVariadicFunction,        "Inlining variadic function is yet to be supported"},
-                        {magnifier::InlineError::kResolveFunctionTypeMismatch, "Resolve function type mismatch"},
-                };
-
                 if (args.size() != 2) {
                     return "Usage: ic <instruction_id> - Inline function call\n";
                 }
@@ -387,10 +695,14 @@ llvm::json::Object HandleRequest(UserData *data, const llvm::json::Object &json)
                     return "Invalid args";
                 }
 
-                magnifier::Result<magnifier::ValueId, magnifier::InlineError> result = data->explorer->InlineFunctionCall(instruction_id, resolver, substitution_observer);
+                if (!IsValueVisibleTo(data, instruction_id)) {
+                    return "Inline function call failed for id: " + std::to_string(instruction_id) + " (error: " + inline_error_map.at(magnifier::InlineError::kInstructionNotFound) + ")\n";
+                }
+
+                magnifier::Result<magnifier::ValueId, magnifier::InlineError> result = data->workspace->explorer->InlineFunctionCall(instruction_id, resolver, substitution_observer);
 
                 if (result.Succeeded()) {
-                    data->explorer->PrintFunction(result.Value(), tool_output);
+                    data->workspace->explorer->PrintFunction(result.Value(), tool_output);
                 } else {
                     tool_output << "Inline function call failed for id: " << instruction_id << " (error: " << inline_error_map.at(result.Error()) << ")\n";
                 }
@@ -398,6 +710,46 @@ llvm::json::Object HandleRequest(UserData *data, const llvm::json::Object &json)
                 tool_output.flush();
                 return tool_str;
             }},
+            // Inline call tree: `ict <id> [<max_depth> [<max_instructions>]]`
+            {"ict", [](UserData *data, const llvm::json::Object &json, const std::vector<std::string> &args) -> llvm::json::Value {
+                if (args.size() < 2 || args.size() > 4) {
+                    return "Usage: ict <id> [<max_depth> [<max_instructions>]] - Inline the call tree below a call, or below every call of a function\n";
+                }
+
+                std::string tool_str;
+                llvm::raw_string_ostream tool_output(tool_str);
+                FunctionResolver resolver{};
+                SubstitutionObserver substitution_observer(tool_output);
+
+                magnifier::ValueId value_id;
+                magnifier::InlineBudget budget;
+                try {
+                    value_id = std::stoul(args[1], nullptr, 10);
+                    if (args.size() > 2) {
+                        budget.max_depth = std::stoul(args[2], nullptr, 10);
+                    }
+                    if (args.size() > 3) {
+                        budget.max_instructions = std::stoul(args[3], nullptr, 10);
+                    }
+                } catch (...) {
+                    return "Invalid args";
+                }
+
+                if (!IsValueVisibleTo(data, value_id)) {
+                    return "Inline call tree failed for id: " + std::to_string(value_id) + " (error: " + inline_error_map.at(magnifier::InlineError::kInstructionNotFound) + ")\n";
+                }
+
+                magnifier::Result<magnifier::ValueId, magnifier::InlineError> result = data->workspace->explorer->InlineCallTree(value_id, budget, resolver, substitution_observer);
+
+                if (result.Succeeded()) {
+                    data->workspace->explorer->PrintFunction(result.Value(), tool_output);
+                } else {
+                    tool_output << "Inline call tree failed for id: " << value_id << " (error: " << inline_error_map.at(result.Error()) << ")\n";
+                }
+
+                tool_output.flush();
+                return tool_str;
+            }},
             // Substitute with value: `sv <id> <val>`
             {"sv", [](UserData *data, const llvm::json::Object &json, const std::vector<std::string> &args) -> llvm::json::Value {
                 static const std::unordered_map<magnifier::SubstitutionError, std::string> substitution_error_map = {
@@ -423,11 +775,15 @@ llvm::json::Object HandleRequest(UserData *data, const llvm::json::Object &json)
                    return "Invalid args";
                 }
 
+                if (!IsValueVisibleTo(data, value_id)) {
+                    return "Substitute value failed for id:  " + std::to_string(value_id) + " (error: " + substitution_error_map.at(magnifier::SubstitutionError::kIdNotFound) + ")\n";
+                }
+
                 // Try treating `value_id` as an instruction id
-                magnifier::Result<magnifier::ValueId, magnifier::SubstitutionError> result = data->explorer->SubstituteInstructionWithValue(value_id, value, substitution_observer);
+                magnifier::Result<magnifier::ValueId, magnifier::SubstitutionError> result = data->workspace->explorer->SubstituteInstructionWithValue(value_id, value, substitution_observer);
 
                 if (result.Succeeded()) {
-                    data->explorer->PrintFunction(result.Value(), tool_output);
+                    data->workspace->explorer->PrintFunction(result.Value(), tool_output);
                     tool_output.flush();
                     return tool_str;
                 }
@@ -437,16 +793,58 @@ llvm::json::Object HandleRequest(UserData *data, const llvm::json::Object &json)
                 }
 
                 // Try treating `value_id` as an argument id
-                result = data->explorer->SubstituteArgumentWithValue(value_id, value, substitution_observer);
+                result = data->workspace->explorer->SubstituteArgumentWithValue(value_id, value, substitution_observer);
 
                 if (result.Succeeded()) {
-                    data->explorer->PrintFunction(result.Value(), tool_output);
+                    data->workspace->explorer->PrintFunction(result.Value(), tool_output);
                     tool_output.flush();
                     return tool_str;
                 } else {
                     return "Substitute value failed for id:  " + std::to_string(value_id) + " (error: " + substitution_error_map.at(result.Error()) + ")\n";
                 }
             }},
+            // Substitute several values at once: `svm <id> <val> [<id> <val> ...]`
+            {"svm", [](UserData *data, const llvm::json::Object &json, const std::vector<std::string> &args) -> llvm::json::Value {
+                static const std::unordered_map<magnifier::SubstitutionError, std::string> substitution_error_map = {
+                        {magnifier::SubstitutionError::kIdNotFound,    "Instruction or argument not found"},
+                        {magnifier::SubstitutionError::kIncorrectType, "Value has non-integer type"},
+                        {magnifier::SubstitutionError::kCannotUseFunctionId, "Expecting an instruction or argument id instead of a function id"},
+                        {magnifier::SubstitutionError::kFunctionMismatch, "Values belong to different functions"},
+                        {magnifier::SubstitutionError::kNoSubstitutions, "No substitution given"},
+                };
+
+                if (args.size() < 3 || args.size() % 2 != 1) {
+                    return "Usage: svm <id> <val> [<id> <val> ...] - Substitute several values of one function at once\n";
+                }
+
+                std::string tool_str;
+                llvm::raw_string_ostream tool_output(tool_str);
+                SubstitutionObserver substitution_observer(tool_output);
+
+                std::vector<magnifier::Substitution> substitutions;
+                try {
+                    for (size_t i = 1; i < args.size(); i += 2) {
+                        substitutions.push_back({std::stoul(args[i], nullptr, 10), std::stoul(args[i + 1], nullptr, 10)});
+                    }
+                } catch (...) {
+                    return "Invalid args";
+                }
+
+                for (const magnifier::Substitution &substitution : substitutions) {
+                    if (!IsValueVisibleTo(data, substitution.id)) {
+                        return "Substitute values failed (error: " + substitution_error_map.at(magnifier::SubstitutionError::kIdNotFound) + ")\n";
+                    }
+                }
+
+                magnifier::Result<magnifier::ValueId, magnifier::SubstitutionError> result = data->workspace->explorer->ApplySubstitutions(substitutions, substitution_observer);
+                if (!result.Succeeded()) {
+                    return "Substitute values failed (error: " + substitution_error_map.at(result.Error()) + ")\n";
+                }
+
+                data->workspace->explorer->PrintFunction(result.Value(), tool_output);
+                tool_output.flush();
+                return tool_str;
+            }},
             // Optimize function bitcode using optimization level -O1: `o1 <id>`
             {"o1", [](UserData *data, const llvm::json::Object &json, const std::vector<std::string> &args) -> llvm::json::Value {
                 if (args.size() != 2) {
@@ -462,7 +860,10 @@ llvm::json::Object HandleRequest(UserData *data, const llvm::json::Object &json)
                 } catch (...) {
                     return "Invalid args";
                 }
-                RunOptimization(*data->explorer, tool_output, function_id, llvm::OptimizationLevel::O1);
+                if (!IsVisibleTo(data, function_id)) {
+                    return "Optimize function failed for id: " + std::to_string(function_id) + " (error: Function id not found)\n";
+                }
+                RunOptimization(*data->workspace->explorer, tool_output, function_id, llvm::OptimizationLevel::O1);
 
                 tool_output.flush();
                 return tool_str;
@@ -482,7 +883,10 @@ llvm::json::Object HandleRequest(UserData *data, const llvm::json::Object &json)
                 } catch (...) {
                     return "Invalid args";
                 }
-                RunOptimization(*data->explorer, tool_output, function_id, llvm::OptimizationLevel::O2);
+                if (!IsVisibleTo(data, function_id)) {
+                    return "Optimize function failed for id: " + std::to_string(function_id) + " (error: Function id not found)\n";
+                }
+                RunOptimization(*data->workspace->explorer, tool_output, function_id, llvm::OptimizationLevel::O2);
 
                 tool_output.flush();
                 return tool_str;
@@ -502,94 +906,208 @@ llvm::json::Object HandleRequest(UserData *data, const llvm::json::Object &json)
                 } catch (...) {
                     return "Invalid args";
                 }
-                RunOptimization(*data->explorer, tool_output, function_id, llvm::OptimizationLevel::O3);
+                if (!IsVisibleTo(data, function_id)) {
+                    return "Optimize function failed for id: " + std::to_string(function_id) + " (error: Function id not found)\n";
+                }
+                RunOptimization(*data->workspace->explorer, tool_output, function_id, llvm::OptimizationLevel::O3);
 
                 tool_output.flush();
                 return tool_str;
             }},
-            // Decompile function
+            // Print optimization timings: `ot`
+            {"ot", [](UserData *data, const llvm::json::Object &json, const std::vector<std::string> &args) -> llvm::json::Value {
+                if (args.size() != 1) {
+                    return "Usage: ot - Print time spent setting up and running optimization pipelines\n";
+                }
+
+                magnifier::OptimizationStats stats = data->workspace->explorer->GetOptimizationStats();
+                return "Setup: " + std::to_string(std::chrono::duration_cast<std::chrono::microseconds>(stats.setup_time).count()) + "us (" +
+                       std::to_string(stats.pipelines_built) + " pipelines)\n" +
+                       "Run: " + std::to_string(std::chrono::duration_cast<std::chrono::microseconds>(stats.run_time).count()) + "us (" +
+                       std::to_string(stats.runs) + " functions)\n";
+            }},
+            // Verification policy: `verify [off|sampled [<interval>]|function|module]`
+            {"verify", [](UserData *data, const llvm::json::Object &json, const std::vector<std::string> &args) -> llvm::json::Value {
+                static const std::unordered_map<std::string, magnifier::VerificationLevel> level_map = {
+                        {"off",      magnifier::VerificationLevel::kOff},
+                        {"sampled",  magnifier::VerificationLevel::kSampled},
+                        {"function", magnifier::VerificationLevel::kFunction},
+                        {"module",   magnifier::VerificationLevel::kModule},
+                };
+
+                if (args.size() > 3 || (args.size() >= 2 && !level_map.count(args[1])) || (args.size() == 3 && args[1] != "sampled")) {
+                    return "Usage: verify [off|sampled [<interval>]|function|module] - Set or print how produced functions are verified\n";
+                }
+
+                magnifier::VerificationPolicy policy = data->workspace->explorer->GetVerificationPolicy();
+                if (args.size() >= 2) {
+                    // The policy applies to the versions of every session
+                    if (data->workspace->IsShared()) {
+                        return "The module is shared with other sessions, its verification policy cannot be changed\n";
+                    }
+                    policy.level = level_map.at(args[1]);
+                    if (args.size() == 3) {
+                        try {
+                            policy.sample_interval = std::max(1ul, std::stoul(args[2], nullptr, 10));
+                        } catch (...) {
+                            return "Invalid args";
+                        }
+                    }
+                    data->workspace->explorer->SetVerificationPolicy(policy);
+                }
+
+                std::string output = "Verification: ";
+                for (auto &[name, level] : level_map) {
+                    if (level == policy.level) {
+                        output += name;
+                    }
+                }
+                if (policy.level == magnifier::VerificationLevel::kSampled) {
+                    output += " (1 in " + std::to_string(policy.sample_interval) + ")";
+                }
+                return output + "\n";
+            }},
+            // Statistics: `stats [reset]`, histograms are bucketed by powers of two microseconds
+            {"stats", [](UserData *data, const llvm::json::Object &json, const std::vector<std::string> &args) -> llvm::json::Value {
+                if (args.size() > 2 || (args.size() == 2 && args[1] != "reset")) {
+                    return "Usage: stats [reset] - Get operation and phase latencies and instruction counters, then clear them if `reset` is given\n";
+                }
+
+                // The counters cover the commands of every session
+                if (args.size() == 2 && data->workspace->IsShared()) {
+                    return "The module is shared with other sessions, its statistics cannot be reset\n";
+                }
+
+                llvm::json::Object stats = StatsToJson(data->workspace->explorer->GetStats());
+                if (args.size() == 2) {
+                    data->workspace->explorer->ResetStats();
+                }
+                return stats;
+            }},
+            // Decompile function: `dec <id> [<base_id>]`, sent as a delta against the output of `base_id` if the client
+            // holds it, see `DiffRendering`
             {"dec", [](UserData *data, const llvm::json::Object &json, const std::vector<std::string> &args) -> llvm::json::Value {
-                if (args.size() != 2) {
-                    return "Usage: dec <id> - Decompile function with id\n";
+                if (args.size() != 2 && args.size() != 3) {
+                    return "Usage: dec <id> [<base_id>] - Decompile function with id, as changes from the function with base_id if given\n";
                 }
                 magnifier::ValueId function_id;
+                magnifier::ValueId base_id = magnifier::kInvalidValueId;
                 try {
                     function_id = std::stoul(args[1], nullptr, 10);
+                    if (args.size() == 3) {
+                        base_id = std::stoul(args[2], nullptr, 10);
+                    }
                 } catch (...) {
                     return "Invalid args";
                 }
 
-                std::string ir_output_str;
-                llvm::raw_string_ostream ir_output_stream(ir_output_str);
-                std::string c_output_str;
-                llvm::raw_string_ostream c_output_stream(c_output_str);
-
-                magnifier::BitcodeExplorer &explorer = *data->explorer;
-                AAW aaw(explorer);
+                magnifier::BitcodeExplorer &explorer = *data->workspace->explorer;
 
                 std::optional<llvm::Function *> target_function_opt = explorer.GetFunctionById(function_id);
 
-                if (!target_function_opt) {
+                if (!target_function_opt || !IsVisibleTo(data, function_id)) {
                     return "No function with id found";
                 }
 
-                std::unique_ptr<llvm::Module> module = llvm::CloneModule(*(*target_function_opt)->getParent());;
-
-                llvm::Function *selected_function = nullptr;
-                for (auto &function : module->functions()) {
-                    if (explorer.GetId(function, magnifier::ValueIdKind::kDerived) == function_id) {
-                        function.print(ir_output_stream, &aaw);
-                        ir_output_stream.flush();
-                        selected_function = &function;
+                // Versions never change, so neither does their decompilation
+                auto find_rendering = [data](magnifier::ValueId id) -> std::optional<Rendering> {
+                    const std::string *cached = data->workspace->decompilations.Find(id);
+                    if (!cached) {
+                        return std::nullopt;
                     }
-                }
-                assert(selected_function);
+                    llvm::Expected<llvm::json::Value> value = llvm::json::parse(*cached);
+                    if (!value) {
+                        llvm::consumeError(value.takeError());
+                        return std::nullopt;
+                    }
+                    return RenderingFromJson(*value);
+                };
 
-                rellic::Result<rellic::DecompilationResult, rellic::DecompilationError> r = rellic::Decompile(std::move(module));
-                if (!r.Succeeded()) {
-                    auto error = r.TakeError();
-                    return error.message+"\n";
+                // Only a base still in the cache can be diffed against, otherwise the whole output is sent
+                std::optional<Rendering> base;
+                if (base_id != magnifier::kInvalidValueId && base_id != function_id && IsVisibleTo(data, base_id)) {
+                    base = find_rendering(base_id);
                 }
-                auto result = r.TakeValue();
 
-                auto selected_function_decl = result.value_to_decl_map.at((llvm::Value *)selected_function);
+                std::optional<Rendering> rendering = find_rendering(function_id);
+                if (!rendering) {
+                    std::string ir_output_str;
+                    llvm::raw_string_ostream ir_output_stream(ir_output_str);
+                    std::string c_output_str;
+                    llvm::raw_string_ostream c_output_stream(c_output_str);
+
+                    // Only decompile the function, with declarations of what it references, rather than its whole module
+                    llvm::ValueToValueMapTy value_map;
+                    std::unique_ptr<llvm::Module> module = magnifier::SliceFunction(**target_function_opt, value_map);
+
+                    // Ids are only known for the original function, so print it while tagging values with their clones
+                    AAW aaw(explorer, value_map);
+                    (*target_function_opt)->print(ir_output_stream, &aaw);
+                    ir_output_stream.flush();
 
-                PrintDecl((clang::Decl *) selected_function_decl,
-                          result.ast->getASTContext().getPrintingPolicy(), 0, c_output_stream);
+                    auto *selected_function = llvm::cast<llvm::Function>((llvm::Value *)value_map.lookup(*target_function_opt));
 
-                c_output_stream.flush();
-                return llvm::json::Object{{
-                                                  {"ir", ir_output_str},
-                                                  {"code", c_output_str},
-                                                  {"provenance", GetRellicProvenance(result)}
-                                          }};
+                    rellic::Result<rellic::DecompilationResult, rellic::DecompilationError> r = rellic::Decompile(std::move(module));
+                    if (!r.Succeeded()) {
+                        auto error = r.TakeError();
+                        return error.message+"\n";
+                    }
+                    auto result = r.TakeValue();
+
+                    auto selected_function_decl = result.value_to_decl_map.at((llvm::Value *)selected_function);
+
+                    PrintDecl((clang::Decl *) selected_function_decl,
+                              result.ast->getASTContext().getPrintingPolicy(), 0, c_output_stream);
+
+                    c_output_stream.flush();
+                    rendering.emplace();
+                    rendering->provenance = NameCodeSpans(c_output_str, aaw.spans, GetRellicProvenance(result));
+                    rendering->ir = SplitLines(ir_output_str);
+                    rendering->ir_ids = std::move(aaw.ids);
+                    rendering->code = SplitLines(c_output_str);
+                    data->workspace->decompilations.Insert(function_id, JsonToString(RenderingToJson(*rendering)));
+                }
+
+                llvm::json::Object response;
+                if (base) {
+                    response = DiffRendering(*base, *rendering);
+                    response["base"] = static_cast<int64_t>(base_id);
+                } else {
+                    response = RenderingToJson(*rendering);
+                }
+                response["version"] = static_cast<int64_t>(function_id);
+                return response;
             }},
+            // Start a module upload: `upload <size> [lazy]`, reading function bodies on first use if `lazy` is given.
+            // The module itself follows as binary chunks, see `RunUploadChunk`
             {"upload", [](UserData *data, const llvm::json::Object &json, const std::vector<std::string> &args) -> llvm::json::Value {
-                auto file_hex_str = json.getString("file");
-                if (!file_hex_str) {
-                    return "invalid upload file";
+                if (args.size() < 2 || args.size() > 3 || (args.size() == 3 && args[2] != "lazy")) {
+                    return "Usage: upload <size> [lazy] - Upload an LLVM module of `size` bytes as binary chunks, reading function bodies on first use if `lazy` is given\n";
                 }
 
-                std::string file_str;
-                bool r = llvm::tryGetFromHex(*file_hex_str, file_str);
-                if (!r) {
-                    return "invalid upload file";
+                size_t size;
+                try {
+                    size = std::stoull(args[1], nullptr, 10);
+                } catch (...) {
+                    return "Invalid args";
                 }
-
-                std::unique_ptr<llvm::Module> mod{rellic::LoadModuleFromMemory(&(*data->llvm_context), file_str, true)};
-                if (!mod) {
+                if (size == 0) {
                     return "invalid upload file";
                 }
+                // The buffer is allocated up front, so its size is checked before trusting the client with it
+                if (size > (max_upload_size << 20)) {
+                    return "upload too large, the limit is " + std::to_string(max_upload_size) + " MiB";
+                }
 
-                // Only support having one module at a time due to design limitations
-//                data->explorer = std::make_unique<magnifier::BitcodeExplorer>(*data->llvm_context);
-
-                data->explorer->TakeModule(std::move(mod));
-                return "module uploaded";
+                data->upload = std::make_unique<ChunkedUpload>(size, args.size() == 3);
+                if (!data->upload->IsValid()) {
+                    data->upload.reset();
+                    return "upload too large";
+                }
+                return "upload started";
             }}
     };
 
-
     auto cmd_str = json.getString("cmd");
     auto packet_id = json.getInteger("id");
     if (!cmd_str || !packet_id) {
@@ -621,50 +1139,284 @@ llvm::json::Object HandleRequest(UserData *data, const llvm::json::Object &json)
 
 }
 
-us_listen_socket_t *listen_socket = nullptr;
+// The listen socket of the event loop running on this thread
+thread_local us_listen_socket_t *listen_socket = nullptr;
+
+// The event loops of every listener thread, so that `exit` can stop all of them
+std::mutex loops_mutex;
+std::vector<uWS::Loop *> loops;
+
+// Workspaces shared by the sessions that uploaded the same module
+WorkspaceRegistry workspaces;
+
+// Largest chunk of an upload, the payload of a binary frame is limited to it plus the packet id
+static constexpr size_t kMaxUploadChunkSize = 4 * 1024 * 1024;
+
+llvm::cl::opt<unsigned> listener_count("listeners", llvm::cl::desc("Number of event loop threads sharing the port, 0 for one per core"),
+                                       llvm::cl::init(1));
+llvm::cl::opt<std::string> module_cache_dir("module-cache", llvm::cl::desc("Directory caching parsed and indexed modules"),
+                                            llvm::cl::value_desc("path"));
+llvm::cl::opt<uint64_t> module_cache_size("module-cache-size", llvm::cl::desc("Size of the module cache in MiB"),
+                                          llvm::cl::init(magnifier::ModuleCache::kDefaultCapacity >> 20));
+
+// Uploads seen before, even by a previous run of the server, are restored from it rather than parsed and indexed again
+std::unique_ptr<magnifier::ModuleCache> module_cache;
+
+// Load a complete upload into `workspace`, through the module cache if there is one. Returns false if the upload is
+// not a valid module
+bool LoadUpload(ChunkedUpload &upload, Workspace &workspace) {
+    if (module_cache && upload.IsBitcode()) {
+        magnifier::LoadOptions options;
+        options.lazy = upload.IsLazy();
+        options.threads = 1;
+        options.cache = module_cache.get();
+        return workspace.explorer->LoadModule(upload.TakeBuffer(), options).Succeeded();
+    }
 
-int main(int argc, char **argv) {
-    llvm::InitLLVM x(argc, argv);
+    std::unique_ptr<llvm::Module> module = upload.Load(*workspace.llvm_context);
+    if (!module) {
+        return false;
+    }
+    workspace.explorer->TakeModule(std::move(module));
+    return true;
+}
 
+llvm::cl::opt<unsigned> worker_count("workers", llvm::cl::desc("Number of threads running commands, 0 for one per core"),
+                                     llvm::cl::init(0));
 
-    uWS::App().ws<UserData>("/ws", {
-        .maxPayloadLength = 50 * 1024 * 1024,
-        .open = [](auto *ws){
-            UserData *data = ws->getUserData();
-            data->llvm_context = std::make_unique<llvm::LLVMContext>();
-            data->explorer = std::make_unique<magnifier::BitcodeExplorer>(*data->llvm_context);
-        },
+// Parse and run a request, returning the response to send or nothing for `exit`
+std::optional<std::string> RunRequest(UserData *data, const std::string &message) {
+    auto json{llvm::json::parse(message)};
+    if (!json) {
+        llvm::consumeError(json.takeError());
+    }
+    if (!json || json->kind() != llvm::json::Value::Object) {
+        return JsonToString(llvm::json::Object {
+            {"message","Invalid JSON message"}
+        });
+    }
 
-        .message = [](auto *ws, std::string_view message, uWS::OpCode opCode) {
-            // Only deal with text
-            if (opCode != uWS::TEXT) {return;}
+    auto cmd_str = json->getAsObject()->getString("cmd");
+    if (cmd_str && *cmd_str == "exit") {
+        return std::nullopt;
+    }
+
+    // Commands run on the strand of the workspace, so every id assigned meanwhile belongs to a version this session
+    // produced, even if other sessions share the workspace
+    std::shared_ptr<Workspace> workspace = data->workspace;
+    magnifier::ValueId first_id = workspace->explorer->MaxCurrentID();
+    std::string response = JsonToString(HandleRequest(data, *json->getAsObject()));
+    magnifier::ValueId next_id = workspace->explorer->MaxCurrentID();
+    if (next_id != first_id) {
+        data->produced_ids.emplace_back(first_id, next_id);
+    }
+    return response;
+}
+
+// Add a chunk of the module being uploaded, sent as a binary frame made of a little endian 32-bit packet id followed
+// by the chunk. The module is loaded as soon as its last chunk arrives. `reply` is called with the response, on the
+// strand of the workspace the session ends up in once the module is loaded
+void RunUploadChunk(const std::shared_ptr<UserData> &data, std::string_view frame, llvm::ThreadPool &pool,
+                    const std::function<void(std::string)> &reply) {
+    if (frame.size() < 4) {
+        reply(JsonToString(llvm::json::Object {
+            {"message","Invalid upload chunk"}
+        }));
+        return;
+    }
+    int64_t packet_id = llvm::support::endian::read32le(frame.data());
+    std::string_view chunk = frame.substr(4);
+
+    auto respond = [packet_id](llvm::json::Value output) {
+        return JsonToString(llvm::json::Object {
+                {"cmd", "upload"},
+                {"id", packet_id},
+                {"output", std::move(output)}});
+    };
 
+    if (!data->upload) {
+        reply(respond("no upload in progress"));
+        return;
+    }
+    if (!data->upload->Append(chunk)) {
+        data->upload.reset();
+        reply(respond("upload larger than announced"));
+        return;
+    }
+    if (!data->upload->IsComplete()) {
+        reply(respond(llvm::json::Object {
+                {"received", static_cast<int64_t>(data->upload->Received())},
+                {"size", static_cast<int64_t>(data->upload->Size())}}));
+        return;
+    }
+
+    std::shared_ptr<ChunkedUpload> upload = std::move(data->upload);
+    data->workspace->strand->Post([data, upload, &pool, reply, respond] {
+        magnifier::BitcodeExplorer &explorer = *data->workspace->explorer;
+        if (data->workspace->IsShared()) {
+            reply(respond("a module shared with other sessions is already loaded"));
+            return;
+        }
 
-            auto json{llvm::json::parse(message)};
-            if (!json || json->kind() != llvm::json::Value::Object) {
-                ws->send(JsonToString(llvm::json::Object {
-                    {"message","Invalid JSON message"}
-                }), opCode);
+        // Modules uploaded after the first one are private to the session
+        if (explorer.MaxCurrentID() != magnifier::kInvalidValueId + 1) {
+            reply(respond(LoadUpload(*upload, *data->workspace) ? "module uploaded" : "invalid upload file"));
+            return;
+        }
+
+        // Join the sessions that uploaded the same module, if any, rather than loading another copy of it. The first
+        // session to get to the workspace on its strand loads it, and the others wait in its queue meanwhile
+        std::shared_ptr<Workspace> workspace = workspaces.Acquire(upload->Digest(), pool);
+        workspace->strand->Post([data, upload, workspace, reply, respond] {
+            if (workspace->state == Workspace::State::kEmpty) {
+                workspace->state =
+                        LoadUpload(*upload, *workspace) ? Workspace::State::kLoaded : Workspace::State::kInvalid;
+            }
+            if (workspace->state == Workspace::State::kInvalid) {
+                reply(respond("invalid upload file"));
                 return;
             }
+            data->workspace = workspace;
+            data->produced_ids.clear();
+            reply(respond("module uploaded"));
+        });
+    });
+}
 
-            if (json->getAsObject()->getString("cmd")->str() == "exit") {
-                std::cout << "exiting" << std::endl;
-                if (listen_socket) {
-                    us_listen_socket_close(0, listen_socket);
-                    listen_socket = nullptr;
-                }
-                return;
+// Leave the workspace of a closed session. A shared workspace outlives the session, so the versions it produced are
+// deleted first
+void ReleaseWorkspace(UserData *data) {
+    std::shared_ptr<Workspace> workspace = std::move(data->workspace);
+    if (!workspace->IsShared()) {
+        return;
+    }
+
+    std::vector<magnifier::ValueId> produced;
+    workspace->explorer->ForEachFunction([data, &produced](magnifier::ValueId function_id, llvm::Function &, magnifier::FunctionKind kind) {
+        if (kind == magnifier::FunctionKind::kGenerated && IsProducedBy(data, function_id)) {
+            produced.push_back(function_id);
+        }
+    });
+
+    // Commands never let a session reach the versions of another one, see `IsValueVisibleTo`, so only the versions
+    // produced after one of these may use it. Deleting them newest first leaves none in use
+    std::sort(produced.rbegin(), produced.rend());
+    for (magnifier::ValueId function_id : produced) {
+        if (!workspace->explorer->DeleteFunction(function_id)) {
+            workspace->decompilations.Erase(function_id);
+        }
+    }
+}
+
+// Close the listen socket of every listener thread. Connections that are still open are served until they close
+void StopListening() {
+    std::cout << "exiting" << std::endl;
+    std::lock_guard<std::mutex> lock(loops_mutex);
+    for (uWS::Loop *loop : loops) {
+        loop->defer([] {
+            if (listen_socket) {
+                us_listen_socket_close(0, listen_socket);
+                listen_socket = nullptr;
             }
+        });
+    }
+}
 
-            ws->send(JsonToString(HandleRequest(ws->getUserData(), *json->getAsObject())), opCode);
+// Run an event loop accepting connections on the shared port. A session stays on the thread that accepted it
+void RunListener(llvm::ThreadPool &worker_pool) {
+    {
+        std::lock_guard<std::mutex> lock(loops_mutex);
+        loops.push_back(uWS::Loop::get());
+    }
+
+    uWS::App().ws<SocketData>("/ws", {
+        .maxPayloadLength = kMaxUploadChunkSize + 4,
+        .open = [&worker_pool](auto *ws){
+            SocketData *socket_data = ws->getUserData();
+            socket_data->data = std::make_shared<UserData>();
+            socket_data->data->workspace = std::make_shared<Workspace>(worker_pool);
+            socket_data->strand = std::make_shared<Strand>(worker_pool);
+        },
+
+        .message = [&worker_pool](auto *ws, std::string_view message, uWS::OpCode opCode) {
+            // Text frames are commands, binary frames are upload chunks
+            if (opCode != uWS::TEXT && opCode != uWS::BINARY) {return;}
+
+            SocketData *socket_data = ws->getUserData();
+            uWS::Loop *loop = uWS::Loop::get();
+            // The command runs on the strand of the workspace. The session's next command waits for it in the queue
+            // of the session's strand, so no thread is held while the workspace is busy with other sessions
+            socket_data->strand->PostAsync([ws, loop, opCode, &worker_pool, data = socket_data->data,
+                                            message = std::string(message)](Strand::Resume resume) {
+                auto reply = [ws, loop, data, resume = std::move(resume)](std::optional<std::string> response) {
+                    // Sockets may only be used on the event loop thread that owns them
+                    loop->defer([ws, data, response = std::move(response)] {
+                        if (!response) {
+                            StopListening();
+                            return;
+                        }
+
+                        if (data->connected) {
+                            ws->send(*response, uWS::TEXT);
+                        }
+                    });
+                    resume();
+                };
+
+                if (opCode == uWS::BINARY) {
+                    RunUploadChunk(data, message, worker_pool, reply);
+                    return;
+                }
+                data->workspace->strand->Post([data, message, reply] {
+                    reply(RunRequest(data.get(), message));
+                });
+            });
+        },
+
+        .close = [](auto *ws, int code, std::string_view message) {
+            SocketData *socket_data = ws->getUserData();
+            socket_data->data->connected = false;
+            // After the commands still queued, which may use the workspace
+            socket_data->strand->PostAsync([data = socket_data->data](Strand::Resume resume) {
+                data->workspace->strand->Post([data, resume = std::move(resume)] {
+                    ReleaseWorkspace(data.get());
+                    resume();
+                });
+            });
         }
     }).listen(9001, [](auto *socket) {
         if (socket) {
-            std::cout << "Listening on port " << 9001 << std::endl;
             listen_socket = socket;
+        } else {
+            std::cout << "Failed to listen on port " << 9001 << std::endl;
         }
     }).run();
-    return 0;
+
+    std::lock_guard<std::mutex> lock(loops_mutex);
+    std::erase(loops, uWS::Loop::get());
 }
 
+int main(int argc, char **argv) {
+    llvm::InitLLVM x(argc, argv);
+    llvm::cl::ParseCommandLineOptions(argc, argv, "magnifier-ui\n");
+
+    if (!module_cache_dir.empty()) {
+        module_cache = std::make_unique<magnifier::ModuleCache>(module_cache_dir, module_cache_size << 20);
+    }
+
+    // Commands run here rather than on the event loop, so that a slow one only holds up its own session
+    llvm::ThreadPool worker_pool(llvm::hardware_concurrency(worker_count));
+
+    // Every listener binds the same port, and the kernel spreads new connections between them
+    unsigned thread_count = llvm::hardware_concurrency(listener_count).compute_thread_count();
+    std::vector<std::thread> listeners;
+    for (unsigned i = 0; i < thread_count; ++i) {
+        listeners.emplace_back(RunListener, std::ref(worker_pool));
+    }
+    std::cout << "Serving port " << 9001 << " from " << thread_count << " threads" << std::endl;
+
+    for (std::thread &listener : listeners) {
+        listener.join();
+    }
+    return 0;
+}
@@ -56,6 +56,22 @@ export default ({ app }, inject) => {
       })
     },
 
+    // Send a chunk of an upload as a binary frame, prefixed with its little endian packet id
+    async sendChunk (chunk) {
+      await this.checkConnection()
+      const id = this.packetId
+      this.packetId += 1
+
+      const frame = new Uint8Array(4 + chunk.byteLength)
+      new DataView(frame.buffer).setUint32(0, id, true)
+      frame.set(new Uint8Array(chunk), 4)
+      this._socket.send(frame)
+
+      return new Promise((resolve, reject) => {
+        this.receiveResolvers[id] = { resolve, reject }
+      })
+    },
+
     _socket: socket,
     connectionResolvers: [],
     receiveResolvers: {},
@@ -1,14 +1,59 @@
 import Vue from 'vue'
 
+// Modules are uploaded in chunks of this many bytes, one at a time
+const uploadChunkSize = 1024 * 1024
+
+// Functions are listed this many at a time
+const catalogPageSize = 1000
+
+// Stands for an id in the lines of IR sent by `dec`
+const idPlaceholder = '\u001f'
+
+// Build lines from the operations of a `dec` delta: [start, count] copies lines of `base`, a string is a new line
+function applyLineDelta (base, operations) {
+  const lines = []
+  for (const operation of operations) {
+    if (typeof operation === 'string') {
+      lines.push(operation)
+      continue
+    }
+    const [start, count] = operation
+    for (let i = start; i < start + count; i++) {
+      lines.push(base[i])
+    }
+  }
+  return lines
+}
+
+// Fill the id placeholders of the IR lines with ids sent as [first, count] runs
+function renderIR (lines, idRuns) {
+  const ids = []
+  for (const [first, count] of idRuns) {
+    for (let i = 0; i < count; i++) {
+      ids.push(first + i)
+    }
+  }
+  const parts = lines.join('\n').split(idPlaceholder)
+  let content = parts[0]
+  for (let i = 1; i < parts.length; i++) {
+    content += ids[i - 1] + parts[i]
+  }
+  return content
+}
+
 export const state = () => ({
   counter: 0,
   terminalOutput: '',
   funcs: {},
+  // Version of the function catalog `funcs` was listed at, see the `lfc` command
+  catalogVersion: undefined,
   currentFuncId: 1,
   currentFuncIRContent: '',
   currentFuncDecompiledContent: '',
   currentIRSelection: undefined,
-  currentProvenanceMap: {}
+  currentProvenanceMap: {},
+  // Output of `dec` for the function shown, kept to apply the deltas of the next function against it
+  currentRendering: undefined
 })
 
 export const mutations = {
@@ -18,6 +63,17 @@ export const mutations = {
   setFuncs (state, { funcs }) {
     Vue.set(state, 'funcs', funcs)
   },
+  applyFuncChanges (state, { updated, removed }) {
+    for (const { id, name } of updated) {
+      Vue.set(state.funcs, id, name)
+    }
+    for (const id of removed) {
+      Vue.delete(state.funcs, id)
+    }
+  },
+  setCatalogVersion (state, { version }) {
+    state.catalogVersion = version
+  },
   setCurrentFuncIRContent (state, { content }) {
     state.currentFuncIRContent = content
   },
@@ -36,26 +92,21 @@ export const mutations = {
   setCurrentIRSelection (state, { id }) {
     state.currentIRSelection = id
   },
+  setCurrentRendering (state, { rendering }) {
+    state.currentRendering = rendering
+  },
   setCurrentProvenanceMap (state, { provenance }) {
     const newMap = {}
-    for (const map in provenance) {
-      for (const [from, to] of provenance[map]) {
-        if (!from || !to) {
-          continue
-        }
-
-        const fromHex = from.toString(16)
-        const toHex = to.toString(16)
-        if (!newMap[fromHex]) {
-          newMap[fromHex] = []
-        }
-        newMap[fromHex].push(toHex)
+    for (const [from, to] of provenance) {
+      if (!newMap[from]) {
+        newMap[from] = []
+      }
+      newMap[from].push(to)
 
-        if (!newMap[toHex]) {
-          newMap[toHex] = []
-        }
-        newMap[toHex].push(fromHex)
+      if (!newMap[to]) {
+        newMap[to] = []
       }
+      newMap[to].push(from)
     }
     Vue.set(state, 'currentProvenanceMap', newMap)
   }
@@ -63,41 +114,72 @@ export const mutations = {
 
 export const actions = {
   async updateFuncs ({ commit, state, dispatch }) {
-    const { output } = await this.$socket.send({
-      cmd: 'lfa'
-    })
+    const knownFuncs = state.funcs
+    let newFunctions = []
+
+    // Only fetch what changed since the last listing, unless the server no longer tracks changes that old
+    let changes
+    if (state.catalogVersion !== undefined) {
+      const { output } = await this.$socket.send({
+        cmd: `lfc ${state.catalogVersion}`
+      })
+      changes = output
+    }
+
+    if (typeof changes === 'object' && !changes.reset) {
+      newFunctions = changes.updated.filter(({ id }) => !knownFuncs[id]).map(({ id }) => id)
+      await commit('applyFuncChanges', { updated: changes.updated, removed: changes.removed })
+      await commit('setCatalogVersion', { version: changes.version })
+    } else {
+      // Changes made while paging are caught up with from the version of the first page on
+      const funcs = {}
+      let version
+      let after = 0
+      do {
+        const { output } = await this.$socket.send({
+          cmd: `lfp ${after} ${catalogPageSize}`
+        })
+        if (typeof output !== 'object') {
+          return
+        }
+        for (const { id, name } of output.functions) {
+          funcs[id] = name
+          if (!knownFuncs[id]) { newFunctions.push(id) }
+        }
+        version = version ?? output.version
+        after = output.next
+      } while (after)
+
+      await commit('setFuncs', { funcs })
+      await commit('setCatalogVersion', { version })
+    }
 
-    if (output.trim().length <= 0) {
-      await commit('setFuncs', { funcs: {} })
+    const ids = Object.keys(state.funcs).map(id => parseInt(id))
+    if (ids.length <= 0) {
+      await commit('setCurrentRendering', { rendering: undefined })
       await commit('setCurrentFuncIRContent', { content: '' })
       await commit('setCurrentFuncDecompiledContent', { content: '' })
       return
     }
 
-    const updateFuncList = {}
-    const newFunctions = []
-    let funcPrecedingCurr = 1
-    output.trim().split('\n').forEach((l) => {
-      const [idStr, name] = l.trim().split(' ')
-      const id = parseInt(idStr)
-      updateFuncList[id] = name
-      if (!state.funcs[id]) { newFunctions.push(id) }
-      if (id <= state.currentFuncId) { funcPrecedingCurr = id }
-    })
-
-    await commit('setFuncs', { funcs: updateFuncList })
-
+    // Listings and changes are in increasing id order
     if (newFunctions.length > 0) {
       await commit('setCurrentFuncId', { id: newFunctions[0] })
       await dispatch('updateFuncContent')
-    } else if (!updateFuncList[state.currentFuncId]) {
+    } else if (!state.funcs[state.currentFuncId]) {
+      let funcPrecedingCurr = ids[0]
+      for (const id of ids) {
+        if (id <= state.currentFuncId) { funcPrecedingCurr = id }
+      }
       await commit('setCurrentFuncId', { id: funcPrecedingCurr })
       await dispatch('updateFuncContent')
     }
   },
   async updateFuncContent ({ state, commit }) {
+    // Only the changes from the function shown are sent, unless the server no longer has its output
+    const held = state.currentRendering
     const { output } = await this.$socket.send({
-      cmd: `dec ${state.currentFuncId}`
+      cmd: held ? `dec ${state.currentFuncId} ${held.version}` : `dec ${state.currentFuncId}`
     })
 
     if (typeof output !== 'object') {
@@ -105,18 +187,38 @@ export const actions = {
       return
     }
 
-    const { ir, code, provenance } = output
+    let rendering
+    if (output.base !== undefined && held && output.base === held.version) {
+      const removed = new Set(output.provenance.removed.map(pair => pair.join(' ')))
+      rendering = {
+        version: output.version,
+        ir: applyLineDelta(held.ir, output.ir),
+        irIds: output.ir_ids,
+        code: applyLineDelta(held.code, output.code),
+        provenance: held.provenance.filter(pair => !removed.has(pair.join(' '))).concat(output.provenance.added)
+      }
+    } else {
+      rendering = {
+        version: output.version,
+        ir: output.ir,
+        irIds: output.ir_ids,
+        code: output.code,
+        provenance: output.provenance
+      }
+    }
+
+    await commit('setCurrentRendering', { rendering })
 
     await commit('setCurrentFuncIRContent', {
-      content: ir
+      content: renderIR(rendering.ir, rendering.irIds)
     })
 
     await commit('setCurrentFuncDecompiledContent', {
-      content: code
+      content: rendering.code.join('\n')
     })
 
     await commit('setCurrentProvenanceMap', {
-      provenance
+      provenance: rendering.provenance
     })
   },
   async focusFunc ({ commit, dispatch }, { id }) {
@@ -136,11 +238,15 @@ export const actions = {
   parseWsData ({ commit, dispatch }, { cmd, output }) {
     // handle unknown data here
   },
-  async uploadBitcode ({ dispatch }, { file }) {
+  async uploadBitcode ({ commit, dispatch }, { file }) {
     await this.$socket.send({
-      cmd: 'upload',
-      file
+      cmd: `upload ${file.byteLength}`
     })
+    for (let offset = 0; offset < file.byteLength; offset += uploadChunkSize) {
+      await this.$socket.sendChunk(file.slice(offset, offset + uploadChunkSize))
+    }
+    // The session may now share the catalog of another one, list it from scratch
+    await commit('setCatalogVersion', { version: undefined })
     await dispatch('updateFuncs')
     await dispatch('updateFuncContent')
   }
@@ -7,6 +7,7 @@
  */
 
 #include <magnifier/BitcodeExplorer.h>
+#include <magnifier/ModuleCache.h>
 
 #include <magnifier/IFunctionResolver.h>
 #include <magnifier/ISubstitutionObserver.h>
@@ -15,9 +16,12 @@
 #include <llvm/Support/ToolOutputFile.h>
 #include <llvm/Support/MemoryBuffer.h>
 #include <llvm/Bitcode/BitcodeReader.h>
+#include <llvm/Support/CommandLine.h>
 #include <llvm/Support/FileSystem.h>
+#include <llvm/Support/FormatVariadic.h>
 #include <llvm/Support/InitLLVM.h>
 
+#include <algorithm>
 #include <iostream>
 #include <memory>
 #include <string>
@@ -57,6 +61,7 @@ public:
                 {magnifier::SubstitutionKind::kConstantFolding, "Constant folding"},
                 {magnifier::SubstitutionKind::kValueSubstitution, "Value substitution"},
                 {magnifier::SubstitutionKind::kFunctionDevirtualization, "Function devirtualization"},
+                {magnifier::SubstitutionKind::kInstructionSimplification, "Instruction simplification"},
         };
         tool_output.os() << "perform substitution: ";
         instr->print(tool_output.os());
@@ -65,6 +70,28 @@ public:
     }
 };
 
+llvm::cl::opt<std::string> module_cache_dir("module-cache", llvm::cl::desc("Directory caching parsed and indexed modules"),
+                                            llvm::cl::value_desc("path"));
+llvm::cl::opt<uint64_t> module_cache_size("module-cache-size", llvm::cl::desc("Size of the module cache in MiB"),
+                                          llvm::cl::init(magnifier::ModuleCache::kDefaultCapacity >> 20));
+
+void LoadModules(magnifier::BitcodeExplorer &explorer, llvm::ToolOutputFile &tool_output, const std::vector<std::string> &filenames, bool lazy, magnifier::ModuleCache *cache) {
+    static const std::unordered_map<magnifier::LoadError, std::string> load_error_map = {
+            {magnifier::LoadError::kCannotReadFile, "File not found or unreadable"},
+            {magnifier::LoadError::kInvalidBitcode, "File is not a valid bitcode file"},
+    };
+
+    magnifier::LoadOptions options;
+    options.lazy = lazy;
+    options.cache = cache;
+    magnifier::Result<size_t, magnifier::LoadError> result = explorer.LoadModules(filenames, options);
+    if (result.Succeeded()) {
+        tool_output.os() << "Loaded " << result.Value() << " modules\n";
+    } else {
+        tool_output.os() << "Load modules failed (error: " << load_error_map.at(result.Error()) << ")\n";
+    }
+}
+
 void RunOptimization(magnifier::BitcodeExplorer &explorer, llvm::ToolOutputFile &tool_output, magnifier::ValueId function_id, llvm::OptimizationLevel level) {
     static const std::unordered_map<magnifier::OptimizationError, std::string> optimization_error_map = {
             {magnifier::OptimizationError::kInvalidOptimizationLevel, "The provided optimization level is not allowed"},
@@ -79,11 +106,46 @@ void RunOptimization(magnifier::BitcodeExplorer &explorer, llvm::ToolOutputFile
     }
 }
 
+void PrintHistogram(llvm::raw_ostream &os, const char *name, const magnifier::LatencyHistogram &histogram) {
+    auto to_us = [](std::chrono::nanoseconds duration) -> double { return duration.count() / 1000.0; };
+    os << llvm::formatv("{0,-18} {1,8} {2,12:f1} {3,10:f1} {4,10:f1} {5,10:f1} {6,10:f1}\n", name, histogram.Count(),
+                        to_us(histogram.Total()), to_us(histogram.Mean()), to_us(histogram.Percentile(50)),
+                        to_us(histogram.Percentile(99)), to_us(histogram.Max()));
+}
+
+void PrintStats(const magnifier::ExplorerStats &stats, llvm::raw_ostream &os) {
+    static const char *header = "{0,-18} {1,8} {2,12} {3,10} {4,10} {5,10} {6,10}\n";
+    os << llvm::formatv(header, "operation", "count", "total us", "mean us", "p50 us", "p99 us", "max us");
+    for (size_t i = 0; i < magnifier::kExplorerOperationCount; ++i) {
+        auto operation = static_cast<magnifier::ExplorerOperation>(i);
+        PrintHistogram(os, magnifier::GetOperationName(operation), stats[operation]);
+    }
+    os << "\n" << llvm::formatv(header, "phase", "count", "total us", "mean us", "p50 us", "p99 us", "max us");
+    for (size_t i = 0; i < magnifier::kExplorerPhaseCount; ++i) {
+        auto phase = static_cast<magnifier::ExplorerPhase>(i);
+        PrintHistogram(os, magnifier::GetPhaseName(phase), stats[phase]);
+    }
+    os << "\nInstructions cloned: " << stats.instructions_cloned << "\n"
+       << "Instructions inlined: " << stats.instructions_inlined << "\n"
+       << "Instructions folded: " << stats.instructions_folded << "\n"
+       << "Instructions indexed: " << stats.instructions_indexed << "\n"
+       << "Verification failures: " << stats.verification_failures << "\n"
+       << "Print cache hits: " << stats.print_cache_hits << "\n"
+       << "Print cache misses: " << stats.print_cache_misses << "\n"
+       << "Module cache hits: " << stats.module_cache_hits << "\n"
+       << "Module cache misses: " << stats.module_cache_misses << "\n";
+}
+
 int main(int argc, char **argv) {
     llvm::InitLLVM x(argc, argv);
+    llvm::cl::ParseCommandLineOptions(argc, argv, "magnifier repl\n");
     llvm::LLVMContext llvm_context;
-    llvm::ExitOnError llvm_exit_on_err;
-    llvm_exit_on_err.setBanner("llvm error: ");
+
+    // Modules loaded before are restored from the cache rather than parsed and indexed again
+    std::unique_ptr<magnifier::ModuleCache> module_cache;
+    if (!module_cache_dir.empty()) {
+        module_cache = std::make_unique<magnifier::ModuleCache>(module_cache_dir, module_cache_size << 20);
+    }
 
     magnifier::BitcodeExplorer explorer(llvm_context);
 
@@ -99,10 +161,10 @@ int main(int argc, char **argv) {
     SubstitutionObserver substitution_observer(tool_output);
 
     std::unordered_map<std::string, std::function<void(const std::vector<std::string> &)>> cmd_map = {
-            // Load module: `lm <path>`
-            {"lm", [&explorer, &llvm_exit_on_err, &llvm_context, &tool_output](const std::vector<std::string> &args) -> void {
-                if (args.size() != 2) {
-                    tool_output.os() << "Usage: lm <path> - Load/open an LLVM .bc or .ll module\n";
+            // Load module: `lm <path> [lazy]`
+            {"lm", [&explorer, &tool_output, &module_cache](const std::vector<std::string> &args) -> void {
+                if ((args.size() != 2 && args.size() != 3) || (args.size() == 3 && args[2] != "lazy")) {
+                    tool_output.os() << "Usage: lm <path> [lazy] - Load/open an LLVM .bc module, reading function bodies on first use if `lazy` is given\n";
                     return;
                 }
                 const std::string &filename = args[1];
@@ -113,14 +175,74 @@ int main(int argc, char **argv) {
                     return;
                 }
 
-                std::unique_ptr<llvm::MemoryBuffer> llvm_memory_buffer = llvm_exit_on_err(
-                        errorOrToExpected(llvm::MemoryBuffer::getFileOrSTDIN(filename)));
-                llvm::BitcodeFileContents llvm_bitcode_contents = llvm_exit_on_err(
-                        llvm::getBitcodeFileContents(*llvm_memory_buffer));
+                LoadModules(explorer, tool_output, {filename}, args.size() == 3, module_cache.get());
+            }},
+            // Load directory: `ld <path> [lazy]`
+            {"ld", [&explorer, &tool_output, &module_cache](const std::vector<std::string> &args) -> void {
+                if ((args.size() != 2 && args.size() != 3) || (args.size() == 3 && args[2] != "lazy")) {
+                    tool_output.os() << "Usage: ld <path> [lazy] - Load every .bc module in a directory in parallel, reading function bodies on first use if `lazy` is given\n";
+                    return;
+                }
+                const std::filesystem::path dir_path = std::filesystem::path(args[1]);
+
+                if (!std::filesystem::is_directory(dir_path)) {
+                    tool_output.os() << "Unable to open directory: " << args[1] << "\n";
+                    return;
+                }
 
-                for (auto &llvm_mod: llvm_bitcode_contents.Mods) {
-                    std::unique_ptr<llvm::Module> mod = llvm_exit_on_err(llvm_mod.parseModule(llvm_context));
-                    explorer.TakeModule(std::move(mod));
+                // Sort the files so that ids do not depend on the directory order
+                std::vector<std::string> filenames;
+                for (const auto &entry : std::filesystem::directory_iterator(dir_path)) {
+                    if (entry.is_regular_file() && entry.path().extension() == ".bc") {
+                        filenames.push_back(entry.path().string());
+                    }
+                }
+                std::sort(filenames.begin(), filenames.end());
+
+                LoadModules(explorer, tool_output, filenames, args.size() == 3, module_cache.get());
+            }},
+            // Save session: `save <path>`
+            {"save", [&explorer, &tool_output](const std::vector<std::string> &args) -> void {
+                static const std::unordered_map<magnifier::SnapshotError, std::string> snapshot_error_map = {
+                        {magnifier::SnapshotError::kCannotWriteFile,     "Snapshot file could not be written"},
+                        {magnifier::SnapshotError::kCannotReadFile,      "Snapshot file not found or unreadable"},
+                        {magnifier::SnapshotError::kInvalidSnapshot,     "File is not a valid snapshot"},
+                        {magnifier::SnapshotError::kExplorerNotEmpty,    "Snapshots can only be restored before loading any module"},
+                        {magnifier::SnapshotError::kCannotReadFunction,  "The body of a lazily loaded function could not be read"},
+                };
+
+                if (args.size() != 2) {
+                    tool_output.os() << "Usage: save <path> - Save the modules, ids and function versions to a snapshot file\n";
+                    return;
+                }
+
+                std::optional<magnifier::SnapshotError> result = explorer.SaveSnapshot(args[1]);
+                if (!result) {
+                    tool_output.os() << "Saved snapshot: " << args[1] << "\n";
+                } else {
+                    tool_output.os() << "Save snapshot failed (error: " << snapshot_error_map.at(result.value()) << ")\n";
+                }
+            }},
+            // Restore session: `restore <path>`
+            {"restore", [&explorer, &tool_output](const std::vector<std::string> &args) -> void {
+                static const std::unordered_map<magnifier::SnapshotError, std::string> snapshot_error_map = {
+                        {magnifier::SnapshotError::kCannotWriteFile,     "Snapshot file could not be written"},
+                        {magnifier::SnapshotError::kCannotReadFile,      "Snapshot file not found or unreadable"},
+                        {magnifier::SnapshotError::kInvalidSnapshot,     "File is not a valid snapshot"},
+                        {magnifier::SnapshotError::kExplorerNotEmpty,    "Snapshots can only be restored before loading any module"},
+                        {magnifier::SnapshotError::kCannotReadFunction,  "The body of a lazily loaded function could not be read"},
+                };
+
+                if (args.size() != 2) {
+                    tool_output.os() << "Usage: restore <path> - Restore a snapshot file saved with `save`\n";
+                    return;
+                }
+
+                magnifier::Result<size_t, magnifier::SnapshotError> result = explorer.RestoreSnapshot(args[1]);
+                if (result.Succeeded()) {
+                    tool_output.os() << "Restored " << result.Value() << " modules\n";
+                } else {
+                    tool_output.os() << "Restore snapshot failed (error: " << snapshot_error_map.at(result.Error()) << ")\n";
                 }
             }},
             // List functions: `lf`
@@ -194,6 +316,50 @@ int main(int argc, char **argv) {
                     tool_output.os() << "Delete function failed for id: " << function_id << " (error: " << deletion_error_map.at(result.value()) << ")\n";
                 }
             }},
+            // Collect unused generated functions: `gc [<versions_per_lineage>]`
+            {"gc", [&explorer, &tool_output](const std::vector<std::string> &args) -> void {
+                if (args.size() > 2) {
+                    tool_output.os() << "Usage: gc [<versions_per_lineage>] - Delete generated functions outside of the retention policy\n";
+                    return;
+                }
+
+                if (args.size() == 2) {
+                    magnifier::RetentionPolicy policy = explorer.GetRetentionPolicy();
+                    policy.versions_per_lineage = std::stoul(args[1], nullptr, 10);
+                    explorer.SetRetentionPolicy(policy);
+                }
+
+                magnifier::CollectionStats stats = explorer.CollectGarbage();
+                tool_output.os() << "Reclaimed " << stats.functions_erased << " functions (" << stats.instructions_erased << " instructions)\n";
+            }},
+            // Pin function: `pin <function_id>`
+            {"pin", [&explorer, &tool_output](const std::vector<std::string> &args) -> void {
+                if (args.size() != 2) {
+                    tool_output.os() << "Usage: pin <function_id> - Keep function during garbage collection\n";
+                    return;
+                }
+
+                magnifier::ValueId function_id = std::stoul(args[1], nullptr, 10);
+                if (explorer.PinFunction(function_id)) {
+                    tool_output.os() << "Pinned function with id: " << function_id << "\n";
+                } else {
+                    tool_output.os() << "Function not found: " << function_id << "\n";
+                }
+            }},
+            // Unpin function: `unpin <function_id>`
+            {"unpin", [&explorer, &tool_output](const std::vector<std::string> &args) -> void {
+                if (args.size() != 2) {
+                    tool_output.os() << "Usage: unpin <function_id> - Allow garbage collection of function\n";
+                    return;
+                }
+
+                magnifier::ValueId function_id = std::stoul(args[1], nullptr, 10);
+                if (explorer.UnpinFunction(function_id)) {
+                    tool_output.os() << "Unpinned function with id: " << function_id << "\n";
+                } else {
+                    tool_output.os() << "Function is not pinned: " << function_id << "\n";
+                }
+            }},
             // Inline function call: `ic <instruction_id>`
             {"ic", [&explorer, &tool_output, &resolver, &substitution_observer](const std::vector<std::string> &args) -> void {
                 static const std::unordered_map<magnifier::InlineError, std::string> inline_error_map = {
@@ -203,6 +369,7 @@ int main(int argc, char **argv) {
                         {magnifier::InlineError::kInlineOperationFailed,   "Inline operation failed"},
                         {magnifier::InlineError::kVariadicFunction,        "Inlining variadic function is yet to be supported"},
                         {magnifier::InlineError::kResolveFunctionTypeMismatch, "Resolve function type mismatch"},
+                        {magnifier::InlineError::kNoCallInlined,           "No call could be inlined within the budget"},
                 };
 
                 if (args.size() != 2) {
@@ -219,6 +386,40 @@ int main(int argc, char **argv) {
                     tool_output.os() << "Inline function call failed for id: " << instruction_id << " (error: " << inline_error_map.at(result.Error()) << ")\n";
                 }
             }},
+            // Inline call tree: `ict <id> [<max_depth> [<max_instructions>]]`
+            {"ict", [&explorer, &tool_output, &resolver, &substitution_observer](const std::vector<std::string> &args) -> void {
+                static const std::unordered_map<magnifier::InlineError, std::string> inline_error_map = {
+                        {magnifier::InlineError::kNotACallBaseInstruction, "Not a CallBase instruction"},
+                        {magnifier::InlineError::kInstructionNotFound,     "Instruction not found"},
+                        {magnifier::InlineError::kCannotResolveFunction,   "Cannot resolve function"},
+                        {magnifier::InlineError::kInlineOperationFailed,   "Inline operation failed"},
+                        {magnifier::InlineError::kVariadicFunction,        "Inlining variadic function is yet to be supported"},
+                        {magnifier::InlineError::kResolveFunctionTypeMismatch, "Resolve function type mismatch"},
+                        {magnifier::InlineError::kNoCallInlined,           "No call could be inlined within the budget"},
+                };
+
+                if (args.size() < 2 || args.size() > 4) {
+                    tool_output.os() << "Usage: ict <id> [<max_depth> [<max_instructions>]] - Inline the call tree below a call, or below every call of a function\n";
+                    return;
+                }
+
+                magnifier::ValueId value_id = std::stoul(args[1], nullptr, 10);
+                magnifier::InlineBudget budget;
+                if (args.size() > 2) {
+                    budget.max_depth = std::stoul(args[2], nullptr, 10);
+                }
+                if (args.size() > 3) {
+                    budget.max_instructions = std::stoul(args[3], nullptr, 10);
+                }
+
+                magnifier::Result<magnifier::ValueId, magnifier::InlineError> result = explorer.InlineCallTree(value_id, budget, resolver, substitution_observer);
+
+                if (result.Succeeded()) {
+                    explorer.PrintFunction(result.Value(), tool_output.os());
+                } else {
+                    tool_output.os() << "Inline call tree failed for id: " << value_id << " (error: " << inline_error_map.at(result.Error()) << ")\n";
+                }
+            }},
             // Substitute with value: `sv <id> <val>`
             {"sv", [&explorer, &tool_output, &substitution_observer](const std::vector<std::string> &args) -> void {
                 static const std::unordered_map<magnifier::SubstitutionError, std::string> substitution_error_map = {
@@ -257,6 +458,33 @@ int main(int argc, char **argv) {
                     tool_output.os() << "Substitute value failed for id:  " << value_id << " (error: " << substitution_error_map.at(result.Error()) << ")\n";
                 }
             }},
+            // Substitute several values at once: `svm <id> <val> [<id> <val> ...]`
+            {"svm", [&explorer, &tool_output, &substitution_observer](const std::vector<std::string> &args) -> void {
+                static const std::unordered_map<magnifier::SubstitutionError, std::string> substitution_error_map = {
+                        {magnifier::SubstitutionError::kIdNotFound,    "Instruction or argument not found"},
+                        {magnifier::SubstitutionError::kIncorrectType, "Value has non-integer type"},
+                        {magnifier::SubstitutionError::kCannotUseFunctionId, "Expecting an instruction or argument id instead of a function id"},
+                        {magnifier::SubstitutionError::kFunctionMismatch, "Values belong to different functions"},
+                        {magnifier::SubstitutionError::kNoSubstitutions, "No substitution given"},
+                };
+
+                if (args.size() < 3 || args.size() % 2 != 1) {
+                    tool_output.os() << "Usage: svm <id> <val> [<id> <val> ...] - Substitute several values of one function at once\n";
+                    return;
+                }
+
+                std::vector<magnifier::Substitution> substitutions;
+                for (size_t i = 1; i < args.size(); i += 2) {
+                    substitutions.push_back({std::stoul(args[i], nullptr, 10), std::stoul(args[i + 1], nullptr, 10)});
+                }
+
+                magnifier::Result<magnifier::ValueId, magnifier::SubstitutionError> result = explorer.ApplySubstitutions(substitutions, substitution_observer);
+                if (result.Succeeded()) {
+                    explorer.PrintFunction(result.Value(), tool_output.os());
+                } else {
+                    tool_output.os() << "Substitute values failed (error: " << substitution_error_map.at(result.Error()) << ")\n";
+                }
+            }},
             // Optimize function bitcode using optimization level -O1: `o1 <id>`
             {"o1", [&explorer, &tool_output, &substitution_observer](const std::vector<std::string> &args) -> void {
                 if (args.size() != 2) {
@@ -287,6 +515,64 @@ int main(int argc, char **argv) {
                 magnifier::ValueId function_id = std::stoul(args[1], nullptr, 10);
                 RunOptimization(explorer, tool_output, function_id, llvm::OptimizationLevel::O3);
             }},
+            // Print optimization timings: `ot`
+            {"ot", [&explorer, &tool_output](const std::vector<std::string> &args) -> void {
+                if (args.size() != 1) {
+                    tool_output.os() << "Usage: ot - Print time spent setting up and running optimization pipelines\n";
+                    return;
+                }
+
+                magnifier::OptimizationStats stats = explorer.GetOptimizationStats();
+                tool_output.os() << "Setup: " << std::chrono::duration_cast<std::chrono::microseconds>(stats.setup_time).count() << "us ("
+                                 << stats.pipelines_built << " pipelines)\n";
+                tool_output.os() << "Run: " << std::chrono::duration_cast<std::chrono::microseconds>(stats.run_time).count() << "us ("
+                                 << stats.runs << " functions)\n";
+            }},
+            // Verification policy: `verify [off|sampled [<interval>]|function|module]`
+            {"verify", [&explorer, &tool_output](const std::vector<std::string> &args) -> void {
+                static const std::unordered_map<std::string, magnifier::VerificationLevel> level_map = {
+                        {"off",      magnifier::VerificationLevel::kOff},
+                        {"sampled",  magnifier::VerificationLevel::kSampled},
+                        {"function", magnifier::VerificationLevel::kFunction},
+                        {"module",   magnifier::VerificationLevel::kModule},
+                };
+
+                if (args.size() > 3 || (args.size() >= 2 && !level_map.count(args[1])) || (args.size() == 3 && args[1] != "sampled")) {
+                    tool_output.os() << "Usage: verify [off|sampled [<interval>]|function|module] - Set or print how produced functions are verified\n";
+                    return;
+                }
+
+                magnifier::VerificationPolicy policy = explorer.GetVerificationPolicy();
+                if (args.size() >= 2) {
+                    policy.level = level_map.at(args[1]);
+                    if (args.size() == 3) {
+                        policy.sample_interval = std::max(1ul, std::stoul(args[2], nullptr, 10));
+                    }
+                    explorer.SetVerificationPolicy(policy);
+                }
+
+                for (auto &[name, level] : level_map) {
+                    if (level == policy.level) {
+                        tool_output.os() << "Verification: " << name;
+                    }
+                }
+                if (policy.level == magnifier::VerificationLevel::kSampled) {
+                    tool_output.os() << " (1 in " << policy.sample_interval << ")";
+                }
+                tool_output.os() << "\n";
+            }},
+            // Print statistics: `stats [reset]`
+            {"stats", [&explorer, &tool_output](const std::vector<std::string> &args) -> void {
+                if (args.size() > 2 || (args.size() == 2 && args[1] != "reset")) {
+                    tool_output.os() << "Usage: stats [reset] - Print operation and phase latencies and instruction counters, then clear them if `reset` is given\n";
+                    return;
+                }
+
+                PrintStats(explorer.GetStats(), tool_output.os());
+                if (args.size() == 2) {
+                    explorer.ResetStats();
+                }
+            }},
     };
 
 //    cmd_map["lm"](split("lm ../test.bc", ' '));
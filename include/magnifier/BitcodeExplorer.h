@@ -9,13 +9,20 @@
 #pragma once
 
 #include <llvm/Passes/PassBuilder.h>
+#include <llvm/Transforms/Utils/ValueMapper.h>
+#include <magnifier/ExplorerStats.h>
 #include <magnifier/ISubstitutionObserver.h>
+#include <magnifier/RenderCache.h>
 #include <magnifier/Result.h>
 
+#include <chrono>
 #include <cstdint>
+#include <initializer_list>
 #include <map>
 #include <optional>
+#include <set>
 #include <string>
+#include <utility>
 #include <vector>
 
 namespace llvm {
@@ -25,18 +32,31 @@ class Instruction;
 class LLVMContext;
 class Module;
 class raw_ostream;
-class WeakVH;
 class Value;
 class Use;
 class FunctionCallee;
 class Type;
 class BasicBlock;
+class CallBase;
 class CallInst;
+class InlineFunctionInfo;
+class InlineResult;
+class MemoryBuffer;
 }  // namespace llvm
 
 namespace magnifier {
+class FunctionCatalog;
+class FunctionVersionStore;
 class IdCommentWriter;
+class ModuleCache;
+class ModuleIndexer;
+class OptimizationEngine;
 class IFunctionResolver;
+class SnapshotReader;
+class SnapshotWriter;
+class ValueIdTable;
+class ValueIndex;
+struct LoadedFile;
 
 using ValueId = uint64_t;
 static constexpr ValueId kInvalidValueId = 0;
@@ -52,6 +72,142 @@ enum class FunctionKind {
   kGenerated,  // Functions generated after an operation (inlining, etc)
 };
 
+enum class VersionOperation {
+  kOriginal,          // Loaded from a module or indexed on first use
+  kInline,            // Produced by `InlineFunctionCall`
+  kSubstitution,      // Produced by `Substitute*WithValue`
+  kOptimization,      // Produced by `OptimizeFunction`
+  kDevirtualization,  // Produced by `DevirtualizeFunction`
+};
+
+// Describes where an indexed function comes from. Every operation leaves its
+// input untouched and produces a new version of it, so the versions derived
+// from one original function form a tree rooted at that function.
+struct FunctionVersion {
+  // The `ValueId` of the version.
+  ValueId function_id;
+  // The version this one was derived from, or `kInvalidValueId` for original
+  // functions. The parent may have been deleted since.
+  ValueId parent_id;
+  // The original function at the root of the tree, i.e. its
+  // `ValueIdKind::kOriginal` id.
+  ValueId lineage_id;
+  // The operation that produced this version.
+  VersionOperation operation;
+};
+
+// An entry of the function catalog, see `ListFunctions`.
+struct FunctionInfo {
+  ValueId function_id;
+  // Empty for unnamed functions.
+  std::string name;
+  FunctionKind kind;
+  // The version this one was derived from, or `kInvalidValueId`, see
+  // `FunctionVersion`.
+  ValueId parent_id;
+  // Number of instructions. Functions of lazily loaded modules have none
+  // until their body is read.
+  size_t instruction_count;
+  // The module holding the function.
+  const llvm::Module *module;
+};
+
+// A page of the function catalog, returned by `ListFunctions`.
+struct FunctionPage {
+  // In increasing id order.
+  std::vector<FunctionInfo> functions;
+  // The catalog version the page was read at. Passing it to
+  // `GetCatalogChanges` once every page was read keeps the listing current.
+  uint64_t catalog_version;
+  // The id to list the next page after, or `kInvalidValueId` if this is the
+  // last page.
+  ValueId next;
+};
+
+// How the function catalog changed since a version, returned by
+// `GetCatalogChanges`.
+struct CatalogChanges {
+  // Functions added or changed since, e.g. when the body of a lazily loaded
+  // function is read, in increasing id order.
+  std::vector<FunctionInfo> updated;
+  // Ids of the functions deleted since.
+  std::vector<ValueId> removed;
+  // The current catalog version.
+  uint64_t catalog_version;
+};
+
+// Controls which generated functions `CollectGarbage` erases. Original
+// functions, pinned functions and functions that are still used by other code
+// are always kept.
+struct RetentionPolicy {
+  // Number of most recent generated versions kept in each lineage.
+  size_t versions_per_lineage{16};
+  // Run the collector after every operation that produces a new version.
+  // This has no effect while `versions_per_lineage` is zero, as the version
+  // that was just produced would be collected right away.
+  bool collect_after_operation{false};
+};
+
+enum class VerificationLevel {
+  kOff,       // Never verify
+  kSampled,   // Verify one in `sample_interval` produced functions
+  kFunction,  // Verify every produced function with `llvm::verifyFunction`
+  kModule,    // Verify the whole module after every step of an operation
+};
+
+// Controls how much of the IR is checked with the llvm verifier while
+// operations run. Explorers start at `kFunction`, or at `kModule` in debug
+// builds of the library.
+struct VerificationPolicy {
+  VerificationLevel level{VerificationLevel::kFunction};
+  // Used by `kSampled`.
+  unsigned sample_interval{16};
+};
+
+// What a `CollectGarbage` run reclaimed.
+struct CollectionStats {
+  size_t functions_erased{0};
+  size_t instructions_erased{0};
+};
+
+// Cumulative timings of `OptimizeFunction`.
+struct OptimizationStats {
+  // Time spent building the pass builder, analysis managers and pipelines.
+  std::chrono::nanoseconds setup_time{0};
+  // Time spent running the pipelines.
+  std::chrono::nanoseconds run_time{0};
+  // Number of pipelines built, at most one per optimization level.
+  size_t pipelines_built{0};
+  // Number of functions optimized.
+  size_t runs{0};
+};
+
+// Controls how `LoadModules` reads bitcode files.
+struct LoadOptions {
+  // Only read function bodies on first use, see `TakeModule`.
+  bool lazy{false};
+  // Number of threads used to parse and index modules. Zero uses one thread
+  // per core.
+  unsigned threads{0};
+  // Modules found in the cache are restored from it rather than parsed and
+  // indexed, and the others are added to it once loaded. Ids are the same
+  // either way.
+  ModuleCache *cache{nullptr};
+};
+
+enum class LoadError {
+  kCannotReadFile,  // File not found or unreadable
+  kInvalidBitcode,  // File is not a valid bitcode file
+};
+
+enum class SnapshotError {
+  kCannotWriteFile,     // Snapshot file could not be written
+  kCannotReadFile,      // Snapshot file not found or unreadable
+  kInvalidSnapshot,     // File is not a valid snapshot
+  kExplorerNotEmpty,    // Snapshots can only be restored into an empty explorer
+  kCannotReadFunction,  // A lazily loaded function body could not be read
+};
+
 enum class InlineError {
   kNotACallBaseInstruction,  // Not a CallBase instruction
   kInstructionNotFound,      // Instruction not found
@@ -59,12 +215,31 @@ enum class InlineError {
   kInlineOperationFailed,    // Inline operation failed
   kVariadicFunction,  // Inlining variadic function is yet to be supported
   kResolveFunctionTypeMismatch,  // Resolve function type mismatch
+  kNoCallInlined,  // No call could be inlined within the budget
+};
+
+// Limits how far `InlineCallTree` inlines.
+struct InlineBudget {
+  // Calls are inlined up to this many levels below the starting point.
+  unsigned max_depth{5};
+  // A call is skipped if inlining it would grow the function beyond this
+  // many instructions.
+  size_t max_instructions{10000};
 };
 
 enum class SubstitutionError {
   kIdNotFound,           // ValueId not found
   kIncorrectType,        // Instruction is not of the desired type
   kCannotUseFunctionId,  // Expecting an instruction id instead of a function id
+  kFunctionMismatch,     // Values belong to different functions
+  kNoSubstitutions,      // No substitution was given
+};
+
+// A substitution for `ApplySubstitutions`: replace the instruction or argument
+// with id `id` by the integer `value`.
+struct Substitution {
+  ValueId id;
+  uint64_t value;
 };
 
 enum class OptimizationError {
@@ -87,42 +262,48 @@ enum class DevirtualizeError {
 
 class BitcodeExplorer {
  private:
-  // Reference to the llvm context
+  // Reference to the llvm context of modules passed to `TakeModule`.
   llvm::LLVMContext &llvm_context;
-  // ID of the `!explorer.id` metadata. This metadata holds the unique ID of
-  // this value.
-  const unsigned md_explorer_id;
-  // ID of the `!explorer.source_id` metadata. This metadata tracks the
-  // provenance of a value. If a value, e.g. an instruction, is from a function,
-  // then usually the `!explorer.id` and `!explorer.source_id` match. However,
-  // if the value has been subject to mutation or inlining, then the
-  // `!explorer.source_id` will stay constant while the `!explorer.id` will
-  // change.
-  const unsigned md_explorer_source_id;
-  // ID of the `!explorer.block_id` metadata. This metadata should only be
-  // attached to terminator instructions of basic blocks. It serves a similar
-  // purpose as `!explorer.id` but for uniquely identifying `BasicBlock` values.
-  const unsigned md_explorer_block_id;
-  // ID of the `!explorer.substitution_kind_id` metadata. This metadata should
-  // only be attached to instructions that are going to be substituted by
-  // `ElideSubstitutionHooks`. It helps determine the `SubstitutionKind` of that
-  // instruction. It's most commonly applied to `CallInst` values calling the
-  // substitute hook function.
-  const unsigned md_explorer_substitution_kind_id;
   // Annotator object used for annotating function disassembly. It prints the
   // various metadata attached to each value.
   std::unique_ptr<llvm::AssemblyAnnotationWriter> annotator;
+  // Side table holding the ids of every indexed function and instruction.
+  // Ids are only attached to values as `!explorer.*` metadata, see
+  // `MetadataKinds`, when they are written out with `WriteMetadata`.
+  std::unique_ptr<ValueIdTable> id_table;
+  // The lineage of every indexed function.
+  std::unique_ptr<FunctionVersionStore> versions;
+  // Name, kind, parent, size and module of every indexed function, kept up to
+  // date so that listing functions does not have to walk the modules.
+  std::unique_ptr<FunctionCatalog> catalog;
+  // Functions that `CollectGarbage` must keep regardless of `retention`.
+  std::set<ValueId> pinned_functions;
+  // The policy used by `CollectGarbage`.
+  RetentionPolicy retention;
+  // How produced functions are verified.
+  VerificationPolicy verification;
+  // Functions produced since the last one verified under
+  // `VerificationLevel::kSampled`.
+  unsigned unverified_versions{0};
+  // Pass pipelines and analysis managers used by `OptimizeFunction`. Created
+  // on first use.
+  std::unique_ptr<OptimizationEngine> optimizer;
+  // Counters and latency histograms of every operation and of its phases.
+  ExplorerStats stats;
+  // Output of `PrintFunction` for recently printed functions.
+  RenderCache printed_functions;
+  // Contexts of the modules loaded by `LoadModules`, one per module.
+  std::vector<std::unique_ptr<llvm::LLVMContext>> owned_contexts;
+  // Bitcode that modules loaded lazily by `LoadModules` still read from.
+  std::vector<std::unique_ptr<llvm::MemoryBuffer>> module_buffers;
   // This is a vector of all the llvm `Module` objects ingested using
-  // `TakeModule`.
+  // `TakeModule` or `LoadModules`.
   std::vector<std::unique_ptr<llvm::Module>> opened_modules;
-  // A map between unique `ValueId`s and their corresponding functions.
-  std::map<ValueId, llvm::WeakVH> function_map;
-  // A map between unique `ValueId`s and their corresponding instructions.
-  std::map<ValueId, llvm::WeakVH> instruction_map;
-  // A map between unique `ValueId`s and their corresponding basic blocks.
-  std::map<ValueId, llvm::WeakVH> block_map;
-  // A map between unique `ValueId`s and their corresponding function arguments.
-  std::map<ValueId, llvm::WeakVH> argument_map;
+  // Functions of lazily loaded modules whose body has not been indexed yet.
+  std::set<llvm::Function *> lazy_functions;
+  // A dense table between unique `ValueId`s and their corresponding
+  // functions, instructions, basic blocks and function arguments.
+  std::unique_ptr<ValueIndex> value_index;
   // An increment only counter used for assigning unique ids to values.
   ValueId value_id_counter;
   // A temporary map between types and their corresponding substitute hook
@@ -130,14 +311,21 @@ class BitcodeExplorer {
   // during an operation. It should be cleared at the end of any high-level
   // operation.
   std::map<llvm::Type *, llvm::FunctionCallee> hook_functions;
+  // The hook calls created by `CreateHookCallInst` since the last call to
+  // `ElideSubstitutionHooks`, i.e. the ones in the function the current
+  // operation works on. Like `hook_functions`, it is cleared at the end of any
+  // high-level operation.
+  std::vector<llvm::CallInst *> hook_calls;
 
   // Elide all substitute hooks present in `function`. Uses
   // `substitute_value_func` to guide the substitution process
   void ElideSubstitutionHooks(llvm::Function &function,
                               ISubstitutionObserver &substitution_observer);
 
-  // Convert from opaque type `ValueIdKind` to actual llvm `kind_id`.
-  [[nodiscard]] unsigned ValueIdKindToKindId(ValueIdKind kind) const;
+  // Erase the hook functions in `hook_functions`, which must no longer be
+  // called, and clear the map. Every high-level operation that created hooks
+  // ends with this, whether it succeeds or not.
+  void EraseHookFunctions();
 
   // Get a `FunctionCallee` object for the given `type`. Create the function in
   // `func_module` if it doesn't exist. In addition, the object is added to the
@@ -147,18 +335,128 @@ class BitcodeExplorer {
 
   // Create and return a `CallInst` for calling the substitution hook.
   // It also attaches the correct `SubstitutionKind` metadata to the
-  // instruction.
+  // instruction and records it in `hook_calls`.
   llvm::CallInst *CreateHookCallInst(llvm::Type *type,
                                      llvm::Module *func_module,
                                      SubstitutionKind hook_kind,
                                      llvm::Value *old_val,
                                      llvm::Value *new_val);
 
-  // Update/index a function by adding various metadata to function,
-  // instruction, and block values. Also update `function_map`,
-  // `instruction_map`, and `block_map` to reflect the changes.
+  // Resolve the function `call_base` calls with `resolver`, check that it can
+  // be inlined there and index it if needed.
+  Result<llvm::Function *, InlineError> ResolveCallee(
+      llvm::CallBase *call_base, IFunctionResolver &resolver);
+
+  // `llvm::InlineFunction` with bookkeeping for `stats`. The callee of
+  // `call_base` must be a function.
+  llvm::InlineResult InlineCall(llvm::CallBase &call_base,
+                                llvm::InlineFunctionInfo &info);
+
+  // Add substitution hooks for the arguments and the return value of
+  // `call_base`, which is about to be inlined. Returns the call to inline,
+  // which replaces `call_base` if it returns a value.
+  llvm::CallBase *HookCallSite(llvm::CallBase *call_base);
+
+  // Verify `function` after an intermediate step of an operation. This only
+  // happens at `VerificationLevel::kModule`.
+  void VerifyStep(llvm::Function &function);
+
+  // Verify `function`, the version an operation just produced, as required
+  // by `verification`.
+  void VerifyVersion(llvm::Function &function);
+
+  // Verify `function` or its whole module and count failures in `stats`.
+  void Verify(llvm::Function &function, bool whole_module);
+
+  // Add the indexed function with `function_id` to `catalog`, or update its
+  // entry. Its parent is read from `versions`, so add its version first.
+  void AddToCatalog(ValueId function_id);
+
+  // Update/index a function by assigning ids to function, instruction, and
+  // block values. Also update `value_index` to reflect the changes.
   void UpdateMetadata(llvm::Function &function);
 
+  // The two halves of `UpdateMetadata`: ids for the function and its
+  // arguments, and ids for its instructions and blocks.
+  void UpdateFunctionMetadata(llvm::Function &function);
+  void UpdateBodyMetadata(llvm::Function &function);
+
+  // Read the body of a lazily loaded `function` and index it. Returns false
+  // if the body could not be read, in which case the function is treated as
+  // not found.
+  bool EnsureMaterialized(llvm::Function &function);
+
+  // Add the ids assigned by `indexer` to the explorer. The ids must start at
+  // `value_id_counter`.
+  void MergeIndex(const ModuleIndexer &indexer);
+
+  // Parse, index and take the modules of `files`, see `LoadModules`.
+  Result<size_t, LoadError> LoadFiles(std::vector<LoadedFile> &files,
+                                      const LoadOptions &options);
+
+  // Write the modules of `file`, which were just loaded with ids from
+  // `first_id` on, to `cache`.
+  void AddToCache(ModuleCache &cache, const LoadedFile &file, bool lazy,
+                  ValueId first_id);
+
+  // Add the ids of the functions of `module` and of their instructions to
+  // `writer`, shifted so that `first_id` becomes 1. Returns the ids of the
+  // functions added, unshifted.
+  std::vector<ValueId> AddToSnapshot(SnapshotWriter &writer,
+                                     llvm::Module &module,
+                                     ValueId first_id) const;
+
+  // Give the functions of every module of `reader` and their instructions
+  // the ids recorded for them, shifted so that 1 becomes `first_id`, along
+  // with their versions and pins. `module_functions` lists the functions of
+  // each module in order.
+  void TakeSnapshotIds(
+      const SnapshotReader &reader,
+      const std::vector<std::vector<llvm::Function *>> &module_functions,
+      ValueId first_id);
+
+  // Clone `function`, replace each of `values`, instructions or arguments of
+  // `function`, with its integer and return the id of the clone.
+  ValueId SubstituteValues(
+      llvm::Function &function,
+      const std::vector<std::pair<llvm::Value *, uint64_t>> &values,
+      ISubstitutionObserver &observer);
+
+  // Index `function` as a new version produced from `parent` by `operation`
+  // and return its id. Every instruction gets new ids, including those copied
+  // unchanged from `parent`: `parent` keeps its own, and an id names a single
+  // instruction.
+  ValueId AddVersion(llvm::Function &function, const llvm::Function &parent,
+                     VersionOperation operation);
+
+  // Clone `function` into its own module. The ids of the function and its
+  // instructions are carried over to the clone, where the derived and block
+  // ids stand in until `AddVersion` replaces them.
+  llvm::Function *CloneFunction(llvm::Function &function,
+                                llvm::ValueToValueMapTy &value_map);
+
+  // Remove the function with `function_id` from the index and erase it.
+  // Returns the number of instructions erased.
+  size_t PurgeFunction(ValueId function_id, llvm::Function *function);
+
+  // Forget the ids of `instruction` and erase it from its parent.
+  void EraseInstruction(llvm::Instruction *instruction);
+
+  // Forget the ids of `function` and its instructions and erase it from its
+  // parent.
+  void EraseFunction(llvm::Function *function);
+
+  // Attach the ids of `kinds` held in `id_table` to `function` and its
+  // instructions as `!explorer.*` metadata. This is used to carry ids through
+  // llvm utilities that copy metadata but are unaware of `id_table`, e.g.
+  // `llvm::InlineFunction` or the optimization pipeline.
+  void WriteMetadata(llvm::Function &function,
+                     std::initializer_list<ValueIdKind> kinds) const;
+
+  // Move any `!explorer.*` metadata attached to `function` and its
+  // instructions into `id_table`.
+  void ReadMetadata(llvm::Function &function);
+
  public:
   explicit BitcodeExplorer(llvm::LLVMContext &llvm_context);
 
@@ -168,22 +466,84 @@ class BitcodeExplorer {
 
   // Ingest `module` and take ownership.
   // It updates `opened_modules` and indexes all the functions inside the
-  // module.
+  // module. If `module` was loaded lazily, e.g. with
+  // `llvm::getOwningLazyBitcodeModule`, functions are listed right away but
+  // their bodies are only read and indexed on first use.
   void TakeModule(std::unique_ptr<llvm::Module> module);
 
+  // Parse and take every module of the bitcode files at `paths` using a pool
+  // of threads. Each module gets its own `llvm::LLVMContext`, owned by the
+  // explorer, so functions can only be inlined or devirtualized within the
+  // file they come from. Ids are assigned as if the modules were passed to
+  // `TakeModule` one by one in order, whatever the number of threads.
+  // Nothing is taken if any file fails to load. Returns the number of modules
+  // taken.
+  Result<size_t, LoadError> LoadModules(const std::vector<std::string> &paths,
+                                        const LoadOptions &options = {});
+
+  // Like `LoadModules`, for a bitcode file that is already in memory, e.g.
+  // one received over the network.
+  Result<size_t, LoadError> LoadModule(
+      std::unique_ptr<llvm::MemoryBuffer> bitcode,
+      const LoadOptions &options = {});
+
+  // Write the modules, the ids and the version history of the explorer to
+  // `path`, so that the session can be picked up again with
+  // `RestoreSnapshot`. Bodies of lazily loaded functions are read, but not
+  // indexed. Functions that do not belong to a module taken by the explorer
+  // are left out.
+  std::optional<SnapshotError> SaveSnapshot(const std::string &path);
+
+  // Restore a snapshot written by `SaveSnapshot` into this explorer, which
+  // must not hold any module yet. Every id is the same as when the snapshot
+  // was saved. Modules that were in the context passed to the constructor are
+  // restored into it; the others get new contexts owned by the explorer.
+  // Returns the number of modules restored.
+  Result<size_t, SnapshotError> RestoreSnapshot(const std::string &path);
+
   // Invoke `callback` on every indexed function while providing its `ValueID`
-  // and `FunctionKind`.
+  // and `FunctionKind`. Functions of lazily loaded modules are passed without
+  // reading their body.
   void ForEachFunction(const std::function<void(ValueId, llvm::Function &,
                                                 FunctionKind)> &callback);
 
-  // Given the function id, print function disassembly to `output_stream`
+  // Returns the catalog entries of up to `limit` functions with ids above
+  // `after`, in increasing id order. Listing from `kInvalidValueId` starts
+  // with the first function.
+  [[nodiscard]] FunctionPage ListFunctions(ValueId after, size_t limit) const;
+
+  // Returns the catalog version, which increases every time a function is
+  // added to the catalog, changed or deleted.
+  [[nodiscard]] uint64_t GetCatalogVersion() const;
+
+  // Returns the functions added, changed or deleted after catalog version
+  // `since`, or nothing if changes that old are no longer tracked, in which
+  // case the functions must be listed again with `ListFunctions`.
+  [[nodiscard]] std::optional<CatalogChanges> GetCatalogChanges(
+      uint64_t since) const;
+
+  // Given the function id, print function disassembly to `output_stream`.
+  // The output of recently printed functions is cached.
   bool PrintFunction(ValueId function_id, llvm::raw_ostream &output_stream);
 
+  // Bound the size of the output cached by `PrintFunction`, in bytes. Zero
+  // disables the cache.
+  void SetPrintCacheCapacity(size_t capacity);
+
   // Inline a call instruction
   Result<ValueId, InlineError> InlineFunctionCall(
       ValueId instruction_id, IFunctionResolver &resolver,
       ISubstitutionObserver &substitution_observer);
 
+  // Inline the call with id `value_id` and, transitively, the calls of the
+  // inlined code, or do so for every call of the function with id `value_id`.
+  // Calls that cannot be resolved or that exceed `budget` are left in place.
+  // All hooks are elided at once and a single new version is produced.
+  Result<ValueId, InlineError> InlineCallTree(
+      ValueId value_id, const InlineBudget &budget,
+      IFunctionResolver &resolver,
+      ISubstitutionObserver &substitution_observer);
+
   // Substitute an instruction with integer value
   Result<ValueId, SubstitutionError> SubstituteInstructionWithValue(
       ValueId instruction_id, uint64_t value, ISubstitutionObserver &observer);
@@ -192,14 +552,49 @@ class BitcodeExplorer {
   Result<ValueId, SubstitutionError> SubstituteArgumentWithValue(
       ValueId argument_id, uint64_t value, ISubstitutionObserver &observer);
 
+  // Substitute several instructions and arguments of one function with
+  // integer values at once, producing a single new version. If an id appears
+  // more than once, its last value is used.
+  Result<ValueId, SubstitutionError> ApplySubstitutions(
+      const std::vector<Substitution> &substitutions,
+      ISubstitutionObserver &observer);
+
   // Optimize a function using a certain `optimization_level`
   Result<ValueId, OptimizationError> OptimizeFunction(
       ValueId function_id,
       const llvm::OptimizationLevel &optimization_level);
 
+  // Returns the accumulated timings of `OptimizeFunction`.
+  [[nodiscard]] OptimizationStats GetOptimizationStats() const;
+
+  // Returns the counters and latency histograms of the operations run so far.
+  [[nodiscard]] const ExplorerStats &GetStats() const;
+
+  // Clear the counters and histograms returned by `GetStats`.
+  void ResetStats();
+
   // Delete a function that is not in use
   std::optional<DeletionError> DeleteFunction(ValueId function_id);
 
+  // Erase every generated function that is not kept by the retention policy,
+  // is not pinned and is not used by any remaining code.
+  CollectionStats CollectGarbage();
+
+  void SetRetentionPolicy(const RetentionPolicy &policy);
+
+  void SetVerificationPolicy(const VerificationPolicy &policy);
+
+  [[nodiscard]] const VerificationPolicy &GetVerificationPolicy() const;
+
+  [[nodiscard]] const RetentionPolicy &GetRetentionPolicy() const;
+
+  // Keep the function with `function_id` across `CollectGarbage` runs.
+  // Returns false if there is no such function.
+  bool PinFunction(ValueId function_id);
+
+  // Undo `PinFunction`. Returns false if the function was not pinned.
+  bool UnpinFunction(ValueId function_id);
+
   // Devirtualize an indirect function call into a direct one
   Result<ValueId, DevirtualizeError> DevirtualizeFunction(
       ValueId instruction_id, ValueId function_id,
@@ -215,23 +610,38 @@ class BitcodeExplorer {
   [[nodiscard]] ValueId GetId(const llvm::Instruction &instruction,
                               ValueIdKind kind) const;
 
-  // Set an id inside the metadata of a function.
+  // Set an id of a function.
   void SetId(llvm::Function &function, ValueId value, ValueIdKind kind) const;
 
-  // Set an id inside the metadata of an instruction.
+  // Set an id of an instruction.
   void SetId(llvm::Instruction &instruction, ValueId value,
              ValueIdKind kind) const;
 
-  // Remove id of `kind` from `function` metadata.
+  // Remove id of `kind` from `function`.
   void RemoveId(llvm::Function &function, ValueIdKind kind);
 
-  // Remove id of `kind` from `instruction` metadata.
+  // Remove id of `kind` from `instruction`.
   void RemoveId(llvm::Instruction &instruction, ValueIdKind kind);
 
+  // Attach the ids of every indexed function in `module` and of their
+  // instructions as `!explorer.*` metadata, e.g. before writing the module
+  // out. Modules carrying this metadata keep their provenance when they are
+  // loaded again with `TakeModule`.
+  void WriteMetadata(llvm::Module &module) const;
+
   ValueId MaxCurrentID();
 
   std::optional<llvm::Function *> GetFunctionById(ValueId);
 
+  // Returns the id of the function that `value_id` identifies, or that the
+  // argument, block or instruction with `value_id` belongs to, or
+  // `kInvalidValueId` if there is none.
+  [[nodiscard]] ValueId GetOwningFunctionId(ValueId value_id) const;
+
+  // Returns the lineage of the function with `function_id`.
+  [[nodiscard]] std::optional<FunctionVersion> GetFunctionVersion(
+      ValueId function_id) const;
+
   // Either gets the current id for a function or indexes the function.
   ValueId IndexFunction(llvm::Function &function);
 };
@@ -0,0 +1,127 @@
+/*
+ * Copyright (c) 2021-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+namespace magnifier {
+
+// The steps `BitcodeExplorer` operations are made of.
+enum class ExplorerPhase : unsigned {
+  kClone,          // Cloning the function an operation works on
+  kHookInsertion,  // Adding substitution hooks
+  kInline,         // `llvm::InlineFunction`
+  kElideHooks,     // `ElideSubstitutionHooks`
+  kIndex,          // Assigning ids to new functions and instructions
+  kVerify,         // Running the llvm verifier
+  kOptimize,       // Running an optimization pipeline
+  kPrint,          // Printing a function
+};
+
+// The public `BitcodeExplorer` operations that are timed as a whole.
+enum class ExplorerOperation : unsigned {
+  kLoad,              // `TakeModule` and `LoadModules`
+  kInline,            // `InlineFunctionCall`
+  kInlineCallTree,    // `InlineCallTree`
+  kSubstitution,      // `Substitute*WithValue` and `ApplySubstitutions`
+  kOptimization,      // `OptimizeFunction`
+  kDevirtualization,  // `DevirtualizeFunction`
+  kCollectGarbage,    // `CollectGarbage`
+  kSnapshot,          // `SaveSnapshot` and `RestoreSnapshot`
+};
+
+static constexpr size_t kExplorerPhaseCount =
+    static_cast<size_t>(ExplorerPhase::kPrint) + 1;
+static constexpr size_t kExplorerOperationCount =
+    static_cast<size_t>(ExplorerOperation::kSnapshot) + 1;
+
+// Returns a short name for `phase`, e.g. "clone".
+const char *GetPhaseName(ExplorerPhase phase);
+
+// Returns a short name for `operation`, e.g. "inline".
+const char *GetOperationName(ExplorerOperation operation);
+
+// A latency distribution with power of two buckets. Bucket 0 holds samples
+// under 1us and bucket `i` holds samples in `[2^(i-1), 2^i)` us; the last
+// bucket also holds everything slower.
+class LatencyHistogram {
+ public:
+  static constexpr size_t kBucketCount = 32;
+
+ private:
+  std::array<uint64_t, kBucketCount> buckets{};
+  uint64_t count{0};
+  std::chrono::nanoseconds total{0};
+  std::chrono::nanoseconds min{std::chrono::nanoseconds::max()};
+  std::chrono::nanoseconds max{0};
+
+ public:
+  void Record(std::chrono::nanoseconds latency);
+
+  [[nodiscard]] uint64_t Count() const { return count; }
+  [[nodiscard]] std::chrono::nanoseconds Total() const { return total; }
+  // Both are zero while the histogram is empty.
+  [[nodiscard]] std::chrono::nanoseconds Min() const;
+  [[nodiscard]] std::chrono::nanoseconds Max() const { return max; }
+  [[nodiscard]] std::chrono::nanoseconds Mean() const;
+
+  // Returns an upper bound of the `percentile`th (0 to 100) sample, i.e. the
+  // upper end of its bucket, capped at `Max()`.
+  [[nodiscard]] std::chrono::nanoseconds Percentile(double percentile) const;
+
+  [[nodiscard]] const std::array<uint64_t, kBucketCount> &Buckets() const {
+    return buckets;
+  }
+};
+
+// Counters and latency histograms of a `BitcodeExplorer`, see
+// `BitcodeExplorer::GetStats`. Operations are timed whether or not they
+// succeed.
+struct ExplorerStats {
+  std::array<LatencyHistogram, kExplorerPhaseCount> phases;
+  std::array<LatencyHistogram, kExplorerOperationCount> operations;
+
+  // Instructions copied by cloning a function before modifying it.
+  uint64_t instructions_cloned{0};
+  // Instructions copied into callers by `llvm::InlineFunction`.
+  uint64_t instructions_inlined{0};
+  // Instructions replaced by constant folding or simplification while
+  // eliding hooks.
+  uint64_t instructions_folded{0};
+  // Instructions that were given ids.
+  uint64_t instructions_indexed{0};
+  // Functions or modules the llvm verifier rejected.
+  uint64_t verification_failures{0};
+  // `PrintFunction` calls answered from the cache, and the ones that were not.
+  uint64_t print_cache_hits{0};
+  uint64_t print_cache_misses{0};
+  // Files `LoadModules` restored from `LoadOptions::cache`, and the ones it
+  // had to parse and index.
+  uint64_t module_cache_hits{0};
+  uint64_t module_cache_misses{0};
+
+  [[nodiscard]] LatencyHistogram &operator[](ExplorerPhase phase) {
+    return phases[static_cast<size_t>(phase)];
+  }
+  [[nodiscard]] const LatencyHistogram &operator[](ExplorerPhase phase) const {
+    return phases[static_cast<size_t>(phase)];
+  }
+  [[nodiscard]] LatencyHistogram &operator[](ExplorerOperation operation) {
+    return operations[static_cast<size_t>(operation)];
+  }
+  [[nodiscard]] const LatencyHistogram &operator[](
+      ExplorerOperation operation) const {
+    return operations[static_cast<size_t>(operation)];
+  }
+};
+
+}  // namespace magnifier
@@ -0,0 +1,32 @@
+/*
+ * Copyright (c) 2021-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <llvm/Transforms/Utils/ValueMapper.h>
+
+#include <memory>
+
+namespace llvm {
+class Function;
+class Module;
+}  // namespace llvm
+
+namespace magnifier {
+
+// Copy `function` into a new module of its own, in the same context, for
+// tools that work on whole modules but only care about one function. The
+// functions it references become declarations and the global variables it
+// references, directly or through initializers, are copied along. The
+// module's data layout, target triple and module flags are kept.
+// `value_map` maps the values of `function` to their copies. `function` must
+// be materialized.
+std::unique_ptr<llvm::Module> SliceFunction(const llvm::Function &function,
+                                            llvm::ValueToValueMapTy &value_map);
+
+}  // namespace magnifier
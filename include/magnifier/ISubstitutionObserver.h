@@ -21,6 +21,7 @@ enum class SubstitutionKind {
   kConstantFolding,
   kValueSubstitution,
   kFunctionDevirtualization,
+  kInstructionSimplification,  // Simplified to a non-constant value
 };
 
 class ISubstitutionObserver {
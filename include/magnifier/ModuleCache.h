@@ -0,0 +1,73 @@
+/*
+ * Copyright (c) 2021-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <string>
+
+namespace llvm {
+class StringRef;
+}  // namespace llvm
+
+namespace magnifier {
+
+// A directory of modules that were already parsed and indexed, used through
+// `LoadOptions::cache`. Entries are keyed by the SHA-256 of the bitcode a
+// module was loaded from, so the same module is found again whatever its
+// path, after a restart or from another process. The directory is bounded by
+// the total size of its entries; the least recently used ones are removed
+// first.
+class ModuleCache {
+ public:
+  static constexpr uint64_t kDefaultCapacity = uint64_t(4) << 30;
+
+ private:
+  std::string directory;
+  uint64_t capacity;
+  // Serializes evictions within the process.
+  std::mutex mutex;
+
+  [[nodiscard]] std::string GetPath(const std::string &key) const;
+
+  // Remove the least recently used entries until the directory fits in
+  // `capacity`.
+  void Evict();
+
+ public:
+  explicit ModuleCache(std::string directory,
+                       uint64_t capacity = kDefaultCapacity);
+
+  // Returns the key of the entry for `bitcode`. Entries of lazily loaded
+  // modules have other ids than the eagerly loaded ones, so they get their
+  // own key.
+  static std::string GetKey(llvm::StringRef bitcode, bool lazy);
+
+  // Returns the path of the entry for `key` and marks it as most recently
+  // used, or nothing if there is none.
+  std::optional<std::string> Find(const std::string &key);
+
+  // Add an entry for `key`, which `write` writes to the path it is given and
+  // returns false if it could not. The entry is only moved in place once it
+  // is complete, replacing any entry for `key`, and the least recently used
+  // entries are then evicted to stay within capacity. Readers of a replaced
+  // or evicted entry keep their copy.
+  bool Insert(const std::string &key,
+              const std::function<bool(const std::string &)> &write);
+
+  // Evicts entries right away if the cache is over the new `capacity`.
+  void SetCapacity(uint64_t capacity);
+
+  [[nodiscard]] const std::string &GetDirectory() const { return directory; }
+  [[nodiscard]] uint64_t Capacity() const { return capacity; }
+};
+
+}  // namespace magnifier
@@ -0,0 +1,63 @@
+/*
+ * Copyright (c) 2021-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+namespace magnifier {
+
+// A least recently used cache of text rendered for functions, keyed by
+// function id and bounded by the total size of the cached text. Functions are
+// not modified once they have an id, so an entry stays valid until its
+// function is erased.
+class RenderCache {
+ public:
+  static constexpr size_t kDefaultCapacity = 64 * 1024 * 1024;
+
+ private:
+  using Entry = std::pair<uint64_t, std::string>;
+
+  // Most recently used first.
+  std::list<Entry> entries;
+  std::unordered_map<uint64_t, std::list<Entry>::iterator> index;
+  size_t capacity;
+  size_t size{0};
+
+  void Evict(size_t limit);
+
+ public:
+  explicit RenderCache(size_t capacity = kDefaultCapacity);
+
+  // Returns the text cached for `id` and marks it as most recently used, or
+  // nullptr if there is none. The pointer is valid until the next change.
+  const std::string *Find(uint64_t id);
+
+  // Cache `text` for `id`, evicting the least recently used entries to stay
+  // within capacity. Text larger than the whole capacity is not cached.
+  void Insert(uint64_t id, std::string text);
+
+  void Erase(uint64_t id);
+
+  void Clear();
+
+  // Evicts entries right away if the cache is over the new `capacity`.
+  void SetCapacity(size_t capacity);
+
+  [[nodiscard]] size_t Capacity() const { return capacity; }
+  // Total size of the cached text in bytes.
+  [[nodiscard]] size_t Size() const { return size; }
+  [[nodiscard]] size_t EntryCount() const { return entries.size(); }
+};
+
+}  // namespace magnifier
@@ -6,8 +6,11 @@
  * the LICENSE file found in the root directory of this source tree.
  */
 
-#include <llvm/Analysis/AliasAnalysis.h>
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/MapVector.h>
+#include <llvm/ADT/SmallPtrSet.h>
 #include <llvm/Analysis/ConstantFolding.h>
+#include <llvm/Analysis/InstructionSimplify.h>
 #include <llvm/Bitcode/BitcodeReader.h>
 #include <llvm/IR/Function.h>
 #include <llvm/IR/IRBuilder.h>
@@ -18,26 +21,67 @@
 #include <llvm/IR/Module.h>
 #include <llvm/IR/PassManager.h>
 #include <llvm/IR/Type.h>
+#include <llvm/IR/ValueHandle.h>
 #include <llvm/IR/Verifier.h>
 #include <llvm/Passes/PassBuilder.h>
 #include <llvm/Support/FormatVariadic.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/ThreadPool.h>
+#include <llvm/Support/Threading.h>
 #include <llvm/Support/ToolOutputFile.h>
+#include <llvm/Support/raw_ostream.h>
 #include <llvm/Transforms/Utils/Cloning.h>
+// `InstructionWorklist` logs under the `DEBUG_TYPE` of its includer.
+#define DEBUG_TYPE "magnifier"
+#include <llvm/Transforms/Utils/InstructionWorklist.h>
+#undef DEBUG_TYPE
 #include <magnifier/BitcodeExplorer.h>
 #include <magnifier/IFunctionResolver.h>
 #include <magnifier/ISubstitutionObserver.h>
+#include <magnifier/ModuleCache.h>
 
+#include <algorithm>
+#include <deque>
 #include <iostream>
+#include <unordered_map>
+#include <unordered_set>
 
+#include "FunctionCatalog.h"
+#include "FunctionVersionStore.h"
 #include "IdCommentWriter.h"
-
-#if 1
-#define MAG_DEBUG(...) __VA_ARGS__
-#else
-#define MAG_DEBUG(...)
-#endif
+#include "ModuleIndexer.h"
+#include "OptimizationEngine.h"
+#include "ScopedTimer.h"
+#include "Snapshot.h"
+#include "ValueIdTable.h"
+#include "ValueIndex.h"
 
 namespace magnifier {
+
+// A module parsed by `LoadModules`, together with its own context.
+struct LoadedModule {
+  std::unique_ptr<llvm::LLVMContext> context;
+  std::unique_ptr<llvm::Module> module;
+  // Null for modules restored from a cache entry, which are indexed already.
+  std::unique_ptr<ModuleIndexer> indexer;
+  // The functions of a module restored from a cache entry, in order.
+  std::vector<llvm::Function *> functions;
+};
+
+// The modules of one bitcode file parsed by `LoadModules`.
+struct LoadedFile {
+  // Where the file is read from, unless `buffer` is given.
+  std::string path;
+  std::unique_ptr<llvm::MemoryBuffer> buffer;
+  // The cache entry the modules were restored from, if any. Lazily loaded
+  // modules read their bodies from it.
+  std::unique_ptr<SnapshotReader> cache_entry;
+  std::vector<LoadedModule> modules;
+  std::optional<LoadError> error;
+  // The key of the file in `LoadOptions::cache`.
+  std::string cache_key;
+};
+
 namespace {
 
 [[nodiscard]] static std::string GetSubstituteHookName(llvm::Type *type) {
@@ -45,14 +89,18 @@ namespace {
       .str();
 }
 
-// Try to verify a module.
-static bool VerifyModule(llvm::Module *module, llvm::Function *function) {
+// Try to verify `function`, or its whole module if `whole_module` is set.
+static bool VerifyFunction(llvm::Function &function, bool whole_module) {
   std::string error;
   llvm::raw_string_ostream error_stream(error);
-  if (llvm::verifyModule(*module, &error_stream)) {
-    function->print(error_stream);
+  bool broken = whole_module
+                    ? llvm::verifyModule(*function.getParent(), &error_stream)
+                    : llvm::verifyFunction(function, &error_stream);
+  if (broken) {
+    function.print(error_stream);
     error_stream.flush();
-    std::cerr << "Error verifying module: " << error;
+    std::cerr << "Error verifying " << (whole_module ? "module" : "function")
+              << ": " << error;
     assert(false);
     return false;
   } else {
@@ -60,6 +108,163 @@ static bool VerifyModule(llvm::Module *module, llvm::Function *function) {
   }
 }
 
+// Returns true if `function` is used by anything other than its own
+// instructions.
+static bool IsUsedOutside(llvm::Function &function) {
+  function.removeDeadConstantUsers();
+  for (const llvm::Use &use : function.uses()) {
+    auto *instr = llvm::dyn_cast<llvm::Instruction>(use.getUser());
+    if (!instr || instr->getFunction() != &function) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// List the functions of `module`, which was just parsed from a snapshot, in
+// `functions` and check them against their `records`. Argument ids follow the
+// function id, so they must stay below `value_id_counter` as well. Bodies that
+// have ids in the records are read if the module was loaded lazily.
+bool MatchSnapshotFunctions(llvm::Module &module,
+                            llvm::ArrayRef<SnapshotFunction> records,
+                            ValueId value_id_counter,
+                            std::vector<llvm::Function *> &functions) {
+  for (llvm::Function &function : module.functions()) {
+    functions.push_back(&function);
+  }
+
+  for (const SnapshotFunction &record : records) {
+    if (record.function_index >= functions.size()) {
+      return false;
+    }
+    llvm::Function *function = functions[record.function_index];
+    if (function->arg_size() >= value_id_counter - record.ids.derived) {
+      return false;
+    }
+    if (!record.body_indexed) {
+      continue;
+    }
+    if (llvm::Error error = function->materialize()) {
+      llvm::consumeError(std::move(error));
+      return false;
+    }
+    if (function->getInstructionCount() != record.instruction_count) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Restore the modules of `file` from the cache entry at `path`, each in a new
+// context. Returns false, leaving `file` untouched, if the entry cannot be
+// used.
+bool RestoreCachedFile(const std::string &path, bool lazy, LoadedFile &file) {
+  Result<std::unique_ptr<SnapshotReader>, SnapshotError> open_result =
+      SnapshotReader::Open(path);
+  if (!open_result.Succeeded()) {
+    return false;
+  }
+  std::unique_ptr<SnapshotReader> entry = open_result.TakeValue();
+  if (entry->GetHeader().value_id_counter == kInvalidValueId) {
+    return false;
+  }
+
+  std::vector<LoadedModule> modules;
+  llvm::ArrayRef<SnapshotFunction> function_records = entry->GetFunctions();
+  for (const SnapshotModule &module_record : entry->GetModules()) {
+    LoadedModule &loaded_module = modules.emplace_back();
+    loaded_module.context = std::make_unique<llvm::LLVMContext>();
+    llvm::MemoryBufferRef bitcode = entry->GetBitcode(module_record);
+    llvm::Expected<std::unique_ptr<llvm::Module>> module =
+        lazy ? llvm::getLazyBitcodeModule(bitcode, *loaded_module.context,
+                                          /*ShouldLazyLoadMetadata=*/true,
+                                          /*IsImporting=*/false)
+             : llvm::parseBitcodeFile(bitcode, *loaded_module.context);
+    if (!module) {
+      llvm::consumeError(module.takeError());
+      return false;
+    }
+    loaded_module.module = std::move(*module);
+
+    if (!MatchSnapshotFunctions(
+            *loaded_module.module,
+            function_records.take_front(module_record.function_count),
+            entry->GetHeader().value_id_counter, loaded_module.functions)) {
+      return false;
+    }
+    function_records =
+        function_records.drop_front(module_record.function_count);
+  }
+
+  file.cache_entry = std::move(entry);
+  file.modules = std::move(modules);
+  return true;
+}
+
+// Parse every module of the bitcode file of `file` into `file`, each in a new
+// context, or restore them from `cache` if it has them. The file is read from
+// its path unless it is in memory already.
+void LoadBitcodeFile(LoadedFile &file, bool lazy, ModuleCache *cache) {
+  if (!file.buffer) {
+    llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> buffer =
+        llvm::MemoryBuffer::getFile(file.path);
+    if (!buffer) {
+      file.error = LoadError::kCannotReadFile;
+      return;
+    }
+    file.buffer = std::move(*buffer);
+  }
+
+  if (cache) {
+    file.cache_key = ModuleCache::GetKey(file.buffer->getBuffer(), lazy);
+    std::optional<std::string> entry_path = cache->Find(file.cache_key);
+    if (entry_path && RestoreCachedFile(*entry_path, lazy, file)) {
+      return;
+    }
+  }
+
+  llvm::Expected<llvm::BitcodeFileContents> contents =
+      llvm::getBitcodeFileContents(*file.buffer);
+  if (!contents) {
+    llvm::consumeError(contents.takeError());
+    file.error = LoadError::kInvalidBitcode;
+    return;
+  }
+
+  for (llvm::BitcodeModule &bitcode_module : contents->Mods) {
+    LoadedModule &loaded_module = file.modules.emplace_back();
+    loaded_module.context = std::make_unique<llvm::LLVMContext>();
+    llvm::Expected<std::unique_ptr<llvm::Module>> module =
+        lazy ? bitcode_module.getLazyModule(*loaded_module.context,
+                                            /*ShouldLazyLoadMetadata=*/true,
+                                            /*IsImporting=*/false)
+             : bitcode_module.parseModule(*loaded_module.context);
+    if (!module) {
+      llvm::consumeError(module.takeError());
+      file.error = LoadError::kInvalidBitcode;
+      return;
+    }
+    loaded_module.module = std::move(*module);
+    loaded_module.indexer =
+        std::make_unique<ModuleIndexer>(*loaded_module.module);
+  }
+}
+
+// Returns `id` moved from the range starting at `from` to the one starting at
+// `to`.
+ValueId ShiftId(ValueId id, ValueId from, ValueId to) {
+  return id == kInvalidValueId ? id : id - from + to;
+}
+
+// `ShiftId` for every id of `ids`. Substitution kinds are not ids and are
+// kept as they are.
+ValueIds ShiftIds(ValueIds ids, ValueId from, ValueId to) {
+  ids.derived = ShiftId(ids.derived, from, to);
+  ids.original = ShiftId(ids.original, from, to);
+  ids.block = ShiftId(ids.block, from, to);
+  return ids;
+}
+
 bool ShouldAddAssumption(SubstitutionKind substitution_kind) {
   return (substitution_kind == SubstitutionKind::kValueSubstitution ||
           substitution_kind == SubstitutionKind::kFunctionDevirtualization);
@@ -69,74 +274,476 @@ bool ShouldAddAssumption(SubstitutionKind substitution_kind) {
 
 BitcodeExplorer::BitcodeExplorer(llvm::LLVMContext &llvm_context)
     : llvm_context(llvm_context),
-      md_explorer_id(llvm_context.getMDKindID("explorer.id")),
-      md_explorer_source_id(llvm_context.getMDKindID("explorer.source_id")),
-      md_explorer_block_id(llvm_context.getMDKindID("explorer.block_id")),
-      md_explorer_substitution_kind_id(
-          llvm_context.getMDKindID("explorer.substitution_kind_id")),
       annotator(std::make_unique<IdCommentWriter>(*this)),
-      function_map(),
-      instruction_map(),
-      block_map(),
-      argument_map(),
+      id_table(std::make_unique<ValueIdTable>()),
+      versions(std::make_unique<FunctionVersionStore>()),
+      catalog(std::make_unique<FunctionCatalog>()),
+      value_index(std::make_unique<ValueIndex>()),
       value_id_counter(1),
-      hook_functions() {}
+      hook_functions() {
+#ifndef NDEBUG
+  verification.level = VerificationLevel::kModule;
+#endif
+}
 
 void BitcodeExplorer::TakeModule(std::unique_ptr<llvm::Module> module) {
+  ScopedTimer timer(stats[ExplorerOperation::kLoad]);
   llvm::LLVMContext &module_context = module->getContext();
   assert(std::addressof(module_context) == std::addressof(llvm_context));
 
-  for (auto &function : module->functions()) {
-    if (function.isDeclaration() || function.isIntrinsic()) {
+  // Functions are indexed in module order from `value_id_counter` on; bodies
+  // of lazily loaded functions are only indexed by `EnsureMaterialized`.
+  ModuleIndexer indexer(*module);
+  indexer.Index(value_id_counter);
+  MergeIndex(indexer);
+
+  opened_modules.push_back(std::move(module));
+}
+
+Result<size_t, LoadError> BitcodeExplorer::LoadModules(
+    const std::vector<std::string> &paths, const LoadOptions &options) {
+  std::vector<LoadedFile> files(paths.size());
+  for (size_t i = 0; i < paths.size(); ++i) {
+    files[i].path = paths[i];
+  }
+  return LoadFiles(files, options);
+}
+
+Result<size_t, LoadError> BitcodeExplorer::LoadModule(
+    std::unique_ptr<llvm::MemoryBuffer> bitcode, const LoadOptions &options) {
+  std::vector<LoadedFile> files(1);
+  files[0].buffer = std::move(bitcode);
+  return LoadFiles(files, options);
+}
+
+Result<size_t, LoadError> BitcodeExplorer::LoadFiles(
+    std::vector<LoadedFile> &files, const LoadOptions &options) {
+  ScopedTimer timer(stats[ExplorerOperation::kLoad]);
+  llvm::ThreadPool thread_pool(llvm::hardware_concurrency(options.threads));
+
+  // Parse every module into its own context. This also counts the ids each
+  // module needs.
+  for (LoadedFile &file : files) {
+    thread_pool.async([&file, &options] {
+      LoadBitcodeFile(file, options.lazy, options.cache);
+    });
+  }
+  thread_pool.wait();
+
+  for (const LoadedFile &file : files) {
+    if (file.error) {
+      return *file.error;
+    }
+  }
+
+  // Reserve an id range per module in input order, so that the ids do not
+  // depend on the number of threads or on scheduling. Modules restored from
+  // the cache get the range their ids were recorded with, shifted.
+  ValueId next_id = value_id_counter;
+  std::vector<ValueId> file_first_ids;
+  std::vector<std::pair<ModuleIndexer *, ValueId>> ranges;
+  for (LoadedFile &file : files) {
+    file_first_ids.push_back(next_id);
+    if (file.cache_entry) {
+      next_id += file.cache_entry->GetHeader().value_id_counter - 1;
       continue;
     }
-    UpdateMetadata(function);
+    for (LoadedModule &loaded_module : file.modules) {
+      ranges.emplace_back(loaded_module.indexer.get(), next_id);
+      next_id += loaded_module.indexer->CountIds();
+    }
+  }
+
+  for (auto [indexer, first_id] : ranges) {
+    thread_pool.async([indexer = indexer, first_id = first_id] {
+      indexer->Index(first_id);
+    });
+  }
+  thread_pool.wait();
+
+  // `id_table` and `value_index` are not thread safe, so the results are
+  // merged one module at a time.
+  size_t num_modules = 0;
+  for (size_t i = 0; i < files.size(); ++i) {
+    LoadedFile &file = files[i];
+    if (file.cache_entry) {
+      std::vector<std::vector<llvm::Function *>> module_functions;
+      for (LoadedModule &loaded_module : file.modules) {
+        module_functions.push_back(std::move(loaded_module.functions));
+      }
+      TakeSnapshotIds(*file.cache_entry, module_functions, file_first_ids[i]);
+      value_id_counter = file_first_ids[i] +
+                         file.cache_entry->GetHeader().value_id_counter - 1;
+      stats.module_cache_hits++;
+    } else {
+      for (LoadedModule &loaded_module : file.modules) {
+        MergeIndex(*loaded_module.indexer);
+      }
+      if (options.cache) {
+        stats.module_cache_misses++;
+        AddToCache(*options.cache, file, options.lazy, file_first_ids[i]);
+      }
+    }
+
+    for (LoadedModule &loaded_module : file.modules) {
+      loaded_module.indexer.reset();
+      owned_contexts.push_back(std::move(loaded_module.context));
+      opened_modules.push_back(std::move(loaded_module.module));
+      num_modules++;
+    }
+    // Lazily loaded modules keep reading from the buffer.
+    if (options.lazy) {
+      module_buffers.push_back(file.cache_entry
+                                   ? file.cache_entry->TakeBuffer()
+                                   : std::move(file.buffer));
+    }
+  }
+  assert(value_id_counter == next_id);
+  return num_modules;
+}
+
+void BitcodeExplorer::AddToCache(ModuleCache &cache, const LoadedFile &file,
+                                 bool lazy, ValueId first_id) {
+  // The bitcode of a lazily loaded module can only be written out once every
+  // body was read, so its entry holds the file as it is instead. Modules of
+  // the same file share a string table, so only files holding a single module
+  // can be cached that way.
+  if (lazy && file.modules.size() != 1) {
+    return;
+  }
+  // Ids carried over from `!explorer.*` metadata do not follow the range of
+  // the file, so they could not be shifted when the entry is restored.
+  for (const LoadedModule &loaded_module : file.modules) {
+    if (loaded_module.indexer->HasMetadataIds()) {
+      return;
+    }
+  }
+
+  SnapshotWriter writer(value_id_counter - first_id + 1, RetentionPolicy());
+  std::vector<ValueId> function_ids;
+  for (size_t i = 0; i < file.modules.size(); ++i) {
+    llvm::Module &module = *file.modules[i].module;
+    if (lazy) {
+      writer.AddModuleBitcode(file.buffer->getBuffer(), i + 1);
+    } else {
+      writer.AddModule(module, i + 1);
+    }
+    std::vector<ValueId> module_function_ids =
+        AddToSnapshot(writer, module, first_id);
+    function_ids.insert(function_ids.end(), module_function_ids.begin(),
+                        module_function_ids.end());
+  }
+  for (ValueId function_id : function_ids) {
+    FunctionVersion version = *versions->Find(function_id);
+    version.function_id = ShiftId(version.function_id, first_id, 1);
+    version.lineage_id = ShiftId(version.lineage_id, first_id, 1);
+    writer.AddVersion(version);
+  }
+
+  cache.Insert(file.cache_key, [&writer](const std::string &path) {
+    return writer.Write(path);
+  });
+}
+
+void BitcodeExplorer::MergeIndex(const ModuleIndexer &indexer) {
+  assert(indexer.GetFirstId() == value_id_counter);
+  ScopedTimer timer(stats[ExplorerPhase::kIndex]);
+
+  id_table->Reserve(indexer.GetEntries().size());
+  for (const ModuleIndexer::Entry &entry : indexer.GetEntries()) {
+    id_table->GetOrCreate(*entry.value) = entry.ids;
+  }
+  for (const ModuleIndexer::Slot &slot : indexer.GetSlots()) {
+    value_index->Insert(slot.id, slot.kind, slot.value);
+    if (slot.kind == IndexedValueKind::kInstruction) {
+      stats.instructions_indexed++;
+    }
+  }
+  for (ValueId function_id : indexer.GetFunctionIds()) {
+    versions->Add({function_id, kInvalidValueId, function_id,
+                   VersionOperation::kOriginal});
+    AddToCatalog(function_id);
+  }
+  lazy_functions.insert(indexer.GetLazyFunctions().begin(),
+                        indexer.GetLazyFunctions().end());
+  value_id_counter += indexer.CountIds();
+}
+
+std::optional<SnapshotError> BitcodeExplorer::SaveSnapshot(
+    const std::string &path) {
+  ScopedTimer timer(stats[ExplorerOperation::kSnapshot]);
+  SnapshotWriter writer(value_id_counter, retention);
+  std::unordered_map<llvm::LLVMContext *, uint64_t> context_indices;
+  context_indices[&llvm_context] = 0;
+  std::unordered_set<ValueId> saved_functions;
+
+  for (const std::unique_ptr<llvm::Module> &module : opened_modules) {
+    // Bitcode cannot be written for a function whose body was not read. The
+    // bodies are only read here, and stay in `lazy_functions` until they are
+    // indexed on first use, after restoring too.
+    if (llvm::Error error = module->materializeAll()) {
+      llvm::consumeError(std::move(error));
+      return SnapshotError::kCannotReadFunction;
+    }
+
+    auto [context_it, inserted] = context_indices.try_emplace(
+        &module->getContext(), context_indices.size());
+    writer.AddModule(*module, context_it->second);
+    std::vector<ValueId> function_ids = AddToSnapshot(writer, *module, 1);
+    saved_functions.insert(function_ids.begin(), function_ids.end());
+  }
+
+  versions->ForEachLineage(
+      [this, &writer, &saved_functions](ValueId,
+                                        const std::vector<ValueId> &lineage) {
+        for (ValueId function_id : lineage) {
+          if (saved_functions.count(function_id)) {
+            writer.AddVersion(*versions->Find(function_id));
+          }
+        }
+      });
+
+  for (ValueId function_id : pinned_functions) {
+    if (saved_functions.count(function_id)) {
+      writer.AddPinned(function_id);
+    }
+  }
+
+  if (!writer.Write(path)) {
+    return SnapshotError::kCannotWriteFile;
+  }
+  return std::nullopt;
+}
+
+std::vector<ValueId> BitcodeExplorer::AddToSnapshot(SnapshotWriter &writer,
+                                                   llvm::Module &module,
+                                                   ValueId first_id) const {
+  std::vector<ValueId> function_ids;
+  uint32_t function_index = 0;
+  for (llvm::Function &function : module.functions()) {
+    const ValueIds *ids = id_table->Find(function);
+    if (ids && ids->derived != kInvalidValueId) {
+      bool body_indexed = !lazy_functions.count(&function);
+      writer.AddFunction(function_index, ShiftIds(*ids, first_id, 1),
+                         body_indexed);
+      function_ids.push_back(ids->derived);
+
+      if (body_indexed) {
+        for (llvm::Instruction &instruction : llvm::instructions(function)) {
+          const ValueIds *instruction_ids = id_table->Find(instruction);
+          writer.AddInstruction(
+              instruction_ids ? ShiftIds(*instruction_ids, first_id, 1)
+                              : ValueIds());
+        }
+      }
+    }
+    function_index++;
+  }
+  return function_ids;
+}
+
+Result<size_t, SnapshotError> BitcodeExplorer::RestoreSnapshot(
+    const std::string &path) {
+  ScopedTimer timer(stats[ExplorerOperation::kSnapshot]);
+  if (!opened_modules.empty() || value_id_counter != 1) {
+    return SnapshotError::kExplorerNotEmpty;
+  }
+
+  Result<std::unique_ptr<SnapshotReader>, SnapshotError> open_result =
+      SnapshotReader::Open(path);
+  if (!open_result.Succeeded()) {
+    return open_result.TakeError();
+  }
+  std::unique_ptr<SnapshotReader> reader = open_result.TakeValue();
+
+  // Parse every module and check that the records match it before touching
+  // the explorer, so that a bad snapshot leaves it empty.
+  std::unordered_map<uint64_t, std::unique_ptr<llvm::LLVMContext>> contexts;
+  std::vector<std::unique_ptr<llvm::Module>> modules;
+  std::vector<std::vector<llvm::Function *>> module_functions;
+  llvm::ArrayRef<SnapshotFunction> function_records = reader->GetFunctions();
+
+  for (const SnapshotModule &module_record : reader->GetModules()) {
+    llvm::LLVMContext *context = &llvm_context;
+    if (module_record.context_index != 0) {
+      std::unique_ptr<llvm::LLVMContext> &owned_context =
+          contexts[module_record.context_index];
+      if (!owned_context) {
+        owned_context = std::make_unique<llvm::LLVMContext>();
+      }
+      context = owned_context.get();
+    }
+
+    llvm::Expected<std::unique_ptr<llvm::Module>> module =
+        llvm::parseBitcodeFile(reader->GetBitcode(module_record), *context);
+    if (!module) {
+      llvm::consumeError(module.takeError());
+      return SnapshotError::kInvalidSnapshot;
+    }
+
+    if (!MatchSnapshotFunctions(
+            **module, function_records.take_front(module_record.function_count),
+            reader->GetHeader().value_id_counter,
+            module_functions.emplace_back())) {
+      return SnapshotError::kInvalidSnapshot;
+    }
+    function_records =
+        function_records.drop_front(module_record.function_count);
+    modules.push_back(std::move(*module));
+  }
+
+  // Ids are read straight from the mapped records. Nothing is reassigned, so
+  // `value_id_counter` is taken as is.
+  TakeSnapshotIds(*reader, module_functions, 1);
+
+  const SnapshotHeader &header = reader->GetHeader();
+  retention.versions_per_lineage = header.versions_per_lineage;
+  retention.collect_after_operation = header.collect_after_operation != 0;
+  value_id_counter = header.value_id_counter;
+
+  for (auto &[context_index, context] : contexts) {
+    owned_contexts.push_back(std::move(context));
+  }
+  for (std::unique_ptr<llvm::Module> &module : modules) {
+    opened_modules.push_back(std::move(module));
+  }
+  return modules.size();
+}
+
+void BitcodeExplorer::TakeSnapshotIds(
+    const SnapshotReader &reader,
+    const std::vector<std::vector<llvm::Function *>> &module_functions,
+    ValueId first_id) {
+  llvm::ArrayRef<SnapshotFunction> function_records = reader.GetFunctions();
+  llvm::ArrayRef<ValueIds> instruction_records = reader.GetInstructions();
+  for (size_t i = 0; i < module_functions.size(); ++i) {
+    uint64_t function_count = reader.GetModules()[i].function_count;
+    for (const SnapshotFunction &function_record :
+         function_records.take_front(function_count)) {
+      llvm::Function *function =
+          module_functions[i][function_record.function_index];
+      ValueIds function_ids = ShiftIds(function_record.ids, 1, first_id);
+      ValueId function_id = function_ids.derived;
+      id_table->GetOrCreate(*function) = function_ids;
+      value_index->Insert(function_id, IndexedValueKind::kFunction, function);
+      for (llvm::Argument &argument : function->args()) {
+        value_index->Insert(function_id + argument.getArgNo() + 1,
+                            IndexedValueKind::kArgument, function);
+      }
+
+      if (!function_record.body_indexed) {
+        lazy_functions.insert(function);
+        continue;
+      }
+
+      auto instruction_ids = instruction_records.begin();
+      for (llvm::Instruction &instruction : llvm::instructions(*function)) {
+        ValueIds ids = ShiftIds(*instruction_ids++, 1, first_id);
+        if (ids.empty()) {
+          continue;
+        }
+        id_table->GetOrCreate(instruction) = ids;
+        if (ids.derived != kInvalidValueId) {
+          value_index->Insert(ids.derived, IndexedValueKind::kInstruction,
+                              &instruction);
+        }
+        if (ids.block != kInvalidValueId) {
+          value_index->Insert(ids.block, IndexedValueKind::kBlock,
+                              instruction.getParent());
+        }
+      }
+      instruction_records =
+          instruction_records.drop_front(function_record.instruction_count);
+    }
+    function_records = function_records.drop_front(function_count);
+  }
+
+  for (const SnapshotVersion &version : reader.GetVersions()) {
+    versions->Add({ShiftId(version.function_id, 1, first_id),
+                   ShiftId(version.parent_id, 1, first_id),
+                   ShiftId(version.lineage_id, 1, first_id),
+                   static_cast<VersionOperation>(version.operation)});
+  }
+  for (const SnapshotFunction &function_record : reader.GetFunctions()) {
+    AddToCatalog(ShiftId(function_record.ids.derived, 1, first_id));
+  }
+  for (ValueId function_id : reader.GetPinned()) {
+    pinned_functions.insert(ShiftId(function_id, 1, first_id));
   }
-  opened_modules.push_back(std::move(module));
 }
 
 void BitcodeExplorer::ForEachFunction(
     const std::function<void(ValueId, llvm::Function &, FunctionKind)>
         &callback) {
-  for (const auto &[function_id, weak_vh] : function_map) {
-    if (llvm::Function *function =
-            llvm::cast_or_null<llvm::Function>(weak_vh)) {
-      FunctionKind kind = GetId(*function, ValueIdKind::kOriginal) ==
-                                  GetId(*function, ValueIdKind::kDerived)
-                              ? FunctionKind::kOriginal
-                              : FunctionKind::kGenerated;
-      callback(function_id, *function, kind);
-    }
-  }
+  catalog->ForEach([this, &callback](const FunctionInfo &info) {
+    callback(info.function_id, *value_index->GetFunction(info.function_id),
+             info.kind);
+  });
+}
+
+FunctionPage BitcodeExplorer::ListFunctions(ValueId after,
+                                            size_t limit) const {
+  return catalog->List(after, limit);
+}
+
+uint64_t BitcodeExplorer::GetCatalogVersion() const {
+  return catalog->GetVersion();
+}
+
+std::optional<CatalogChanges> BitcodeExplorer::GetCatalogChanges(
+    uint64_t since) const {
+  return catalog->GetChanges(since);
+}
+
+void BitcodeExplorer::AddToCatalog(ValueId function_id) {
+  llvm::Function *function = value_index->GetFunction(function_id);
+  const FunctionVersion *version = versions->Find(function_id);
+  assert(function);
+
+  // Functions whose source is another function were generated, possibly by
+  // another explorer before the module was written out.
+  FunctionKind kind = GetId(*function, ValueIdKind::kOriginal) == function_id
+                          ? FunctionKind::kOriginal
+                          : FunctionKind::kGenerated;
+  catalog->Insert({function_id, function->getName().str(), kind,
+                   version ? version->parent_id : kInvalidValueId,
+                   function->getInstructionCount(),
+                   function->getParent()});
 }
 
 bool BitcodeExplorer::PrintFunction(ValueId function_id,
                                     llvm::raw_ostream &output_stream) {
-  auto function_pair = function_map.find(function_id);
-  if (function_pair == function_map.end()) {
+  llvm::Function *function = value_index->GetFunction(function_id);
+  if (!function || !EnsureMaterialized(*function)) {
     return false;
   }
 
-  llvm::Function *function =
-      llvm::cast_or_null<llvm::Function>(function_pair->second);
-  if (!function) {
-    return false;
+  ScopedTimer timer(stats[ExplorerPhase::kPrint]);
+  if (const std::string *output = printed_functions.Find(function_id)) {
+    stats.print_cache_hits++;
+    output_stream << *output;
+    return true;
   }
 
-  function->print(output_stream, annotator.get());
+  stats.print_cache_misses++;
+  std::string output;
+  llvm::raw_string_ostream string_stream(output);
+  function->print(string_stream, annotator.get());
+  string_stream.flush();
+  output_stream << output;
+  printed_functions.Insert(function_id, std::move(output));
   return true;
 }
 
+void BitcodeExplorer::SetPrintCacheCapacity(size_t capacity) {
+  printed_functions.SetCapacity(capacity);
+}
+
 Result<ValueId, InlineError> BitcodeExplorer::InlineFunctionCall(
     ValueId instruction_id, IFunctionResolver &resolver,
     ISubstitutionObserver &substitution_observer) {
-  auto instruction_pair = instruction_map.find(instruction_id);
-  if (instruction_pair == instruction_map.end()) {
-    return InlineError::kInstructionNotFound;
-  }
-
-  llvm::Instruction *instruction =
-      llvm::cast_or_null<llvm::Instruction>(instruction_pair->second);
+  ScopedTimer timer(stats[ExplorerOperation::kInline]);
+  llvm::Instruction *instruction = value_index->GetInstruction(instruction_id);
   if (!instruction) {
     return InlineError::kInstructionNotFound;
   }
@@ -146,16 +753,85 @@ Result<ValueId, InlineError> BitcodeExplorer::InlineFunctionCall(
     return InlineError::kNotACallBaseInstruction;
   }
 
-  llvm::Function *called_function = call_base->getCalledFunction();
-  llvm::Module *func_module = called_function->getParent();
-
   // try to resolve declarations
-  llvm::FunctionType *original_callee_type = called_function->getFunctionType();
-  called_function = resolver.ResolveCallSite(call_base, called_function);
+  Result<llvm::Function *, InlineError> resolved_function =
+      ResolveCallee(call_base, resolver);
+  if (!resolved_function.Succeeded()) {
+    return resolved_function.TakeError();
+  }
+  llvm::Function *called_function = resolved_function.TakeValue();
+
+  llvm::Function *caller_function = call_base->getFunction();
+  assert(caller_function != nullptr);
+
+  // clone the caller function. The called function is not cloned; it is
+  // only read by `llvm::InlineFunction`.
+  llvm::ValueToValueMapTy caller_value_map;
+  llvm::Function *cloned_caller_function =
+      CloneFunction(*caller_function, caller_value_map);
+
+  auto *cloned_call_base =
+      llvm::cast<llvm::CallBase>(caller_value_map[call_base]);
+  cloned_call_base->setCalledFunction(called_function);
+
+  cloned_call_base = HookCallSite(cloned_call_base);
+
+  VerifyStep(*cloned_caller_function);
+
+  // `llvm::InlineFunction` copies the metadata of the inlined instructions
+  // but knows nothing about `id_table`. Carry the provenance through as
+  // metadata and read it back after inlining. Source ids are drawn from a
+  // bounded set of values, so the uniqued nodes do not grow with every
+  // operation. The call itself is erased by a successful inline.
+  WriteMetadata(*called_function, {ValueIdKind::kOriginal});
+  id_table->Forget(*cloned_call_base);
+
+  // Do the inlining
+  llvm::InlineFunctionInfo info;
+  llvm::InlineResult inline_result = InlineCall(*cloned_call_base, info);
+
+  // Strip the temporary metadata from the called function again
+  ReadMetadata(*called_function);
+
+  if (!inline_result.isSuccess()) {
+    // clean up resources
+    hook_calls.clear();
+    EraseFunction(cloned_caller_function);
+    EraseHookFunctions();
+
+    return InlineError::kInlineOperationFailed;
+  }
+
+  ReadMetadata(*cloned_caller_function);
+
+  VerifyStep(*cloned_caller_function);
+
+  // elide the hooks
+  ElideSubstitutionHooks(*cloned_caller_function, substitution_observer);
+
+  // update all metadata
+  ValueId cloned_caller_id = AddVersion(
+      *cloned_caller_function, *caller_function, VersionOperation::kInline);
+
+  VerifyVersion(*cloned_caller_function);
+
+  return cloned_caller_id;
+}
+
+Result<llvm::Function *, InlineError> BitcodeExplorer::ResolveCallee(
+    llvm::CallBase *call_base, IFunctionResolver &resolver) {
+  llvm::FunctionType *original_callee_type = call_base->getFunctionType();
+  llvm::Function *called_function =
+      resolver.ResolveCallSite(call_base, call_base->getCalledFunction());
   if (!called_function) {
     return InlineError::kCannotResolveFunction;
   } else if (called_function->isDeclaration()) {
     return InlineError::kCannotResolveFunction;
+  } else if (&called_function->getContext() != &call_base->getContext()) {
+    // Modules loaded by `LoadModules` each live in their own context
+    return InlineError::kCannotResolveFunction;
+  } else if (!EnsureMaterialized(*called_function)) {
+    return InlineError::kCannotResolveFunction;
   } else if (called_function->isVarArg()) {
     return InlineError::kVariadicFunction;
   } else if (called_function->getFunctionType() != original_callee_type) {
@@ -165,20 +841,31 @@ Result<ValueId, InlineError> BitcodeExplorer::InlineFunctionCall(
   // Need to index the newly resolved function if it's the first time
   // encountering it
   if (GetId(*called_function, ValueIdKind::kDerived) == kInvalidValueId) {
-    UpdateMetadata(*called_function);
+    IndexFunction(*called_function);
   }
+  return called_function;
+}
 
-  llvm::Function *caller_function = call_base->getFunction();
-  assert(caller_function != nullptr);
+llvm::InlineResult BitcodeExplorer::InlineCall(llvm::CallBase &call_base,
+                                               llvm::InlineFunctionInfo &info) {
+  ScopedTimer timer(stats[ExplorerPhase::kInline]);
+  size_t callee_instruction_count =
+      call_base.getCalledFunction()->getInstructionCount();
+  llvm::InlineResult inline_result = llvm::InlineFunction(call_base, info);
+  if (inline_result.isSuccess()) {
+    stats.instructions_inlined += callee_instruction_count;
+  }
+  return inline_result;
+}
 
-  // clone and modify the called function prior to inlining
-  llvm::ValueToValueMapTy called_value_map;
-  llvm::Function *cloned_called_function =
-      llvm::CloneFunction(called_function, called_value_map);
+llvm::CallBase *BitcodeExplorer::HookCallSite(
+    llvm::CallBase *cloned_call_base) {
+  ScopedTimer timer(stats[ExplorerPhase::kHookInsertion]);
+  llvm::Module *func_module = cloned_call_base->getModule();
 
   // Add hook for each argument
 
-  // As an example, given function:
+  // As an example, given functions:
   //
   // foo(x, y) {
   //   ...
@@ -186,41 +873,38 @@ Result<ValueId, InlineError> BitcodeExplorer::InlineFunctionCall(
   //   ...
   // }
   //
-  // We will append two calls to the substitute hook at the start of the
-  // function First, argument `x` will be hooked. After the first loop
-  // iteration, the function becomes:
-  //
-  // foo(x, y) {
-  //   temp_val = substitute_hook(x, x)
+  // bar() {
   //   ...
-  //   z = temp_val + y
+  //   foo(1,2)
   //   ...
   // }
   //
-  // The `substitute_hook` takes two parameters: the old value and the new
-  // value. It's more useful in the case of value substitution. Here we just use
-  // the same value `x` for both. Then, the same process is applied again for
-  // `y`:
+  // We will insert a call to the substitute hook in front of the call for
+  // each argument. After the first loop iteration, `bar` becomes:
   //
-  // foo(x, y) {
-  //   temp_val = substitute_hook(x, x)
-  //   temp_val2 = substitute_hook(y, y)
+  // bar() {
   //   ...
-  //   z = temp_val + temp_val2
+  //   temp_val = substitute_hook(1, 1)
+  //   foo(temp_val,2)
   //   ...
   // }
-
-  // This hooking process helps us observe and control the substitution of
-  // arguments during the inlining process. Now, when inlining the function
-  // `foo`:
+  //
+  // The `substitute_hook` takes two parameters: the old value and the new
+  // value. It's more useful in the case of value substitution. Here we just use
+  // the same value `1` for both. Then, the same process is applied again for
+  // `2`:
   //
   // bar() {
   //   ...
-  //   foo(1,2)
+  //   temp_val = substitute_hook(1, 1)
+  //   temp_val2 = substitute_hook(2, 2)
+  //   foo(temp_val,temp_val2)
   //   ...
   // }
-  //
-  // There's a new intermediate stage:
+
+  // This hooking process helps us observe and control the substitution of
+  // arguments during the inlining process. Inlining `foo` gives an
+  // intermediate stage:
   //
   // bar() {
   //   ...
@@ -239,32 +923,15 @@ Result<ValueId, InlineError> BitcodeExplorer::InlineFunctionCall(
   //   ...
   // }
 
-  llvm::BasicBlock &entry = cloned_called_function->getEntryBlock();
-  llvm::IRBuilder<> builder(&entry.front());
-  for (llvm::Argument &arg : cloned_called_function->args()) {
-    llvm::CallInst *call_inst = CreateHookCallInst(
-        arg.getType(), func_module, SubstitutionKind::kArgument, &arg, &arg);
-    builder.Insert(call_inst);
-
-    arg.replaceUsesWithIf(call_inst, [call_inst](const llvm::Use &use) -> bool {
-      return use.getUser() != call_inst;
-    });
+  for (llvm::Use &arg : cloned_call_base->args()) {
+    llvm::Value *arg_value = arg.get();
+    llvm::CallInst *call_inst =
+        CreateHookCallInst(arg_value->getType(), func_module,
+                           SubstitutionKind::kArgument, arg_value, arg_value);
+    call_inst->insertBefore(cloned_call_base);
+    arg.set(call_inst);
   }
 
-  // clone and modify the caller function
-  llvm::ValueToValueMapTy caller_value_map;
-  llvm::Function *cloned_caller_function =
-      llvm::CloneFunction(caller_function, caller_value_map);
-
-  llvm::CallBase *cloned_call_base = nullptr;
-  for (auto &cloned_instruction : llvm::instructions(cloned_caller_function)) {
-    if (this->GetId(cloned_instruction, ValueIdKind::kDerived) ==
-        instruction_id) {
-      cloned_call_base = llvm::dyn_cast<llvm::CallBase>(&cloned_instruction);
-    }
-  }
-  assert(cloned_call_base != nullptr);
-
   // hook the function call if the return type is not void
 
   // As an example, given functions:
@@ -320,83 +987,221 @@ Result<ValueId, InlineError> BitcodeExplorer::InlineFunctionCall(
     auto *dup_call_base =
         llvm::dyn_cast<llvm::CallBase>(cloned_call_base->clone());
     dup_call_base->setName("temp_val");
-    dup_call_base->setCalledFunction(cloned_called_function);
     dup_call_base->insertBefore(cloned_call_base);
 
-    std::string original_name = cloned_call_base->getName().str();
-    cloned_call_base->setName("to_delete");
+    std::string original_name = cloned_call_base->getName().str();
+    cloned_call_base->setName("to_delete");
+
+    llvm::CallInst *substituted_call = CreateHookCallInst(
+        cloned_call_base->getType(), func_module,
+        SubstitutionKind::kReturnValue, dup_call_base, dup_call_base);
+    substituted_call->insertBefore(cloned_call_base);
+    substituted_call->setName(original_name);
+
+    cloned_call_base->replaceAllUsesWith(substituted_call);
+    EraseInstruction(cloned_call_base);
+
+    cloned_call_base = dup_call_base;
+  }
+
+
+  return cloned_call_base;
+}
+
+Result<ValueId, InlineError> BitcodeExplorer::InlineCallTree(
+    ValueId value_id, const InlineBudget &budget, IFunctionResolver &resolver,
+    ISubstitutionObserver &substitution_observer) {
+  ScopedTimer timer(stats[ExplorerOperation::kInlineCallTree]);
+  // `value_id` is either a call, whose call tree is inlined, or a function,
+  // in which case the call trees of all its calls are.
+  llvm::Function *caller_function = value_index->GetFunction(value_id);
+  llvm::CallBase *root_call = nullptr;
+  if (caller_function) {
+    if (!EnsureMaterialized(*caller_function)) {
+      return InlineError::kInstructionNotFound;
+    }
+  } else if (llvm::Instruction *instruction =
+                 value_index->GetInstruction(value_id)) {
+    root_call = llvm::dyn_cast<llvm::CallBase>(instruction);
+    if (!root_call) {
+      return InlineError::kNotACallBaseInstruction;
+    }
+    caller_function = root_call->getFunction();
+  } else {
+    return InlineError::kInstructionNotFound;
+  }
+
+  llvm::ValueToValueMapTy caller_value_map;
+  llvm::Function *cloned_caller_function =
+      CloneFunction(*caller_function, caller_value_map);
+
+  // Calls left to inline, breadth first so that the budget is spent on the
+  // shallowest calls, with their depth below the starting point.
+  std::deque<std::pair<llvm::WeakVH, unsigned>> worklist;
+  llvm::Value *cloned_root_call = nullptr;
+  if (root_call) {
+    cloned_root_call = caller_value_map[root_call];
+    worklist.emplace_back(cloned_root_call, 1);
+  } else {
+    for (llvm::Instruction &instruction :
+         llvm::instructions(cloned_caller_function)) {
+      if (llvm::isa<llvm::CallBase>(instruction)) {
+        worklist.emplace_back(&instruction, 1);
+      }
+    }
+  }
+
+  // The resolver is consulted once per callee; calls copied by inlining
+  // reuse the answer given for the original call.
+  llvm::DenseMap<llvm::Value *, llvm::Function *> resolved_callees;
+  // Callees that temporarily carry their ids as metadata, see
+  // `InlineFunctionCall`.
+  llvm::SmallPtrSet<llvm::Function *, 8> written_callees;
+  size_t instruction_count = cloned_caller_function->getInstructionCount();
+  size_t inlined_calls = 0;
+  std::optional<InlineError> root_error;
+
+  while (!worklist.empty()) {
+    auto [call_handle, depth] = worklist.front();
+    worklist.pop_front();
+    auto *call_base = llvm::dyn_cast_or_null<llvm::CallBase>(
+        static_cast<llvm::Value *>(call_handle));
+    if (!call_base || depth > budget.max_depth) {
+      continue;
+    }
+
+    llvm::Value *callee = call_base->getCalledOperand()->stripPointerCasts();
+    auto resolved_it = resolved_callees.find(callee);
+    llvm::Function *called_function;
+    if (resolved_it != resolved_callees.end()) {
+      called_function = resolved_it->second;
+    } else {
+      Result<llvm::Function *, InlineError> resolved_function =
+          ResolveCallee(call_base, resolver);
+      if (resolved_function.Succeeded()) {
+        called_function = resolved_function.TakeValue();
+      } else {
+        called_function = nullptr;
+        if (call_base == cloned_root_call) {
+          root_error = resolved_function.TakeError();
+        }
+      }
+      // Indirect calls are resolved per call site
+      if (llvm::isa<llvm::Function>(callee)) {
+        resolved_callees[callee] = called_function;
+      }
+    }
+
+    if (!called_function || call_base->getFunctionType() !=
+                                called_function->getFunctionType()) {
+      continue;
+    }
 
-    llvm::CallInst *substituted_call = CreateHookCallInst(
-        cloned_call_base->getType(), func_module,
-        SubstitutionKind::kReturnValue, dup_call_base, dup_call_base);
-    substituted_call->insertBefore(cloned_call_base);
-    substituted_call->setName(original_name);
+    size_t callee_instruction_count = called_function->getInstructionCount();
+    if (instruction_count + callee_instruction_count >
+        budget.max_instructions) {
+      continue;
+    }
 
-    cloned_call_base->replaceAllUsesWith(substituted_call);
-    cloned_call_base->eraseFromParent();
+    call_base->setCalledFunction(called_function);
+    call_base = HookCallSite(call_base);
 
-    cloned_call_base = dup_call_base;
-  }
+    if (written_callees.insert(called_function).second) {
+      WriteMetadata(*called_function, {ValueIdKind::kOriginal});
+    }
+    std::optional<ValueIds> call_ids;
+    if (const ValueIds *ids = id_table->Find(*call_base)) {
+      call_ids = *ids;
+    }
+    id_table->Forget(*call_base);
+
+    llvm::InlineFunctionInfo info;
+    llvm::InlineResult inline_result = InlineCall(*call_base, info);
+    if (!inline_result.isSuccess()) {
+      // The call stays, and its hooks are elided with the rest
+      if (call_ids) {
+        id_table->GetOrCreate(*call_base) = *call_ids;
+      }
+      continue;
+    }
 
-  MAG_DEBUG(VerifyModule(func_module, cloned_caller_function));
+    instruction_count += callee_instruction_count;
+    inlined_calls++;
+    for (llvm::CallBase *inlined_call : info.InlinedCallSites) {
+      worklist.emplace_back(inlined_call, depth + 1);
+    }
+  }
 
-  // Do the inlining
-  llvm::InlineFunctionInfo info;
-  llvm::InlineResult inline_result =
-      llvm::InlineFunction(*cloned_call_base, info);
-  if (!inline_result.isSuccess()) {
-    // clean up resources
-    cloned_called_function->eraseFromParent();
-    cloned_caller_function->eraseFromParent();
+  // Strip the temporary metadata from the called functions again
+  for (llvm::Function *called_function : written_callees) {
+    ReadMetadata(*called_function);
+  }
 
-    return InlineError::kInlineOperationFailed;
+  if (inlined_calls == 0) {
+    hook_calls.clear();
+    EraseFunction(cloned_caller_function);
+    EraseHookFunctions();
+    if (root_error) {
+      return *root_error;
+    }
+    return InlineError::kNoCallInlined;
   }
 
-  // delete the cloned copy of the called_function after inlining it
-  cloned_called_function->eraseFromParent();
+  ReadMetadata(*cloned_caller_function);
 
-  MAG_DEBUG(VerifyModule(func_module, cloned_caller_function));
+  VerifyStep(*cloned_caller_function);
 
-  // elide the hooks
+  // elide the hooks of every inlined call at once
   ElideSubstitutionHooks(*cloned_caller_function, substitution_observer);
 
-  // update all metadata
-  UpdateMetadata(*cloned_caller_function);
+  ValueId cloned_caller_id = AddVersion(
+      *cloned_caller_function, *caller_function, VersionOperation::kInline);
 
-  MAG_DEBUG(VerifyModule(func_module, cloned_caller_function));
+  VerifyVersion(*cloned_caller_function);
 
-  return GetId(*cloned_caller_function, ValueIdKind::kDerived);
+  return cloned_caller_id;
 }
 
 void BitcodeExplorer::UpdateMetadata(llvm::Function &function) {
+  UpdateFunctionMetadata(function);
+  UpdateBodyMetadata(function);
+}
+
+void BitcodeExplorer::UpdateFunctionMetadata(llvm::Function &function) {
   ValueId function_id = value_id_counter++;
-  SetId(function, function_id, ValueIdKind::kDerived);
-  if (GetId(function, ValueIdKind::kOriginal) == kInvalidValueId) {
-    SetId(function, function_id, ValueIdKind::kOriginal);
+  ValueIds &function_ids = id_table->GetOrCreate(function);
+  function_ids.derived = function_id;
+  if (function_ids.original == kInvalidValueId) {
+    function_ids.original = function_id;
   }
-  function_map.emplace(function_id, &function);
+  value_index->Insert(function_id, IndexedValueKind::kFunction, &function);
 
   // Assign ids to function arguments. The assertion should always hold.
-  for (llvm::Argument &argument : function.args()) {
+  for ([[maybe_unused]] llvm::Argument &argument : function.args()) {
     ValueId argument_id = value_id_counter++;
-    argument_map.emplace(argument_id, &argument);
+    value_index->Insert(argument_id, IndexedValueKind::kArgument, &function);
     assert(argument_id == (function_id + argument.getArgNo() + 1));
   }
+}
+
+void BitcodeExplorer::UpdateBodyMetadata(llvm::Function &function) {
+  ScopedTimer timer(stats[ExplorerPhase::kIndex]);
+  stats.instructions_indexed += function.getInstructionCount();
 
   for (auto &instruction : llvm::instructions(function)) {
     ValueId new_instruction_id = value_id_counter++;
-    SetId(instruction, new_instruction_id, ValueIdKind::kDerived);
+    ValueIds &instruction_ids = id_table->GetOrCreate(instruction);
+    instruction_ids.derived = new_instruction_id;
 
     // for an instruction without a source, set itself to be the self
-    if (GetId(instruction, ValueIdKind::kOriginal) == kInvalidValueId) {
-      SetId(instruction, new_instruction_id, ValueIdKind::kOriginal);
+    if (instruction_ids.original == kInvalidValueId) {
+      instruction_ids.original = new_instruction_id;
     }
 
-    if (GetId(instruction, ValueIdKind::kBlock) != kInvalidValueId) {
-      RemoveId(instruction, ValueIdKind::kBlock);
-    }
+    instruction_ids.block = kInvalidValueId;
 
-    instruction_map.emplace(new_instruction_id, &instruction);
+    value_index->Insert(new_instruction_id, IndexedValueKind::kInstruction,
+                        &instruction);
   }
 
   for (llvm::BasicBlock &block : function) {
@@ -407,55 +1212,96 @@ void BitcodeExplorer::UpdateMetadata(llvm::Function &function) {
     }
     SetId(*terminator_instr, new_block_id, ValueIdKind::kBlock);
 
-    block_map.emplace(new_block_id, &block);
+    value_index->Insert(new_block_id, IndexedValueKind::kBlock, &block);
+  }
+}
+
+ValueId BitcodeExplorer::AddVersion(llvm::Function &function,
+                                    const llvm::Function &parent,
+                                    VersionOperation operation) {
+  UpdateMetadata(function);
+
+  ValueId function_id = GetId(function, ValueIdKind::kDerived);
+  versions->Add({function_id, GetId(parent, ValueIdKind::kDerived),
+                 GetId(function, ValueIdKind::kOriginal), operation});
+  AddToCatalog(function_id);
+
+  if (retention.collect_after_operation &&
+      retention.versions_per_lineage > 0) {
+    CollectGarbage();
   }
+  return function_id;
 }
 
 void BitcodeExplorer::ElideSubstitutionHooks(
     llvm::Function &function, ISubstitutionObserver &substitution_observer) {
+  ScopedTimer timer(stats[ExplorerPhase::kElideHooks]);
+
   // Get a const reference to the module data layout later used for constant
   // folding
   llvm::Module *func_module = function.getParent();
   const llvm::DataLayout &module_data_layout = func_module->getDataLayout();
 
-  // The tuple contains:
-  // 1. The instruction we are substituting
-  //   This is usually in the form of `%abc = call i32
-  //   @substitute_hook_4949385960(i32 %old_val, i32 %new_val)`. But in the case
-  //   of constant folding, it can also be an instruction with only constant
-  //   operands similar to `%add.i = add nsw i32 31, 30`.
-  // 2. The old value before the substitution
-  // 3. The new value after the substitution
-  std::vector<std::tuple<llvm::Instruction *, llvm::Value *, llvm::Value *>>
-      subs;
-
-  // Find all uses of the hook functions
-  for (auto [type, function_callee_obj] : hook_functions) {
-    auto *hook_func =
-        llvm::dyn_cast<llvm::Function>(function_callee_obj.getCallee());
-    if (!hook_func) {
-      continue;
-    }
-
-    for (llvm::Use &use : hook_func->uses()) {
-      // only enqueue hook calls inside the given function
-      auto *call_base = llvm::dyn_cast<llvm::CallBase>(use.getUser());
-      if (call_base && call_base->getFunction() == &function) {
-        subs.emplace_back(call_base, call_base->getArgOperand(0),
-                          call_base->getArgOperand(1));
-      }
-    }
+  const llvm::SimplifyQuery simplify_query(module_data_layout);
+
+  // The worklist holds the hook calls created for this operation, followed by
+  // the users of every substituted value, which may now fold. Hook calls are
+  // usually in the form of `%abc = call i32 @substitute_hook_4949385960(i32
+  // %old_val, i32 %new_val)`. The worklist never holds an instruction twice.
+  llvm::SmallPtrSet<llvm::Instruction *, 32> hooks;
+  llvm::InstructionWorklist worklist;
+  worklist.reserve(hook_calls.size());
+  for (auto it = hook_calls.rbegin(); it != hook_calls.rend(); ++it) {
+    assert((*it)->getFunction() == &function);
+    hooks.insert(*it);
+    worklist.push(*it);
   }
+  hook_calls.clear();
+
+  auto erase = [this, &hooks, &worklist](llvm::Instruction *instr) {
+    hooks.erase(instr);
+    worklist.remove(instr);
+    EraseInstruction(instr);
+  };
 
   // substitute the values
-  while (!subs.empty()) {
-    auto [inst, old_val, new_val] = subs.back();
-    subs.pop_back();
+  while (!worklist.isEmpty()) {
+    llvm::Instruction *inst = worklist.removeOne();
+    if (!inst) {
+      continue;  // Erased while in the worklist
+    }
 
-    ValueId substitution_id = GetId(*inst, ValueIdKind::kSubstitution);
-    assert(substitution_id != kInvalidValueId);
+    llvm::Value *old_val;
+    llvm::Value *new_val;
+    SubstitutionKind substitution_kind;
+
+    if (hooks.count(inst)) {
+      auto *hook_call = llvm::cast<llvm::CallInst>(inst);
+      old_val = hook_call->getArgOperand(0);
+      new_val = hook_call->getArgOperand(1);
+
+      ValueId substitution_id = GetId(*inst, ValueIdKind::kSubstitution);
+      assert(substitution_id != kInvalidValueId);
+      substitution_kind = static_cast<SubstitutionKind>(substitution_id);
+    } else if (llvm::Constant *fold_result = llvm::ConstantFoldInstruction(
+                   inst, module_data_layout)) {
+      // e.g. `%add.i = add nsw i32 31, 30` after substituting the operands
+      old_val = inst;
+      new_val = fold_result;
+      substitution_kind = SubstitutionKind::kConstantFolding;
+    } else if (llvm::Value *simplify_result =
+                   llvm::SimplifyInstruction(inst, simplify_query);
+               simplify_result && simplify_result != inst) {
+      // e.g. `%or.i = or i32 %x, -1` or `%sub.i = sub i32 %x, %x`
+      old_val = inst;
+      new_val = simplify_result;
+      substitution_kind = llvm::isa<llvm::Constant>(simplify_result)
+                              ? SubstitutionKind::kConstantFolding
+                              : SubstitutionKind::kInstructionSimplification;
+    } else {
+      continue;
+    }
 
-    auto substitution_kind = static_cast<SubstitutionKind>(substitution_id);
     llvm::Value *updated_sub_val = substitution_observer.PerformSubstitution(
         inst, old_val, new_val, substitution_kind);
 
@@ -468,28 +1314,15 @@ void BitcodeExplorer::ElideSubstitutionHooks(
 
     // Check we are not replacing the value with itself
     if (updated_sub_val != inst) {
-      // Iterate through and replace each occurrence of the value.
-      // Attempt constant folding and add additional substitution hooks to the
-      // `subs` list.
-      while (!inst->use_empty()) {
-        llvm::Use &substitute_location = *inst->use_begin();
-        substitute_location.set(updated_sub_val);
-
-        auto *target_instr =
-            llvm::cast<llvm::Instruction>(substitute_location.getUser());
-        llvm::Constant *fold_result =
-            llvm::ConstantFoldInstruction(target_instr, module_data_layout);
-        if (fold_result) {
-          SetId(*target_instr,
-                static_cast<std::underlying_type_t<SubstitutionKind>>(
-                    SubstitutionKind::kConstantFolding),
-                ValueIdKind::kSubstitution);
-          subs.emplace_back(target_instr, target_instr, fold_result);
-        }
+      if (!hooks.count(inst)) {
+        stats.instructions_folded++;
       }
+      // Every user gets a new operand and may fold or simplify now.
+      worklist.pushUsersToWorkList(*inst);
+      inst->replaceAllUsesWith(updated_sub_val);
 
       // Remove the substitution hook
-      inst->eraseFromParent();
+      erase(inst);
     }
 
     // Remove `old_val` if it's an instruction and no longer in use.
@@ -497,12 +1330,16 @@ void BitcodeExplorer::ElideSubstitutionHooks(
     if (old_val != inst) {
       auto old_instr = llvm::dyn_cast<llvm::Instruction>(old_val);
       if (old_instr && old_instr->getParent() && old_instr->use_empty()) {
-        old_instr->eraseFromParent();
+        erase(old_instr);
       }
     }
   }
 
   // remove all the hook functions after eliding them
+  EraseHookFunctions();
+}
+
+void BitcodeExplorer::EraseHookFunctions() {
   for (auto [type, function_callee_obj] : hook_functions) {
     if (auto *hook_func =
             llvm::dyn_cast<llvm::Function>(function_callee_obj.getCallee())) {
@@ -515,76 +1352,144 @@ void BitcodeExplorer::ElideSubstitutionHooks(
   hook_functions.clear();
 }
 
-// Convert from opaque type `ValueIdKind` to actual llvm `kind_id`.
-unsigned BitcodeExplorer::ValueIdKindToKindId(ValueIdKind kind) const {
-  switch (kind) {
-    case ValueIdKind::kOriginal:
-      return md_explorer_source_id;
-    case ValueIdKind::kDerived:
-      return md_explorer_id;
-    case ValueIdKind::kBlock:
-      return md_explorer_block_id;
-    case ValueIdKind::kSubstitution:
-      return md_explorer_substitution_kind_id;
-  }
-  assert(false);
-  return 0;  // An invalid metadata id.
-}
-
 // Returns the value ID for `function`, or `kInvalidValueId` if no ID is found.
 ValueId BitcodeExplorer::GetId(const llvm::Function &function,
                                ValueIdKind kind) const {
-  llvm::MDNode *mdnode = function.getMetadata(ValueIdKindToKindId(kind));
-  if (mdnode == nullptr) {
-    return kInvalidValueId;
-  }
-  return llvm::cast<llvm::ConstantInt>(
-             llvm::cast<llvm::ConstantAsMetadata>(mdnode->getOperand(0))
-                 ->getValue())
-      ->getZExtValue();
+  return id_table->Get(function, kind);
 }
 
 // Returns the value ID for `instruction`, or `kInvalidValueId` if no ID is
 // found.
 ValueId BitcodeExplorer::GetId(const llvm::Instruction &instruction,
                                ValueIdKind kind) const {
-  llvm::MDNode *mdnode = instruction.getMetadata(ValueIdKindToKindId(kind));
-  if (mdnode == nullptr) {
-    return kInvalidValueId;
-  }
-  return llvm::cast<llvm::ConstantInt>(
-             llvm::cast<llvm::ConstantAsMetadata>(mdnode->getOperand(0))
-                 ->getValue())
-      ->getZExtValue();
+  return id_table->Get(instruction, kind);
 }
 
-// Set an id inside the metadata of a function.
+// Set an id of a function.
 void BitcodeExplorer::SetId(llvm::Function &function, ValueId value,
                             ValueIdKind kind) const {
-  llvm::MDNode *mdnode = llvm::MDNode::get(
-      llvm_context, llvm::ConstantAsMetadata::get(llvm::ConstantInt::get(
-                        llvm_context, llvm::APInt(64, value, false))));
-  function.setMetadata(ValueIdKindToKindId(kind), mdnode);
+  id_table->Set(function, kind, value);
 }
 
-// Set an id inside the metadata of an instruction.
+// Set an id of an instruction.
 void BitcodeExplorer::SetId(llvm::Instruction &instruction, ValueId value,
                             ValueIdKind kind) const {
-  llvm::MDNode *mdnode = llvm::MDNode::get(
-      llvm_context, llvm::ConstantAsMetadata::get(llvm::ConstantInt::get(
-                        llvm_context, llvm::APInt(64, value, false))));
-  instruction.setMetadata(ValueIdKindToKindId(kind), mdnode);
+  id_table->Set(instruction, kind, value);
 }
 
-// Remove id of `kind` from `function` metadata.
+// Remove id of `kind` from `function`.
 void BitcodeExplorer::RemoveId(llvm::Function &function, ValueIdKind kind) {
-  function.setMetadata(ValueIdKindToKindId(kind), nullptr);
+  id_table->Remove(function, kind);
 }
 
-// Remove id of `kind` from `instruction` metadata.
+// Remove id of `kind` from `instruction`.
 void BitcodeExplorer::RemoveId(llvm::Instruction &instruction,
                                ValueIdKind kind) {
-  instruction.setMetadata(ValueIdKindToKindId(kind), nullptr);
+  id_table->Remove(instruction, kind);
+}
+
+llvm::Function *BitcodeExplorer::CloneFunction(
+    llvm::Function &function, llvm::ValueToValueMapTy &value_map) {
+  ScopedTimer timer(stats[ExplorerPhase::kClone]);
+  llvm::Function *cloned_function = llvm::CloneFunction(&function, value_map);
+  stats.instructions_cloned += function.getInstructionCount();
+
+  id_table->Copy(function, *cloned_function);
+  for (auto &instruction : llvm::instructions(function)) {
+    id_table->Copy(instruction,
+                   *llvm::cast<llvm::Instruction>(value_map[&instruction]));
+  }
+  return cloned_function;
+}
+
+void BitcodeExplorer::EraseInstruction(llvm::Instruction *instruction) {
+  id_table->Forget(*instruction);
+  instruction->eraseFromParent();
+}
+
+void BitcodeExplorer::EraseFunction(llvm::Function *function) {
+  lazy_functions.erase(function);
+  id_table->ForgetFunction(*function);
+  function->eraseFromParent();
+}
+
+bool BitcodeExplorer::EnsureMaterialized(llvm::Function &function) {
+  auto it = lazy_functions.find(&function);
+  if (it == lazy_functions.end()) {
+    return true;
+  }
+
+  // The body may already have been read by someone else, e.g. by
+  // `llvm::Module::materializeAll`, in which case this is a no-op.
+  if (llvm::Error error = function.materialize()) {
+    llvm::consumeError(std::move(error));
+    return false;
+  }
+  lazy_functions.erase(it);
+
+  // The function itself was indexed when its module was taken, so only keep
+  // the provenance read from the body.
+  ValueId function_id = GetId(function, ValueIdKind::kDerived);
+  ReadMetadata(function);
+  SetId(function, function_id, ValueIdKind::kDerived);
+  UpdateBodyMetadata(function);
+  // Its size is only known now.
+  AddToCatalog(function_id);
+  return true;
+}
+
+void BitcodeExplorer::WriteMetadata(
+    llvm::Function &function, std::initializer_list<ValueIdKind> kinds) const {
+  llvm::LLVMContext &context = function.getContext();
+  MetadataKinds kind_ids(context);
+  auto write = [this, &context, &kind_ids, kinds](auto &value) {
+    const ValueIds *ids = id_table->Find(value);
+    if (!ids) {
+      return;
+    }
+    for (ValueIdKind kind : kinds) {
+      if (ValueId id = (*ids)[kind]; id != kInvalidValueId) {
+        value.setMetadata(kind_ids[kind], CreateIdNode(context, id));
+      }
+    }
+  };
+
+  write(function);
+  for (auto &instruction : llvm::instructions(function)) {
+    write(instruction);
+  }
+}
+
+void BitcodeExplorer::WriteMetadata(llvm::Module &module) const {
+  for (auto &function : module.functions()) {
+    if (GetId(function, ValueIdKind::kDerived) != kInvalidValueId) {
+      WriteMetadata(function,
+                    {ValueIdKind::kOriginal, ValueIdKind::kDerived,
+                     ValueIdKind::kBlock, ValueIdKind::kSubstitution});
+    }
+  }
+}
+
+void BitcodeExplorer::ReadMetadata(llvm::Function &function) {
+  MetadataKinds kind_ids(function.getContext());
+  auto read = [this, &kind_ids](auto &value) {
+    for (ValueIdKind kind :
+         {ValueIdKind::kOriginal, ValueIdKind::kDerived, ValueIdKind::kBlock,
+          ValueIdKind::kSubstitution}) {
+      unsigned kind_id = kind_ids[kind];
+      if (llvm::MDNode *mdnode = value.getMetadata(kind_id)) {
+        id_table->Set(value, kind, ReadIdNode(mdnode));
+        value.setMetadata(kind_id, nullptr);
+      }
+    }
+  };
+
+  read(function);
+  for (auto &instruction : llvm::instructions(function)) {
+    if (instruction.hasMetadataOtherThanDebugLoc()) {
+      read(instruction);
+    }
+  }
 }
 
 // Get a `FunctionCallee` object for the given `type`. Create the function in
@@ -614,19 +1519,15 @@ llvm::CallInst *BitcodeExplorer::CreateHookCallInst(llvm::Type *type,
   SetId(*call_instr,
         static_cast<std::underlying_type_t<SubstitutionKind>>(hook_kind),
         ValueIdKind::kSubstitution);
+  hook_calls.push_back(call_instr);
   return call_instr;
 }
 
 Result<ValueId, SubstitutionError>
 BitcodeExplorer::SubstituteInstructionWithValue(
     ValueId instruction_id, uint64_t value, ISubstitutionObserver &observer) {
-  auto instruction_pair = instruction_map.find(instruction_id);
-  if (instruction_pair == instruction_map.end()) {
-    return SubstitutionError::kIdNotFound;
-  }
-
-  llvm::Instruction *instruction =
-      llvm::cast_or_null<llvm::Instruction>(instruction_pair->second);
+  ScopedTimer timer(stats[ExplorerOperation::kSubstitution]);
+  llvm::Instruction *instruction = value_index->GetInstruction(instruction_id);
   if (!instruction) {
     return SubstitutionError::kIdNotFound;
   }
@@ -636,241 +1537,237 @@ BitcodeExplorer::SubstituteInstructionWithValue(
 
   llvm::Function *function = instruction->getFunction();
   assert(function != nullptr);
-  llvm::Module *func_module = function->getParent();
-
-  // clone and modify the function
-  llvm::ValueToValueMapTy value_map;
-  llvm::Function *cloned_function = llvm::CloneFunction(function, value_map);
-
-  llvm::Instruction *cloned_instr = nullptr;
-  for (auto &cloned_instruction : llvm::instructions(cloned_function)) {
-    if (GetId(cloned_instruction, ValueIdKind::kDerived) == instruction_id) {
-      cloned_instr = &cloned_instruction;
-    }
-  }
-  assert(cloned_instr != nullptr);
-
-  // Here we want to add in a substitution hook to facilitate the substitution
-  // process. The real value replacement really happens inside
-  // `ElideSubstitutionHooks`. For example, given a function:
-  //
-  // foo(x, y) {
-  //   ...
-  //   a = x + y
-  //   b = a + 1
-  //   ...
-  // }
-  //
-  // And we want to replace `a` with `10`. Then the function should be
-  // transformed into:
-  //
-  // foo(x, y) {
-  //   ...
-  //   temp_val = x + y
-  //   a = substitute_hook(temp_val, 10)
-  //   b = a + 1
-  //   ...
-  // }
-  //
-  // The first parameter being the old value and the second one being the new
-  // value.
-
-  llvm::ConstantInt *const_val = llvm::ConstantInt::get(
-      llvm_context,
-      llvm::APInt(cloned_instr->getType()->getIntegerBitWidth(), value, false));
-  llvm::CallInst *substituted_call = CreateHookCallInst(
-      cloned_instr->getType(), func_module,
-      SubstitutionKind::kValueSubstitution, cloned_instr, const_val);
-  substituted_call->insertAfter(cloned_instr);
-
-  cloned_instr->replaceUsesWithIf(
-      substituted_call, [substituted_call](const llvm::Use &use) -> bool {
-        return use.getUser() != substituted_call;
-      });
-
-  MAG_DEBUG(VerifyModule(func_module, cloned_function));
-
-  ElideSubstitutionHooks(*cloned_function, observer);
 
-  UpdateMetadata(*cloned_function);
-
-  MAG_DEBUG(VerifyModule(func_module, cloned_function));
-
-  return GetId(*cloned_function, ValueIdKind::kDerived);
+  return SubstituteValues(*function, {{instruction, value}}, observer);
 }
 
 Result<ValueId, SubstitutionError> BitcodeExplorer::SubstituteArgumentWithValue(
     ValueId argument_id, uint64_t value, ISubstitutionObserver &observer) {
-  auto argument_pair = argument_map.find(argument_id);
-  if (argument_pair == argument_map.end()) {
-    if (function_map.find(argument_id) != function_map.end()) {
+  ScopedTimer timer(stats[ExplorerOperation::kSubstitution]);
+  llvm::Argument *argument = value_index->GetArgument(argument_id);
+  if (!argument) {
+    if (value_index->GetFunction(argument_id)) {
       return SubstitutionError::kCannotUseFunctionId;
     }
     return SubstitutionError::kIdNotFound;
   }
-
-  llvm::Argument *argument =
-      llvm::cast_or_null<llvm::Argument>(argument_pair->second);
-  if (!argument) {
-    return SubstitutionError::kIdNotFound;
-  }
   if (!argument->getType()->isIntegerTy()) {
     return SubstitutionError::kIncorrectType;
   }
 
   llvm::Function *function = argument->getParent();
   assert(function != nullptr);
-  llvm::Module *func_module = function->getParent();
+  if (!EnsureMaterialized(*function)) {
+    return SubstitutionError::kIdNotFound;
+  }
+
+  return SubstituteValues(*function, {{argument, value}}, observer);
+}
+
+Result<ValueId, SubstitutionError> BitcodeExplorer::ApplySubstitutions(
+    const std::vector<Substitution> &substitutions,
+    ISubstitutionObserver &observer) {
+  ScopedTimer timer(stats[ExplorerOperation::kSubstitution]);
+  if (substitutions.empty()) {
+    return SubstitutionError::kNoSubstitutions;
+  }
+
+  llvm::Function *function = nullptr;
+  llvm::MapVector<llvm::Value *, uint64_t> values;
+  for (const Substitution &substitution : substitutions) {
+    llvm::Value *target;
+    llvm::Function *target_function;
+    if (llvm::Instruction *instruction =
+            value_index->GetInstruction(substitution.id)) {
+      target = instruction;
+      target_function = instruction->getFunction();
+    } else if (llvm::Argument *argument =
+                   value_index->GetArgument(substitution.id)) {
+      target = argument;
+      target_function = argument->getParent();
+    } else if (value_index->GetFunction(substitution.id)) {
+      return SubstitutionError::kCannotUseFunctionId;
+    } else {
+      return SubstitutionError::kIdNotFound;
+    }
+
+    if (!target->getType()->isIntegerTy()) {
+      return SubstitutionError::kIncorrectType;
+    }
+    if (function && function != target_function) {
+      return SubstitutionError::kFunctionMismatch;
+    }
+    function = target_function;
+
+    // A later substitution of the same value replaces the earlier one
+    values[target] = substitution.value;
+  }
+
+  if (!EnsureMaterialized(*function)) {
+    return SubstitutionError::kIdNotFound;
+  }
+
+  return SubstituteValues(*function, values.takeVector(), observer);
+}
+
+ValueId BitcodeExplorer::SubstituteValues(
+    llvm::Function &function,
+    const std::vector<std::pair<llvm::Value *, uint64_t>> &values,
+    ISubstitutionObserver &observer) {
+  llvm::Module *func_module = function.getParent();
 
   // clone and modify the function
   llvm::ValueToValueMapTy value_map;
-  llvm::Function *cloned_function = llvm::CloneFunction(function, value_map);
-
-  llvm::Argument *cloned_argument =
-      cloned_function->getArg(argument->getArgNo());
+  llvm::Function *cloned_function = CloneFunction(function, value_map);
 
-  // Here we want to add in a substitution hook to facilitate the substitution
-  // process. The real value replacement really happens inside
-  // `ElideSubstitutionHooks`. For example, given a function:
+  // Here we want to add in a substitution hook for every value to facilitate
+  // the substitution process. The real value replacement really happens inside
+  // `ElideSubstitutionHooks`, once for all of them. For example, given a
+  // function:
   //
   // foo(x, y) {
   //   ...
   //   a = x + y
+  //   b = a + 1
   //   ...
   // }
   //
-  // And we want to replace `y` with `10`. Then the function should be
-  // transformed into:
+  // And we want to replace `y` with `10` and `a` with `20`. Then the function
+  // should be transformed into:
   //
   // foo(x, y) {
   //   temp_val = substitute_hook(y, 10)
   //   ...
-  //   a = x + temp_val
+  //   temp_val1 = x + temp_val
+  //   a = substitute_hook(temp_val1, 20)
+  //   b = a + 1
   //   ...
   // }
   //
-  // The first parameter being the old value (`y`) and the second one being the
-  // new value (`10`).
-
-  llvm::ConstantInt *const_val = llvm::ConstantInt::get(
-      llvm_context,
-      llvm::APInt(cloned_argument->getType()->getIntegerBitWidth(), value,
-                  false));
-  llvm::CallInst *substitute_hook_call = CreateHookCallInst(
-      cloned_argument->getType(), func_module,
-      SubstitutionKind::kValueSubstitution, cloned_argument, const_val);
-  substitute_hook_call->insertBefore(&cloned_function->getEntryBlock().front());
-
-  cloned_argument->replaceUsesWithIf(
-      substitute_hook_call,
-      [substitute_hook_call](const llvm::Use &use) -> bool {
-        return use.getUser() != substitute_hook_call;
-      });
+  // The first parameter being the old value and the second one being the new
+  // value.
+  std::optional<ScopedTimer> hook_timer(
+      std::in_place, stats[ExplorerPhase::kHookInsertion]);
+  for (auto [value, new_value] : values) {
+    llvm::Value *cloned_value = value_map[value];
+    llvm::ConstantInt *const_val = llvm::ConstantInt::get(
+        cloned_value->getContext(),
+        llvm::APInt(cloned_value->getType()->getIntegerBitWidth(), new_value,
+                    false));
+    llvm::CallInst *substitute_hook_call = CreateHookCallInst(
+        cloned_value->getType(), func_module,
+        SubstitutionKind::kValueSubstitution, cloned_value, const_val);
+
+    if (auto *cloned_instr = llvm::dyn_cast<llvm::Instruction>(cloned_value)) {
+      substitute_hook_call->insertAfter(cloned_instr);
+    } else {
+      substitute_hook_call->insertBefore(
+          &cloned_function->getEntryBlock().front());
+    }
+
+    cloned_value->replaceUsesWithIf(
+        substitute_hook_call,
+        [substitute_hook_call](const llvm::Use &use) -> bool {
+          return use.getUser() != substitute_hook_call;
+        });
+  }
+  hook_timer.reset();
 
-  MAG_DEBUG(VerifyModule(func_module, cloned_function));
+  VerifyStep(*cloned_function);
 
   ElideSubstitutionHooks(*cloned_function, observer);
 
-  UpdateMetadata(*cloned_function);
+  ValueId cloned_function_id = AddVersion(*cloned_function, function,
+                                          VersionOperation::kSubstitution);
 
-  MAG_DEBUG(VerifyModule(func_module, cloned_function));
+  VerifyVersion(*cloned_function);
 
-  return GetId(*cloned_function, ValueIdKind::kDerived);
+  return cloned_function_id;
 }
 
 Result<ValueId, OptimizationError> BitcodeExplorer::OptimizeFunction(
     ValueId function_id,
     const llvm::OptimizationLevel &optimization_level) {
+  ScopedTimer timer(stats[ExplorerOperation::kOptimization]);
   if (optimization_level == llvm::OptimizationLevel::O0) {
     return OptimizationError::kInvalidOptimizationLevel;
   }
 
-  auto function_pair = function_map.find(function_id);
-  if (function_pair == function_map.end()) {
+  llvm::Function *function = value_index->GetFunction(function_id);
+  if (!function || !EnsureMaterialized(*function)) {
     return OptimizationError::kIdNotFound;
   }
 
-  llvm::Function *function =
-      llvm::cast_or_null<llvm::Function>(function_pair->second);
-  if (!function) {
-    return OptimizationError::kIdNotFound;
-  }
-
-  llvm::Module *func_module = function->getParent();
-
   // Clone the function
   llvm::ValueToValueMapTy value_map;
-  llvm::Function *cloned_function = llvm::CloneFunction(function, value_map);
+  llvm::Function *cloned_function = CloneFunction(*function, value_map);
+
+  if (!optimizer) {
+    optimizer = std::make_unique<OptimizationEngine>();
+  }
 
-  // Create the analysis managers
-  llvm::LoopAnalysisManager loop_analysis_manager;
-  llvm::FunctionAnalysisManager function_analysis_manager;
-  llvm::CGSCCAnalysisManager cgscc_analysis_manager;
-  llvm::ModuleAnalysisManager module_analysis_manager;
+  // The pipeline freely erases and creates instructions, so carry the
+  // provenance through it as metadata rather than through `id_table`.
+  WriteMetadata(*cloned_function, {ValueIdKind::kOriginal});
+  id_table->ForgetFunction(*cloned_function);
 
-  // Create the new pass manager builder
-  llvm::PassBuilder pass_builder;
+  {
+    ScopedTimer optimize_timer(stats[ExplorerPhase::kOptimize]);
+    optimizer->Run(*cloned_function, optimization_level);
+  }
 
-  function_analysis_manager.registerPass(
-      [&] { return pass_builder.buildDefaultAAPipeline(); });
+  ReadMetadata(*cloned_function);
 
-  pass_builder.registerModuleAnalyses(module_analysis_manager);
-  pass_builder.registerCGSCCAnalyses(cgscc_analysis_manager);
-  pass_builder.registerFunctionAnalyses(function_analysis_manager);
-  pass_builder.registerLoopAnalyses(loop_analysis_manager);
-  pass_builder.crossRegisterProxies(
-      loop_analysis_manager, function_analysis_manager, cgscc_analysis_manager,
-      module_analysis_manager);
+  ValueId cloned_function_id = AddVersion(*cloned_function, *function,
+                                          VersionOperation::kOptimization);
 
-  llvm::FunctionPassManager function_pass_manager =
-      pass_builder.buildFunctionSimplificationPipeline(
-          optimization_level, llvm::ThinOrFullLTOPhase::None);
+  VerifyVersion(*cloned_function);
 
-  function_pass_manager.run(*cloned_function, function_analysis_manager);
+  return cloned_function_id;
+}
 
-  UpdateMetadata(*cloned_function);
+const ExplorerStats &BitcodeExplorer::GetStats() const { return stats; }
 
-  MAG_DEBUG(VerifyModule(func_module, cloned_function));
+void BitcodeExplorer::ResetStats() { stats = ExplorerStats(); }
 
-  return GetId(*cloned_function, ValueIdKind::kDerived);
+OptimizationStats BitcodeExplorer::GetOptimizationStats() const {
+  if (!optimizer) {
+    return {};
+  }
+  return optimizer->GetStats();
 }
 
 std::optional<DeletionError> BitcodeExplorer::DeleteFunction(
     ValueId function_id) {
-  auto function_pair = function_map.find(function_id);
-  if (function_pair == function_map.end()) {
-    return DeletionError::kIdNotFound;
-  }
-
-  llvm::Function *function =
-      llvm::cast_or_null<llvm::Function>(function_pair->second);
+  llvm::Function *function = value_index->GetFunction(function_id);
   if (!function) {
     return DeletionError::kIdNotFound;
   }
 
   // Check if the function is referenced by another function
-  bool function_used_by_other_function = false;
-  for (llvm::Use &use : function->uses()) {
-    auto *instr = llvm::dyn_cast<llvm::Instruction>(use.getUser());
-    if (instr && instr->getFunction() != function) {
-      function_used_by_other_function = true;
-      break;
-    }
-  }
-
-  if (function_used_by_other_function) {
+  if (IsUsedOutside(*function)) {
     return DeletionError::kFunctionInUse;
   }
 
-  // Remove function from the various maps
-  function_map.erase(function_id);
+  PurgeFunction(function_id, function);
+  return std::nullopt;
+}
+
+size_t BitcodeExplorer::PurgeFunction(ValueId function_id,
+                                      llvm::Function *function) {
+  // Remove function from the index
+  value_index->Erase(function_id);
+  versions->Erase(function_id);
+  catalog->Erase(function_id);
+  pinned_functions.erase(function_id);
+  printed_functions.Erase(function_id);
 
   for (llvm::Argument &argument : function->args()) {
-    argument_map.erase(function_id + argument.getArgNo() + 1);
+    value_index->Erase(function_id + argument.getArgNo() + 1);
   }
 
   for (auto &instruction : llvm::instructions(function)) {
-    instruction_map.erase(GetId(instruction, ValueIdKind::kDerived));
+    value_index->Erase(GetId(instruction, ValueIdKind::kDerived));
   }
 
   for (llvm::BasicBlock &block : *function) {
@@ -878,27 +1775,130 @@ std::optional<DeletionError> BitcodeExplorer::DeleteFunction(
     if (!terminator_instr) {
       continue;
     }
-    block_map.erase(GetId(*terminator_instr, ValueIdKind::kBlock));
+    value_index->Erase(GetId(*terminator_instr, ValueIdKind::kBlock));
   }
 
   // Delete the function
-  function->eraseFromParent();
+  size_t instruction_count = function->getInstructionCount();
+  EraseFunction(function);
 
-  return std::nullopt;
+  return instruction_count;
+}
+
+CollectionStats BitcodeExplorer::CollectGarbage() {
+  ScopedTimer timer(stats[ExplorerOperation::kCollectGarbage]);
+  CollectionStats result;
+
+  // Gather the generated versions that fall outside of the retention window
+  // of their lineage.
+  std::vector<ValueId> candidates;
+  versions->ForEachLineage([this, &candidates](
+                               ValueId, const std::vector<ValueId> &lineage) {
+    size_t newer_versions = 0;
+    for (auto it = lineage.rbegin(); it != lineage.rend(); ++it) {
+      if (versions->Find(*it)->operation == VersionOperation::kOriginal) {
+        continue;
+      }
+      if (newer_versions++ < retention.versions_per_lineage) {
+        continue;
+      }
+      if (!pinned_functions.count(*it)) {
+        candidates.push_back(*it);
+      }
+    }
+  });
+  std::sort(candidates.begin(), candidates.end());
+
+  // Erasing a version can leave versions it used unreferenced, so keep going
+  // until nothing else can be erased. Newer versions are more likely to use
+  // older ones, so visit them first.
+  bool erased_any = true;
+  while (erased_any) {
+    erased_any = false;
+    for (auto it = candidates.rbegin(); it != candidates.rend(); ++it) {
+      llvm::Function *function = value_index->GetFunction(*it);
+      if (!function || IsUsedOutside(*function)) {
+        continue;
+      }
+
+      result.instructions_erased += PurgeFunction(*it, function);
+      result.functions_erased++;
+      erased_any = true;
+    }
+  }
+
+  return result;
+}
+
+void BitcodeExplorer::VerifyStep(llvm::Function &function) {
+  if (verification.level == VerificationLevel::kModule) {
+    Verify(function, /*whole_module=*/true);
+  }
+}
+
+void BitcodeExplorer::VerifyVersion(llvm::Function &function) {
+  switch (verification.level) {
+    case VerificationLevel::kOff:
+      return;
+    case VerificationLevel::kSampled:
+      if (++unverified_versions < verification.sample_interval) {
+        return;
+      }
+      unverified_versions = 0;
+      Verify(function, /*whole_module=*/false);
+      return;
+    case VerificationLevel::kFunction:
+      Verify(function, /*whole_module=*/false);
+      return;
+    case VerificationLevel::kModule:
+      Verify(function, /*whole_module=*/true);
+      return;
+  }
+}
+
+void BitcodeExplorer::Verify(llvm::Function &function, bool whole_module) {
+  ScopedTimer timer(stats[ExplorerPhase::kVerify]);
+  if (!VerifyFunction(function, whole_module)) {
+    stats.verification_failures++;
+  }
+}
+
+void BitcodeExplorer::SetVerificationPolicy(const VerificationPolicy &policy) {
+  verification = policy;
+  unverified_versions = 0;
+}
+
+const VerificationPolicy &BitcodeExplorer::GetVerificationPolicy() const {
+  return verification;
+}
+
+void BitcodeExplorer::SetRetentionPolicy(const RetentionPolicy &policy) {
+  retention = policy;
+}
+
+const RetentionPolicy &BitcodeExplorer::GetRetentionPolicy() const {
+  return retention;
+}
+
+bool BitcodeExplorer::PinFunction(ValueId function_id) {
+  if (!value_index->GetFunction(function_id)) {
+    return false;
+  }
+  pinned_functions.insert(function_id);
+  return true;
+}
+
+bool BitcodeExplorer::UnpinFunction(ValueId function_id) {
+  return pinned_functions.erase(function_id) != 0;
 }
 
 Result<ValueId, DevirtualizeError> BitcodeExplorer::DevirtualizeFunction(
     ValueId instruction_id, ValueId function_id,
     ISubstitutionObserver &substitution_observer) {
+  ScopedTimer timer(stats[ExplorerOperation::kDevirtualization]);
   // Find and check `instruction_id` is correctly referencing a `CallBase`
   // instruction
-  auto instruction_pair = instruction_map.find(instruction_id);
-  if (instruction_pair == instruction_map.end()) {
-    return DevirtualizeError::kInstructionNotFound;
-  }
-
-  llvm::Instruction *instruction =
-      llvm::cast_or_null<llvm::Instruction>(instruction_pair->second);
+  llvm::Instruction *instruction = value_index->GetInstruction(instruction_id);
   if (!instruction) {
     return DevirtualizeError::kInstructionNotFound;
   }
@@ -914,14 +1914,10 @@ Result<ValueId, DevirtualizeError> BitcodeExplorer::DevirtualizeFunction(
   }
 
   // Find the function with `function_id`
-  auto function_pair = function_map.find(function_id);
-  if (function_pair == function_map.end()) {
-    return DevirtualizeError::kFunctionNotFound;
-  }
-
   llvm::Function *direct_called_function =
-      llvm::cast_or_null<llvm::Function>(function_pair->second);
-  if (!direct_called_function) {
+      value_index->GetFunction(function_id);
+  if (!direct_called_function ||
+      &direct_called_function->getContext() != &call_base->getContext()) {
     return DevirtualizeError::kFunctionNotFound;
   }
 
@@ -931,17 +1927,12 @@ Result<ValueId, DevirtualizeError> BitcodeExplorer::DevirtualizeFunction(
 
   // Clone and modify the caller function
   llvm::ValueToValueMapTy caller_value_map;
+  llvm::Function *caller_function = call_base->getFunction();
   llvm::Function *cloned_caller_function =
-      llvm::CloneFunction(call_base->getFunction(), caller_value_map);
+      CloneFunction(*caller_function, caller_value_map);
 
-  llvm::CallBase *cloned_call_base = nullptr;
-  for (auto &cloned_instruction : llvm::instructions(cloned_caller_function)) {
-    if (this->GetId(cloned_instruction, ValueIdKind::kDerived) ==
-        instruction_id) {
-      cloned_call_base = llvm::dyn_cast<llvm::CallBase>(&cloned_instruction);
-    }
-  }
-  assert(cloned_call_base != nullptr);
+  auto *cloned_call_base =
+      llvm::cast<llvm::CallBase>(caller_value_map[call_base]);
 
   // Here we add in a hook function call to better observe the substitutions
   // that take place. The real value substitutions happen inside
@@ -968,45 +1959,64 @@ Result<ValueId, DevirtualizeError> BitcodeExplorer::DevirtualizeFunction(
   // second parameter is the new value - the function we are going to call
   // directly  (`direct_called_function`).
 
-  llvm::CallInst *substitute_hook_call = CreateHookCallInst(
-      cloned_call_base->getCalledOperand()->getType(),
-      cloned_call_base->getModule(),
-      SubstitutionKind::kFunctionDevirtualization,
-      cloned_call_base->getCalledOperand(), direct_called_function);
-  substitute_hook_call->insertBefore(cloned_call_base);
-  cloned_call_base->setCalledOperand(substitute_hook_call);
+  {
+    ScopedTimer hook_timer(stats[ExplorerPhase::kHookInsertion]);
+    llvm::CallInst *substitute_hook_call = CreateHookCallInst(
+        cloned_call_base->getCalledOperand()->getType(),
+        cloned_call_base->getModule(),
+        SubstitutionKind::kFunctionDevirtualization,
+        cloned_call_base->getCalledOperand(), direct_called_function);
+    substitute_hook_call->insertBefore(cloned_call_base);
+    cloned_call_base->setCalledOperand(substitute_hook_call);
+  }
 
-  MAG_DEBUG(VerifyModule(cloned_caller_function->getParent(),
-                         cloned_caller_function));
+  VerifyStep(*cloned_caller_function);
 
   ElideSubstitutionHooks(*cloned_caller_function, substitution_observer);
 
-  UpdateMetadata(*cloned_caller_function);
+  ValueId cloned_caller_id =
+      AddVersion(*cloned_caller_function, *caller_function,
+                 VersionOperation::kDevirtualization);
 
-  MAG_DEBUG(VerifyModule(cloned_caller_function->getParent(),
-                         cloned_caller_function));
+  VerifyVersion(*cloned_caller_function);
 
-  return GetId(*cloned_caller_function, ValueIdKind::kDerived);
+  return cloned_caller_id;
 }
 
 std::optional<llvm::Function *> BitcodeExplorer::GetFunctionById(ValueId id) {
-  auto res = this->function_map.find(id);
-  if (res != this->function_map.end()) {
-    if (auto f = llvm::cast_or_null<llvm::Function>(res->second)) {
-      return f;
-    } else {
-      return std::nullopt;
-    }
-  } else {
-    return std::nullopt;
+  if (auto f = value_index->GetFunction(id); f && EnsureMaterialized(*f)) {
+    return f;
+  }
+  return std::nullopt;
+}
+
+ValueId BitcodeExplorer::GetOwningFunctionId(ValueId value_id) const {
+  const llvm::Function *function = value_index->GetOwningFunction(value_id);
+  return function ? GetId(*function, ValueIdKind::kDerived) : kInvalidValueId;
+}
+
+std::optional<FunctionVersion> BitcodeExplorer::GetFunctionVersion(
+    ValueId function_id) const {
+  if (const FunctionVersion *version = versions->Find(function_id)) {
+    return *version;
   }
+  return std::nullopt;
 }
 
 ValueId BitcodeExplorer::IndexFunction(llvm::Function &function) {
   auto res = GetId(function, ValueIdKind::kDerived);
   if (res == kInvalidValueId) {
+    if (llvm::Error error = function.materialize()) {
+      llvm::consumeError(std::move(error));
+      return kInvalidValueId;
+    }
     UpdateMetadata(function);
-    return GetId(function, ValueIdKind::kDerived);
+
+    ValueId function_id = GetId(function, ValueIdKind::kDerived);
+    versions->Add({function_id, kInvalidValueId, function_id,
+                   VersionOperation::kOriginal});
+    AddToCatalog(function_id);
+    return function_id;
   }
 
   return res;
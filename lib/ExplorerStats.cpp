@@ -0,0 +1,116 @@
+/*
+ * Copyright (c) 2021-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#include <magnifier/ExplorerStats.h>
+
+#include <algorithm>
+#include <cassert>
+
+namespace magnifier {
+namespace {
+
+// Returns the bucket of a sample of `micros` microseconds.
+size_t GetBucket(uint64_t micros) {
+  size_t bucket = 0;
+  while (micros != 0 && bucket + 1 < LatencyHistogram::kBucketCount) {
+    micros >>= 1;
+    bucket++;
+  }
+  return bucket;
+}
+
+}  // namespace
+
+const char *GetPhaseName(ExplorerPhase phase) {
+  switch (phase) {
+    case ExplorerPhase::kClone:
+      return "clone";
+    case ExplorerPhase::kHookInsertion:
+      return "hook_insertion";
+    case ExplorerPhase::kInline:
+      return "inline";
+    case ExplorerPhase::kElideHooks:
+      return "elide_hooks";
+    case ExplorerPhase::kIndex:
+      return "index";
+    case ExplorerPhase::kVerify:
+      return "verify";
+    case ExplorerPhase::kOptimize:
+      return "optimize";
+    case ExplorerPhase::kPrint:
+      return "print";
+  }
+  assert(false);
+  return "";
+}
+
+const char *GetOperationName(ExplorerOperation operation) {
+  switch (operation) {
+    case ExplorerOperation::kLoad:
+      return "load";
+    case ExplorerOperation::kInline:
+      return "inline";
+    case ExplorerOperation::kInlineCallTree:
+      return "inline_call_tree";
+    case ExplorerOperation::kSubstitution:
+      return "substitution";
+    case ExplorerOperation::kOptimization:
+      return "optimization";
+    case ExplorerOperation::kDevirtualization:
+      return "devirtualization";
+    case ExplorerOperation::kCollectGarbage:
+      return "collect_garbage";
+    case ExplorerOperation::kSnapshot:
+      return "snapshot";
+  }
+  assert(false);
+  return "";
+}
+
+void LatencyHistogram::Record(std::chrono::nanoseconds latency) {
+  uint64_t micros =
+      std::chrono::duration_cast<std::chrono::microseconds>(latency).count();
+  buckets[GetBucket(micros)]++;
+  count++;
+  total += latency;
+  min = std::min(min, latency);
+  max = std::max(max, latency);
+}
+
+std::chrono::nanoseconds LatencyHistogram::Min() const {
+  return count == 0 ? std::chrono::nanoseconds(0) : min;
+}
+
+std::chrono::nanoseconds LatencyHistogram::Mean() const {
+  return count == 0 ? std::chrono::nanoseconds(0)
+                    : total / static_cast<int64_t>(count);
+}
+
+std::chrono::nanoseconds LatencyHistogram::Percentile(
+    double percentile) const {
+  if (count == 0) {
+    return std::chrono::nanoseconds(0);
+  }
+
+  // The rank of the sample, starting from 1.
+  auto rank = static_cast<uint64_t>(percentile / 100.0 * count + 0.5);
+  rank = std::clamp<uint64_t>(rank, 1, count);
+
+  uint64_t seen = 0;
+  for (size_t bucket = 0; bucket < kBucketCount; ++bucket) {
+    seen += buckets[bucket];
+    if (seen >= rank) {
+      std::chrono::nanoseconds upper =
+          std::chrono::microseconds(uint64_t(1) << bucket);
+      return std::min(upper, max);
+    }
+  }
+  return max;
+}
+
+}  // namespace magnifier
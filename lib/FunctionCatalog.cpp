@@ -0,0 +1,108 @@
+/*
+ * Copyright (c) 2021-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#include "FunctionCatalog.h"
+
+#include <algorithm>
+#include <iterator>
+
+namespace magnifier {
+
+void FunctionCatalog::Log(ValueId function_id) {
+  changes.emplace_back(++version, function_id);
+  if (changes.size() <=
+      std::max(kMinLogSize, kLogGrowthFactor * functions.size())) {
+    return;
+  }
+
+  // Drop the oldest half. Clients holding a version from before it have to
+  // list the functions again.
+  auto kept = changes.begin() + changes.size() / 2;
+  compacted_version = std::prev(kept)->first;
+  changes.erase(changes.begin(), kept);
+}
+
+void FunctionCatalog::Insert(FunctionInfo info) {
+  ValueId function_id = info.function_id;
+  functions[function_id] = std::move(info);
+  Log(function_id);
+}
+
+void FunctionCatalog::Erase(ValueId function_id) {
+  if (functions.erase(function_id)) {
+    Log(function_id);
+  }
+}
+
+const FunctionInfo *FunctionCatalog::Find(ValueId function_id) const {
+  auto it = functions.find(function_id);
+  if (it == functions.end()) {
+    return nullptr;
+  }
+  return &it->second;
+}
+
+FunctionPage FunctionCatalog::List(ValueId after, size_t limit) const {
+  FunctionPage page{{}, version, kInvalidValueId};
+  auto it = functions.upper_bound(after);
+  for (; it != functions.end() && page.functions.size() < limit; ++it) {
+    page.functions.push_back(it->second);
+  }
+  if (it != functions.end() && !page.functions.empty()) {
+    page.next = page.functions.back().function_id;
+  }
+  return page;
+}
+
+std::optional<CatalogChanges> FunctionCatalog::GetChanges(
+    uint64_t since) const {
+  if (since < compacted_version || since > version) {
+    return std::nullopt;
+  }
+
+  auto first = std::upper_bound(
+      changes.begin(), changes.end(), since,
+      [](uint64_t since, const std::pair<uint64_t, ValueId> &change) {
+        return since < change.first;
+      });
+  std::vector<ValueId> changed_ids;
+  for (auto it = first; it != changes.end(); ++it) {
+    changed_ids.push_back(it->second);
+  }
+  std::sort(changed_ids.begin(), changed_ids.end());
+  changed_ids.erase(std::unique(changed_ids.begin(), changed_ids.end()),
+                    changed_ids.end());
+
+  CatalogChanges result{{}, {}, version};
+  for (ValueId function_id : changed_ids) {
+    if (const FunctionInfo *info = Find(function_id)) {
+      result.updated.push_back(*info);
+    } else {
+      result.removed.push_back(function_id);
+    }
+  }
+  return result;
+}
+
+void FunctionCatalog::ForEach(
+    const std::function<void(const FunctionInfo &)> &callback) const {
+  if (functions.empty()) {
+    return;
+  }
+  // The callback may add or erase functions, so look the next one up by id.
+  // Functions added meanwhile have larger ids and are not visited.
+  ValueId last_id = functions.rbegin()->first;
+  for (auto it = functions.begin();
+       it != functions.end() && it->first <= last_id;) {
+    ValueId function_id = it->first;
+    callback(it->second);
+    it = functions.upper_bound(function_id);
+  }
+}
+
+}  // namespace magnifier
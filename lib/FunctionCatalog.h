@@ -0,0 +1,69 @@
+/*
+ * Copyright (c) 2021-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <magnifier/BitcodeExplorer.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <optional>
+#include <utility>
+#include <vector>
+
+namespace magnifier {
+
+// Keeps a `FunctionInfo` for every indexed function, ordered by id so that it
+// can be listed a page at a time. Every change increases the catalog version
+// and is logged, so that clients holding a listing can catch up with the
+// changes since their version instead of listing everything again.
+class FunctionCatalog {
+ private:
+  // The log is compacted once it holds this many times more changes than
+  // there are functions, or at least `kMinLogSize`.
+  static constexpr size_t kLogGrowthFactor = 2;
+  static constexpr size_t kMinLogSize = 4096;
+
+  std::map<ValueId, FunctionInfo> functions;
+  uint64_t version{0};
+  // The functions added, changed or erased, with the version they did so at,
+  // in increasing version order.
+  std::vector<std::pair<uint64_t, ValueId>> changes;
+  // Changes up to this version were dropped from `changes`.
+  uint64_t compacted_version{0};
+
+  // Log a change of the function with `function_id` at a new version.
+  void Log(ValueId function_id);
+
+ public:
+  // Add `info`, replacing the entry of its function if there is one.
+  void Insert(FunctionInfo info);
+
+  // Erasing a function that is not in the catalog is a no-op.
+  void Erase(ValueId function_id);
+
+  // Returns the entry of the function with `function_id`, or `nullptr`.
+  [[nodiscard]] const FunctionInfo *Find(ValueId function_id) const;
+
+  // See `BitcodeExplorer::ListFunctions`.
+  [[nodiscard]] FunctionPage List(ValueId after, size_t limit) const;
+
+  // See `BitcodeExplorer::GetCatalogChanges`.
+  [[nodiscard]] std::optional<CatalogChanges> GetChanges(uint64_t since) const;
+
+  // Invoke `callback` on every entry in increasing id order. Entries added by
+  // `callback` are not visited.
+  void ForEach(const std::function<void(const FunctionInfo &)> &callback) const;
+
+  [[nodiscard]] uint64_t GetVersion() const { return version; }
+  [[nodiscard]] size_t size() const { return functions.size(); }
+};
+
+}  // namespace magnifier
@@ -0,0 +1,164 @@
+/*
+ * Copyright (c) 2021-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#include <llvm/ADT/SetVector.h>
+#include <llvm/ADT/SmallPtrSet.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/GlobalAlias.h>
+#include <llvm/IR/GlobalVariable.h>
+#include <llvm/IR/InstIterator.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Transforms/Utils/Cloning.h>
+#include <magnifier/FunctionSlice.h>
+
+#include <vector>
+
+namespace magnifier {
+namespace {
+
+// Collects the global values a function references, looking through constant
+// expressions and the initializers of referenced global variables.
+class GlobalCollector {
+  llvm::SmallPtrSet<const llvm::Constant *, 32> visited;
+  std::vector<const llvm::Constant *> worklist;
+
+ public:
+  llvm::SetVector<const llvm::GlobalValue *> globals;
+
+  void Add(const llvm::Value *value) {
+    auto constant = llvm::dyn_cast_or_null<llvm::Constant>(value);
+    if (constant && visited.insert(constant).second) {
+      worklist.push_back(constant);
+    }
+  }
+
+  void Collect() {
+    while (!worklist.empty()) {
+      const llvm::Constant *constant = worklist.back();
+      worklist.pop_back();
+
+      if (auto global = llvm::dyn_cast<llvm::GlobalValue>(constant)) {
+        globals.insert(global);
+        // Referenced functions only need a declaration, but a copied
+        // variable needs everything its initializer refers to.
+        if (auto variable = llvm::dyn_cast<llvm::GlobalVariable>(global);
+            variable && variable->hasInitializer()) {
+          Add(variable->getInitializer());
+        }
+        continue;
+      }
+
+      for (const llvm::Value *operand : constant->operands()) {
+        Add(operand);
+      }
+    }
+  }
+};
+
+// Declares `global` in `module`, or defines it if it is a global variable
+// with an initializer, which is set once every global has been declared.
+// Aliases become declarations of what they point to.
+llvm::GlobalValue *CopyGlobal(const llvm::GlobalValue &global,
+                              llvm::Module &module) {
+  llvm::GlobalValue *copy;
+  if (auto function_type =
+          llvm::dyn_cast<llvm::FunctionType>(global.getValueType())) {
+    auto declaration = llvm::Function::Create(
+        function_type, llvm::GlobalValue::ExternalLinkage,
+        global.getAddressSpace(), global.getName(), &module);
+    if (auto function = llvm::dyn_cast<llvm::Function>(&global)) {
+      declaration->copyAttributesFrom(function);
+      // These only apply to definitions and refer to the source module.
+      declaration->setPersonalityFn(nullptr);
+      declaration->setPrefixData(nullptr);
+      declaration->setPrologueData(nullptr);
+    }
+    copy = declaration;
+  } else {
+    auto variable = llvm::dyn_cast<llvm::GlobalVariable>(&global);
+    auto copied_variable = new llvm::GlobalVariable(
+        module, global.getValueType(), variable && variable->isConstant(),
+        global.getLinkage(), nullptr, global.getName(), nullptr,
+        global.getThreadLocalMode(), global.getAddressSpace());
+    if (variable) {
+      copied_variable->copyAttributesFrom(variable);
+    }
+    copy = copied_variable;
+  }
+
+  if (auto variable = llvm::dyn_cast<llvm::GlobalVariable>(&global);
+      variable && variable->hasInitializer()) {
+    return copy;
+  }
+  copy->setLinkage(llvm::GlobalValue::ExternalLinkage);
+  copy->setVisibility(llvm::GlobalValue::DefaultVisibility);
+  return copy;
+}
+
+}  // namespace
+
+std::unique_ptr<llvm::Module> SliceFunction(
+    const llvm::Function &function, llvm::ValueToValueMapTy &value_map) {
+  const llvm::Module &source = *function.getParent();
+  auto module = std::make_unique<llvm::Module>(source.getModuleIdentifier(),
+                                               source.getContext());
+  module->setSourceFileName(source.getSourceFileName());
+  module->setDataLayout(source.getDataLayout());
+  module->setTargetTriple(source.getTargetTriple());
+  llvm::SmallVector<llvm::Module::ModuleFlagEntry, 8> flags;
+  source.getModuleFlagsMetadata(flags);
+  for (const llvm::Module::ModuleFlagEntry &flag : flags) {
+    module->addModuleFlag(flag.Behavior, flag.Key->getString(), flag.Val);
+  }
+
+  GlobalCollector collector;
+  if (function.hasPersonalityFn()) {
+    collector.Add(function.getPersonalityFn());
+  }
+  for (const llvm::Instruction &instruction : llvm::instructions(function)) {
+    for (const llvm::Value *operand : instruction.operands()) {
+      collector.Add(operand);
+    }
+  }
+  collector.Collect();
+
+  llvm::Function *copy = llvm::Function::Create(
+      function.getFunctionType(), function.getLinkage(),
+      function.getAddressSpace(), function.getName(), module.get());
+  copy->copyAttributesFrom(&function);
+  value_map[&function] = copy;
+
+  for (const llvm::GlobalValue *global : collector.globals) {
+    if (global != &function) {
+      value_map[global] = CopyGlobal(*global, *module);
+    }
+  }
+  for (const llvm::GlobalValue *global : collector.globals) {
+    auto variable = llvm::dyn_cast<llvm::GlobalVariable>(global);
+    if (variable && variable->hasInitializer()) {
+      llvm::cast<llvm::GlobalVariable>(value_map[global])
+          ->setInitializer(
+              llvm::MapValue(variable->getInitializer(), value_map));
+    }
+  }
+
+  auto argument = copy->arg_begin();
+  for (const llvm::Argument &source_argument : function.args()) {
+    argument->setName(source_argument.getName());
+    value_map[&source_argument] = &*argument++;
+  }
+
+  llvm::SmallVector<llvm::ReturnInst *, 8> returns;
+  llvm::CloneFunctionInto(copy, &function, value_map,
+                          llvm::CloneFunctionChangeType::DifferentModule,
+                          returns);
+  return module;
+}
+
+}  // namespace magnifier
@@ -0,0 +1,66 @@
+/*
+ * Copyright (c) 2021-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#include "FunctionVersionStore.h"
+
+#include <algorithm>
+
+namespace magnifier {
+
+void FunctionVersionStore::Add(const FunctionVersion &version) {
+  versions[version.function_id] = version;
+  lineages[version.lineage_id].push_back(version.function_id);
+}
+
+const FunctionVersion *FunctionVersionStore::Find(ValueId function_id) const {
+  auto it = versions.find(function_id);
+  if (it == versions.end()) {
+    return nullptr;
+  }
+  return &it->second;
+}
+
+void FunctionVersionStore::Erase(ValueId function_id) {
+  auto it = versions.find(function_id);
+  if (it == versions.end()) {
+    return;
+  }
+
+  auto lineage_it = lineages.find(it->second.lineage_id);
+  if (lineage_it != lineages.end()) {
+    std::vector<ValueId> &lineage = lineage_it->second;
+    auto id_it = std::find(lineage.begin(), lineage.end(), function_id);
+    if (id_it != lineage.end()) {
+      lineage.erase(id_it);
+    }
+    if (lineage.empty()) {
+      lineages.erase(lineage_it);
+    }
+  }
+  versions.erase(it);
+}
+
+const std::vector<ValueId> &FunctionVersionStore::GetLineage(
+    ValueId lineage_id) const {
+  static const std::vector<ValueId> kEmptyLineage;
+  auto it = lineages.find(lineage_id);
+  if (it == lineages.end()) {
+    return kEmptyLineage;
+  }
+  return it->second;
+}
+
+void FunctionVersionStore::ForEachLineage(
+    const std::function<void(ValueId, const std::vector<ValueId> &)>
+        &callback) const {
+  for (const auto &[lineage_id, lineage] : lineages) {
+    callback(lineage_id, lineage);
+  }
+}
+
+}  // namespace magnifier
@@ -0,0 +1,47 @@
+/*
+ * Copyright (c) 2021-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <llvm/ADT/DenseMap.h>
+#include <magnifier/BitcodeExplorer.h>
+
+#include <cstddef>
+#include <functional>
+#include <vector>
+
+namespace magnifier {
+
+// Keeps the `FunctionVersion` of every indexed function, grouped by lineage.
+class FunctionVersionStore {
+ private:
+  llvm::DenseMap<ValueId, FunctionVersion> versions;
+  // The ids of the versions in each lineage, in creation order.
+  llvm::DenseMap<ValueId, std::vector<ValueId>> lineages;
+
+ public:
+  void Add(const FunctionVersion &version);
+
+  // Returns the version with `function_id`, or `nullptr`.
+  [[nodiscard]] const FunctionVersion *Find(ValueId function_id) const;
+
+  void Erase(ValueId function_id);
+
+  // Returns the ids of the live versions in `lineage_id`, oldest first.
+  [[nodiscard]] const std::vector<ValueId> &GetLineage(
+      ValueId lineage_id) const;
+
+  // Invoke `callback` with the live version ids of every lineage.
+  void ForEachLineage(
+      const std::function<void(ValueId, const std::vector<ValueId> &)>
+          &callback) const;
+
+  [[nodiscard]] size_t size() const { return versions.size(); }
+};
+
+}  // namespace magnifier
@@ -0,0 +1,127 @@
+/*
+ * Copyright (c) 2021-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#include <llvm/ADT/SmallString.h>
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/Support/Chrono.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/Process.h>
+#include <llvm/Support/SHA256.h>
+#include <magnifier/ModuleCache.h>
+
+#include <algorithm>
+#include <chrono>
+#include <utility>
+#include <vector>
+
+namespace magnifier {
+namespace {
+
+constexpr llvm::StringLiteral kEntryExtension = ".module";
+
+}  // namespace
+
+ModuleCache::ModuleCache(std::string directory, uint64_t capacity)
+    : directory(std::move(directory)), capacity(capacity) {}
+
+std::string ModuleCache::GetKey(llvm::StringRef bitcode, bool lazy) {
+  std::string key = llvm::toHex(
+      llvm::SHA256::hash(llvm::arrayRefFromStringRef(bitcode)), true);
+  return lazy ? key + "-lazy" : key;
+}
+
+std::string ModuleCache::GetPath(const std::string &key) const {
+  llvm::SmallString<128> path(directory);
+  llvm::sys::path::append(path, key + kEntryExtension);
+  return std::string(path);
+}
+
+std::optional<std::string> ModuleCache::Find(const std::string &key) {
+  std::string path = GetPath(key);
+  int fd;
+  if (llvm::sys::fs::openFileForRead(path, fd)) {
+    return std::nullopt;
+  }
+
+  // The modification time orders entries for eviction.
+  (void)llvm::sys::fs::setLastAccessAndModificationTime(
+      fd, std::chrono::system_clock::now());
+  (void)llvm::sys::Process::SafelyCloseFileDescriptor(fd);
+  return path;
+}
+
+bool ModuleCache::Insert(
+    const std::string &key,
+    const std::function<bool(const std::string &)> &write) {
+  if (llvm::sys::fs::create_directories(directory)) {
+    return false;
+  }
+  llvm::SmallString<128> model(directory);
+  llvm::sys::path::append(model, "partial-%%%%%%%%%%%%");
+  llvm::SmallString<128> temporary_path;
+  llvm::sys::fs::createUniquePath(model, temporary_path,
+                                  /*MakeAbsolute=*/false);
+
+  // Renaming replaces any entry atomically, so concurrent loads of the same
+  // module never see a partial entry.
+  if (!write(std::string(temporary_path)) ||
+      llvm::sys::fs::rename(temporary_path, GetPath(key))) {
+    (void)llvm::sys::fs::remove(temporary_path);
+    return false;
+  }
+  Evict();
+  return true;
+}
+
+void ModuleCache::SetCapacity(uint64_t new_capacity) {
+  capacity = new_capacity;
+  Evict();
+}
+
+void ModuleCache::Evict() {
+  std::lock_guard<std::mutex> lock(mutex);
+
+  struct Entry {
+    std::string path;
+    uint64_t size;
+    llvm::sys::TimePoint<> last_used;
+  };
+  std::vector<Entry> entries;
+  uint64_t total_size = 0;
+
+  std::error_code error_code;
+  for (llvm::sys::fs::directory_iterator it(directory, error_code), end;
+       !error_code && it != end; it.increment(error_code)) {
+    if (llvm::sys::path::extension(it->path()) != kEntryExtension) {
+      continue;
+    }
+    llvm::sys::fs::file_status status;
+    if (llvm::sys::fs::status(it->path(), status)) {
+      continue;
+    }
+    entries.push_back(
+        {it->path(), status.getSize(), status.getLastModificationTime()});
+    total_size += status.getSize();
+  }
+
+  std::sort(entries.begin(), entries.end(),
+            [](const Entry &lhs, const Entry &rhs) {
+              return lhs.last_used < rhs.last_used;
+            });
+  for (const Entry &entry : entries) {
+    if (total_size <= capacity) {
+      break;
+    }
+    if (!llvm::sys::fs::remove(entry.path)) {
+      total_size -= entry.size;
+    }
+  }
+}
+
+}  // namespace magnifier
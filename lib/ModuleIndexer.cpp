@@ -0,0 +1,130 @@
+/*
+ * Copyright (c) 2021-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#include "ModuleIndexer.h"
+
+#include <llvm/IR/Function.h>
+#include <llvm/IR/InstIterator.h>
+#include <llvm/IR/Instruction.h>
+#include <llvm/IR/Module.h>
+
+#include <cassert>
+
+namespace magnifier {
+namespace {
+
+// Functions that get ids, see `BitcodeExplorer::TakeModule`.
+bool IsIndexed(const llvm::Function &function) {
+  return !function.isDeclaration() && !function.isIntrinsic();
+}
+
+// Move the `!explorer.*` metadata of `value` into `ids`. Derived and block ids
+// are always reassigned, so only the original and substitution ids are kept.
+// Returns true if any was.
+template <typename T>
+bool TakeMetadata(T &value, const MetadataKinds &kinds, ValueIds &ids) {
+  bool kept = false;
+  for (ValueIdKind kind :
+       {ValueIdKind::kOriginal, ValueIdKind::kDerived, ValueIdKind::kBlock,
+        ValueIdKind::kSubstitution}) {
+    if (llvm::MDNode *mdnode = value.getMetadata(kinds[kind])) {
+      if (kind == ValueIdKind::kOriginal ||
+          kind == ValueIdKind::kSubstitution) {
+        ids[kind] = ReadIdNode(mdnode);
+        kept = true;
+      }
+      value.setMetadata(kinds[kind], nullptr);
+    }
+  }
+  return kept;
+}
+
+}  // namespace
+
+ModuleIndexer::ModuleIndexer(llvm::Module &module) : module(module) {
+  for (llvm::Function &function : module.functions()) {
+    if (!IsIndexed(function)) {
+      continue;
+    }
+    id_count += 1 + function.arg_size();
+    if (!function.isMaterializable()) {
+      id_count += function.getInstructionCount() + function.size();
+    }
+  }
+}
+
+void ModuleIndexer::Index(ValueId first_id) {
+  assert(entries.empty() && "module was already indexed");
+  this->first_id = first_id;
+  MetadataKinds kinds(module.getContext());
+  ValueId next_id = first_id;
+
+  for (llvm::Function &function : module.functions()) {
+    if (!IsIndexed(function)) {
+      continue;
+    }
+
+    // Ids are laid out the same way as by `BitcodeExplorer::UpdateMetadata`:
+    // the function, its arguments, its instructions and then its blocks.
+    ValueId function_id = next_id++;
+    ValueIds function_ids;
+    if (function.isMaterializable()) {
+      lazy_functions.push_back(&function);
+    } else {
+      has_metadata_ids |= TakeMetadata(function, kinds, function_ids);
+    }
+    function_ids.derived = function_id;
+    if (function_ids.original == kInvalidValueId) {
+      function_ids.original = function_id;
+    }
+    entries.push_back({&function, function_ids});
+    slots.push_back({function_id, IndexedValueKind::kFunction, &function});
+    this->function_ids.push_back(function_id);
+
+    for ([[maybe_unused]] llvm::Argument &argument : function.args()) {
+      ValueId argument_id = next_id++;
+      slots.push_back({argument_id, IndexedValueKind::kArgument, &function});
+      assert(argument_id == (function_id + argument.getArgNo() + 1));
+    }
+
+    if (function.isMaterializable()) {
+      continue;
+    }
+
+    for (llvm::Instruction &instruction : llvm::instructions(function)) {
+      ValueId instruction_id = next_id++;
+      ValueIds instruction_ids;
+      if (instruction.hasMetadataOtherThanDebugLoc()) {
+        has_metadata_ids |= TakeMetadata(instruction, kinds, instruction_ids);
+      }
+      instruction_ids.derived = instruction_id;
+      if (instruction_ids.original == kInvalidValueId) {
+        instruction_ids.original = instruction_id;
+      }
+      entries.push_back({&instruction, instruction_ids});
+      slots.push_back(
+          {instruction_id, IndexedValueKind::kInstruction, &instruction});
+    }
+
+    // The block id lives on the terminator, whose entry was just added.
+    size_t terminator_entry = entries.size() - function.getInstructionCount();
+    for (llvm::BasicBlock &block : function) {
+      ValueId block_id = next_id++;
+      terminator_entry += block.size();
+      if (!block.getTerminator()) {
+        continue;
+      }
+      entries[terminator_entry - 1].ids.block = block_id;
+      slots.push_back({block_id, IndexedValueKind::kBlock, &block});
+    }
+  }
+
+  assert(next_id == first_id + id_count);
+}
+
+}  // namespace magnifier
@@ -0,0 +1,91 @@
+/*
+ * Copyright (c) 2021-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <magnifier/BitcodeExplorer.h>
+
+#include <vector>
+
+#include "ValueIdTable.h"
+#include "ValueIndex.h"
+
+namespace llvm {
+class Function;
+class Module;
+class Value;
+}  // namespace llvm
+
+namespace magnifier {
+
+// Assigns ids to the functions of a single module without touching the
+// explorer, so that several modules can be indexed at the same time. The ids
+// come from a range of `CountIds` ids reserved by the caller, which keeps them
+// independent of how the work was scheduled. The result is merged into the
+// explorer with `BitcodeExplorer::MergeIndex`.
+class ModuleIndexer {
+ public:
+  // The ids of a function or instruction.
+  struct Entry {
+    const llvm::Value *value;
+    ValueIds ids;
+  };
+
+  // A `ValueIndex` slot.
+  struct Slot {
+    ValueId id;
+    IndexedValueKind kind;
+    llvm::Value *value;
+  };
+
+ private:
+  llvm::Module &module;
+  ValueId first_id{kInvalidValueId};
+  ValueId id_count{0};
+  std::vector<Entry> entries;
+  std::vector<Slot> slots;
+  std::vector<ValueId> function_ids;
+  std::vector<llvm::Function *> lazy_functions;
+  bool has_metadata_ids{false};
+
+ public:
+  // Counts the ids needed by `module`.
+  explicit ModuleIndexer(llvm::Module &module);
+
+  ModuleIndexer(const ModuleIndexer &) = delete;
+  ModuleIndexer &operator=(const ModuleIndexer &) = delete;
+
+  // Number of ids `Index` hands out. Bodies of lazily loaded functions are
+  // not counted; they are indexed on first use.
+  [[nodiscard]] ValueId CountIds() const { return id_count; }
+
+  // Assign the ids `[first_id, first_id + CountIds())`. Any `!explorer.*`
+  // metadata is moved out of the module into the result, as
+  // `BitcodeExplorer::ReadMetadata` would.
+  void Index(ValueId first_id);
+
+  [[nodiscard]] llvm::Module &GetModule() const { return module; }
+  [[nodiscard]] ValueId GetFirstId() const { return first_id; }
+  [[nodiscard]] const std::vector<Entry> &GetEntries() const {
+    return entries;
+  }
+  [[nodiscard]] const std::vector<Slot> &GetSlots() const { return slots; }
+  // Ids of the indexed functions, in module order.
+  [[nodiscard]] const std::vector<ValueId> &GetFunctionIds() const {
+    return function_ids;
+  }
+  // Whether `!explorer.*` metadata gave an original id or a substitution
+  // kind to any value, i.e. the module was written out by an explorer.
+  [[nodiscard]] bool HasMetadataIds() const { return has_metadata_ids; }
+  // Functions whose body has not been read yet.
+  [[nodiscard]] const std::vector<llvm::Function *> &GetLazyFunctions() const {
+    return lazy_functions;
+  }
+};
+
+}  // namespace magnifier
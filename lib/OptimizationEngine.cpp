@@ -0,0 +1,73 @@
+/*
+ * Copyright (c) 2021-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#include "OptimizationEngine.h"
+
+#include <llvm/Analysis/AliasAnalysis.h>
+#include <llvm/IR/Function.h>
+
+#include <chrono>
+
+namespace magnifier {
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+}  // namespace
+
+OptimizationEngine::OptimizationEngine() {
+  Clock::time_point start = Clock::now();
+
+  function_analysis_manager.registerPass(
+      [&] { return pass_builder.buildDefaultAAPipeline(); });
+
+  pass_builder.registerModuleAnalyses(module_analysis_manager);
+  pass_builder.registerCGSCCAnalyses(cgscc_analysis_manager);
+  pass_builder.registerFunctionAnalyses(function_analysis_manager);
+  pass_builder.registerLoopAnalyses(loop_analysis_manager);
+  pass_builder.crossRegisterProxies(
+      loop_analysis_manager, function_analysis_manager, cgscc_analysis_manager,
+      module_analysis_manager);
+
+  stats.setup_time += Clock::now() - start;
+}
+
+llvm::FunctionPassManager &OptimizationEngine::GetPipeline(
+    const llvm::OptimizationLevel &level) {
+  auto key = std::make_pair(level.getSpeedupLevel(), level.getSizeLevel());
+  auto it = pipelines.find(key);
+  if (it != pipelines.end()) {
+    return it->second;
+  }
+
+  Clock::time_point start = Clock::now();
+  llvm::FunctionPassManager &pipeline =
+      pipelines
+          .emplace(key, pass_builder.buildFunctionSimplificationPipeline(
+                            level, llvm::ThinOrFullLTOPhase::None))
+          .first->second;
+  stats.setup_time += Clock::now() - start;
+  stats.pipelines_built++;
+  return pipeline;
+}
+
+void OptimizationEngine::Run(llvm::Function &function,
+                             const llvm::OptimizationLevel &level) {
+  llvm::FunctionPassManager &pipeline = GetPipeline(level);
+
+  Clock::time_point start = Clock::now();
+  pipeline.run(function, function_analysis_manager);
+  stats.run_time += Clock::now() - start;
+  stats.runs++;
+
+  // Only the analyses of the function that was just optimized are dropped;
+  // the managers and pipelines stay warm for the next call.
+  function_analysis_manager.clear(function, function.getName());
+}
+
+}  // namespace magnifier
@@ -0,0 +1,57 @@
+/*
+ * Copyright (c) 2021-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <llvm/IR/PassManager.h>
+#include <llvm/Passes/PassBuilder.h>
+#include <magnifier/BitcodeExplorer.h>
+
+#include <map>
+#include <utility>
+
+namespace llvm {
+class Function;
+}  // namespace llvm
+
+namespace magnifier {
+
+// Owns the pass builder, the analysis managers and one function
+// simplification pipeline per optimization level. Everything is built once
+// and reused by every `OptimizeFunction` call of an explorer.
+class OptimizationEngine {
+ private:
+  llvm::LoopAnalysisManager loop_analysis_manager;
+  llvm::FunctionAnalysisManager function_analysis_manager;
+  llvm::CGSCCAnalysisManager cgscc_analysis_manager;
+  llvm::ModuleAnalysisManager module_analysis_manager;
+  llvm::PassBuilder pass_builder;
+
+  // Pipelines keyed by the speedup and size level of `llvm::OptimizationLevel`.
+  std::map<std::pair<unsigned, unsigned>, llvm::FunctionPassManager> pipelines;
+
+  OptimizationStats stats;
+
+  // Returns the pipeline for `level`, building it on first use.
+  llvm::FunctionPassManager &GetPipeline(const llvm::OptimizationLevel &level);
+
+ public:
+  OptimizationEngine();
+
+  OptimizationEngine(const OptimizationEngine &) = delete;
+  OptimizationEngine &operator=(const OptimizationEngine &) = delete;
+
+  // Run the pipeline for `level` over `function`. Analysis results computed
+  // for `function` are dropped afterwards, so nothing keyed on it outlives
+  // the function.
+  void Run(llvm::Function &function, const llvm::OptimizationLevel &level);
+
+  [[nodiscard]] const OptimizationStats &GetStats() const { return stats; }
+};
+
+}  // namespace magnifier
@@ -0,0 +1,68 @@
+/*
+ * Copyright (c) 2021-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#include <magnifier/RenderCache.h>
+
+namespace magnifier {
+
+RenderCache::RenderCache(size_t capacity) : capacity(capacity) {}
+
+void RenderCache::Evict(size_t limit) {
+  while (size > limit && !entries.empty()) {
+    Entry &entry = entries.back();
+    size -= entry.second.size();
+    index.erase(entry.first);
+    entries.pop_back();
+  }
+}
+
+const std::string *RenderCache::Find(uint64_t id) {
+  auto it = index.find(id);
+  if (it == index.end()) {
+    return nullptr;
+  }
+
+  entries.splice(entries.begin(), entries, it->second);
+  return &it->second->second;
+}
+
+void RenderCache::Insert(uint64_t id, std::string text) {
+  Erase(id);
+  if (text.size() > capacity) {
+    return;
+  }
+
+  Evict(capacity - text.size());
+  size += text.size();
+  entries.emplace_front(id, std::move(text));
+  index[id] = entries.begin();
+}
+
+void RenderCache::Erase(uint64_t id) {
+  auto it = index.find(id);
+  if (it == index.end()) {
+    return;
+  }
+
+  size -= it->second->second.size();
+  entries.erase(it->second);
+  index.erase(it);
+}
+
+void RenderCache::Clear() {
+  entries.clear();
+  index.clear();
+  size = 0;
+}
+
+void RenderCache::SetCapacity(size_t new_capacity) {
+  capacity = new_capacity;
+  Evict(capacity);
+}
+
+}  // namespace magnifier
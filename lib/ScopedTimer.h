@@ -0,0 +1,35 @@
+/*
+ * Copyright (c) 2021-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <magnifier/ExplorerStats.h>
+
+#include <chrono>
+
+namespace magnifier {
+
+// Records the time between its construction and destruction in a histogram.
+class ScopedTimer {
+ private:
+  LatencyHistogram &histogram;
+  std::chrono::steady_clock::time_point start;
+
+ public:
+  explicit ScopedTimer(LatencyHistogram &histogram)
+      : histogram(histogram), start(std::chrono::steady_clock::now()) {}
+
+  ScopedTimer(const ScopedTimer &) = delete;
+  ScopedTimer &operator=(const ScopedTimer &) = delete;
+
+  ~ScopedTimer() {
+    histogram.Record(std::chrono::steady_clock::now() - start);
+  }
+};
+
+}  // namespace magnifier
@@ -0,0 +1,312 @@
+/*
+ * Copyright (c) 2021-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#include "Snapshot.h"
+
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <cassert>
+#include <cstring>
+#include <type_traits>
+
+namespace magnifier {
+namespace {
+
+constexpr char kSnapshotMagic[8] = {'M', 'A', 'G', 'S', 'N', 'A', 'P', '\0'};
+constexpr uint32_t kSnapshotFormatVersion = 1;
+constexpr uint64_t kLastVersionOperation =
+    static_cast<uint64_t>(VersionOperation::kDevirtualization);
+
+template <typename T>
+constexpr bool kIsRecord = std::is_trivially_copyable_v<T> &&
+                           sizeof(T) % alignof(uint64_t) == 0;
+static_assert(kIsRecord<SnapshotHeader> && kIsRecord<SnapshotModule> &&
+              kIsRecord<SnapshotFunction> && kIsRecord<ValueIds> &&
+              kIsRecord<SnapshotVersion> && kIsRecord<ValueId>);
+
+// Offsets of the sections that follow the header.
+struct SnapshotLayout {
+  uint64_t modules;
+  uint64_t functions;
+  uint64_t instructions;
+  uint64_t versions;
+  uint64_t pinned;
+  uint64_t end;
+
+  // Returns false if a section would not fit in `file_size` bytes.
+  bool Compute(const SnapshotHeader &header, uint64_t file_size) {
+    uint64_t offset = sizeof(SnapshotHeader);
+    auto section = [&offset, file_size](uint64_t &start, uint64_t count,
+                                        uint64_t record_size) {
+      start = offset;
+      if (count > (file_size - offset) / record_size) {
+        return false;
+      }
+      offset += count * record_size;
+      return true;
+    };
+    bool fits =
+        file_size >= offset &&
+        section(modules, header.module_count, sizeof(SnapshotModule)) &&
+        section(functions, header.function_count, sizeof(SnapshotFunction)) &&
+        section(instructions, header.instruction_count, sizeof(ValueIds)) &&
+        section(versions, header.version_count, sizeof(SnapshotVersion)) &&
+        section(pinned, header.pinned_count, sizeof(ValueId));
+    end = offset;
+    return fits;
+  }
+};
+
+uint64_t AlignOffset(uint64_t offset) {
+  return (offset + alignof(uint64_t) - 1) & ~uint64_t(alignof(uint64_t) - 1);
+}
+
+template <typename T>
+llvm::ArrayRef<T> GetSection(const llvm::MemoryBuffer &buffer,
+                             uint64_t offset, uint64_t count) {
+  return llvm::ArrayRef<T>(
+      reinterpret_cast<const T *>(buffer.getBufferStart() + offset), count);
+}
+
+// Returns true if every id of `ids` is unset or was allocated before
+// `value_id_counter`.
+bool IdsInRange(const ValueIds &ids, ValueId value_id_counter) {
+  return ids.derived < value_id_counter && ids.original < value_id_counter &&
+         ids.block < value_id_counter;
+}
+
+template <typename T>
+void WriteSection(llvm::raw_ostream &os, const std::vector<T> &records) {
+  os.write(reinterpret_cast<const char *>(records.data()),
+           records.size() * sizeof(T));
+}
+
+}  // namespace
+
+SnapshotWriter::SnapshotWriter(ValueId value_id_counter,
+                               const RetentionPolicy &retention)
+    : header() {
+  std::memcpy(header.magic, kSnapshotMagic, sizeof(kSnapshotMagic));
+  header.format_version = kSnapshotFormatVersion;
+  header.value_id_counter = value_id_counter;
+  header.versions_per_lineage = retention.versions_per_lineage;
+  header.collect_after_operation = retention.collect_after_operation;
+}
+
+void SnapshotWriter::AddModule(const llvm::Module &module,
+                               uint64_t context_index) {
+  llvm::SmallVector<char, 0> &module_bitcode = bitcode.emplace_back();
+  llvm::raw_svector_ostream os(module_bitcode);
+  llvm::WriteBitcodeToFile(module, os);
+
+  modules.push_back({0, module_bitcode.size(), context_index, 0});
+}
+
+void SnapshotWriter::AddModuleBitcode(llvm::StringRef module_bitcode,
+                                      uint64_t context_index) {
+  bitcode.emplace_back(module_bitcode.begin(), module_bitcode.end());
+  modules.push_back({0, module_bitcode.size(), context_index, 0});
+}
+
+void SnapshotWriter::AddFunction(uint32_t function_index, const ValueIds &ids,
+                                 bool body_indexed) {
+  assert(!modules.empty());
+  functions.push_back({function_index, body_indexed, 0, ids});
+  modules.back().function_count++;
+}
+
+void SnapshotWriter::AddInstruction(const ValueIds &ids) {
+  assert(!functions.empty() && functions.back().body_indexed);
+  instructions.push_back(ids);
+  functions.back().instruction_count++;
+}
+
+void SnapshotWriter::AddVersion(const FunctionVersion &version) {
+  versions.push_back({version.function_id, version.parent_id,
+                      version.lineage_id,
+                      static_cast<uint64_t>(version.operation)});
+}
+
+void SnapshotWriter::AddPinned(ValueId function_id) {
+  pinned.push_back(function_id);
+}
+
+bool SnapshotWriter::Write(const std::string &path) const {
+  SnapshotHeader file_header = header;
+  file_header.module_count = modules.size();
+  file_header.function_count = functions.size();
+  file_header.instruction_count = instructions.size();
+  file_header.version_count = versions.size();
+  file_header.pinned_count = pinned.size();
+
+  SnapshotLayout layout;
+  layout.Compute(file_header, UINT64_MAX);
+
+  // The bitcode follows the fixed-size sections.
+  std::vector<SnapshotModule> file_modules = modules;
+  uint64_t offset = layout.end;
+  for (SnapshotModule &module : file_modules) {
+    offset = AlignOffset(offset);
+    module.bitcode_offset = offset;
+    offset += module.bitcode_size;
+  }
+
+  std::error_code error_code;
+  llvm::raw_fd_ostream os(path, error_code, llvm::sys::fs::OF_None);
+  if (error_code) {
+    return false;
+  }
+
+  os.write(reinterpret_cast<const char *>(&file_header), sizeof(file_header));
+  WriteSection(os, file_modules);
+  WriteSection(os, functions);
+  WriteSection(os, instructions);
+  WriteSection(os, versions);
+  WriteSection(os, pinned);
+  for (size_t i = 0; i < bitcode.size(); ++i) {
+    os.write_zeros(file_modules[i].bitcode_offset - os.tell());
+    os.write(bitcode[i].data(), bitcode[i].size());
+  }
+
+  os.close();
+  if (os.has_error()) {
+    os.clear_error();
+    return false;
+  }
+  return true;
+}
+
+Result<std::unique_ptr<SnapshotReader>, SnapshotError> SnapshotReader::Open(
+    const std::string &path) {
+  // Without a null terminator, large files are memory mapped rather than
+  // read.
+  llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> buffer =
+      llvm::MemoryBuffer::getFile(path, /*IsText=*/false,
+                                  /*RequiresNullTerminator=*/false);
+  if (!buffer) {
+    return SnapshotError::kCannotReadFile;
+  }
+
+  std::unique_ptr<SnapshotReader> reader(new SnapshotReader());
+  reader->buffer = std::move(*buffer);
+  const llvm::MemoryBuffer &file = *reader->buffer;
+  uint64_t file_size = file.getBufferSize();
+
+  // Records are read in place, so the buffer has to be suitably aligned.
+  // Mapped files are page aligned and read files are 16 byte aligned.
+  if (reinterpret_cast<uintptr_t>(file.getBufferStart()) %
+          alignof(uint64_t) !=
+      0) {
+    return SnapshotError::kInvalidSnapshot;
+  }
+
+  if (file_size < sizeof(SnapshotHeader)) {
+    return SnapshotError::kInvalidSnapshot;
+  }
+  const auto *header =
+      reinterpret_cast<const SnapshotHeader *>(file.getBufferStart());
+  if (std::memcmp(header->magic, kSnapshotMagic, sizeof(kSnapshotMagic)) !=
+          0 ||
+      header->format_version != kSnapshotFormatVersion) {
+    return SnapshotError::kInvalidSnapshot;
+  }
+
+  SnapshotLayout layout;
+  if (!layout.Compute(*header, file_size)) {
+    return SnapshotError::kInvalidSnapshot;
+  }
+
+  reader->header = header;
+  reader->modules =
+      GetSection<SnapshotModule>(file, layout.modules, header->module_count);
+  reader->functions = GetSection<SnapshotFunction>(file, layout.functions,
+                                                   header->function_count);
+  reader->instructions = GetSection<ValueIds>(file, layout.instructions,
+                                              header->instruction_count);
+  reader->versions = GetSection<SnapshotVersion>(file, layout.versions,
+                                                 header->version_count);
+  reader->pinned =
+      GetSection<ValueId>(file, layout.pinned, header->pinned_count);
+
+  // Every function must belong to a module and every instruction to a
+  // function.
+  uint64_t function_count = 0;
+  for (const SnapshotModule &module : reader->modules) {
+    if (module.bitcode_offset < layout.end ||
+        module.bitcode_offset > file_size ||
+        module.bitcode_size > file_size - module.bitcode_offset) {
+      return SnapshotError::kInvalidSnapshot;
+    }
+    function_count += module.function_count;
+  }
+
+  // Only functions with an indexed body have instruction records.
+  uint64_t instruction_count = 0;
+  for (const SnapshotFunction &function : reader->functions) {
+    if (!function.body_indexed && function.instruction_count != 0) {
+      return SnapshotError::kInvalidSnapshot;
+    }
+    instruction_count += function.instruction_count;
+  }
+
+  if (function_count != header->function_count ||
+      instruction_count != header->instruction_count) {
+    return SnapshotError::kInvalidSnapshot;
+  }
+
+  // Ids are used as indices into the value index, so an id the explorer could
+  // not have allocated would make it grow without bound.
+  ValueId value_id_counter = header->value_id_counter;
+  for (const SnapshotFunction &function : reader->functions) {
+    if (function.ids.derived == kInvalidValueId ||
+        !IdsInRange(function.ids, value_id_counter)) {
+      return SnapshotError::kInvalidSnapshot;
+    }
+  }
+  for (const ValueIds &ids : reader->instructions) {
+    if (!IdsInRange(ids, value_id_counter)) {
+      return SnapshotError::kInvalidSnapshot;
+    }
+  }
+  for (const SnapshotVersion &version : reader->versions) {
+    if (version.function_id >= value_id_counter ||
+        version.parent_id >= value_id_counter ||
+        version.lineage_id >= value_id_counter ||
+        version.operation > kLastVersionOperation) {
+      return SnapshotError::kInvalidSnapshot;
+    }
+  }
+  for (ValueId function_id : reader->pinned) {
+    if (function_id >= value_id_counter) {
+      return SnapshotError::kInvalidSnapshot;
+    }
+  }
+  return reader;
+}
+
+llvm::MemoryBufferRef SnapshotReader::GetBitcode(
+    const SnapshotModule &module) const {
+  return llvm::MemoryBufferRef(
+      buffer->getBuffer().substr(module.bitcode_offset, module.bitcode_size),
+      buffer->getBufferIdentifier());
+}
+
+std::unique_ptr<llvm::MemoryBuffer> SnapshotReader::TakeBuffer() {
+  header = nullptr;
+  modules = {};
+  functions = {};
+  instructions = {};
+  versions = {};
+  pinned = {};
+  return std::move(buffer);
+}
+
+}  // namespace magnifier
@@ -0,0 +1,164 @@
+/*
+ * Copyright (c) 2021-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <magnifier/BitcodeExplorer.h>
+#include <magnifier/Result.h>
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "ValueIdTable.h"
+
+namespace llvm {
+class Module;
+}  // namespace llvm
+
+namespace magnifier {
+
+// A snapshot file is laid out as follows. Every record is a multiple of 8
+// bytes, so each section is aligned and the id tables can be used in place
+// from a memory mapped file. Values are stored in host byte order.
+//
+//   SnapshotHeader
+//   SnapshotModule[module_count]
+//   SnapshotFunction[function_count]    grouped by module, in module order
+//   ValueIds[instruction_count]         the body of each `SnapshotFunction`
+//   SnapshotVersion[version_count]      grouped by lineage, oldest first
+//   ValueId[pinned_count]
+//   The bitcode of every module, each starting at a multiple of 8 bytes.
+struct SnapshotHeader {
+  char magic[8];
+  uint32_t format_version;
+  uint32_t module_count;
+  ValueId value_id_counter;
+  uint64_t function_count;
+  uint64_t instruction_count;
+  uint64_t version_count;
+  uint64_t pinned_count;
+  uint64_t versions_per_lineage;
+  uint64_t collect_after_operation;
+};
+
+struct SnapshotModule {
+  uint64_t bitcode_offset;
+  uint64_t bitcode_size;
+  // Zero for the context the explorer was created with. Modules with the
+  // same non-zero index get the same new context when restored.
+  uint64_t context_index;
+  // Number of `SnapshotFunction` records of the module.
+  uint64_t function_count;
+};
+
+// An indexed function. It is followed by `instruction_count` `ValueIds`
+// records in the instruction section, one per instruction in order.
+struct SnapshotFunction {
+  // Position of the function in the function list of its module.
+  uint32_t function_index;
+  // Zero if the body was not indexed yet, see `lazy_functions`.
+  uint32_t body_indexed;
+  uint64_t instruction_count;
+  ValueIds ids;
+};
+
+struct SnapshotVersion {
+  ValueId function_id;
+  ValueId parent_id;
+  ValueId lineage_id;
+  uint64_t operation;
+};
+
+// Collects the state of an explorer and writes it out as a snapshot.
+class SnapshotWriter {
+ private:
+  SnapshotHeader header;
+  std::vector<SnapshotModule> modules;
+  std::vector<llvm::SmallVector<char, 0>> bitcode;
+  std::vector<SnapshotFunction> functions;
+  std::vector<ValueIds> instructions;
+  std::vector<SnapshotVersion> versions;
+  std::vector<ValueId> pinned;
+
+ public:
+  SnapshotWriter(ValueId value_id_counter, const RetentionPolicy &retention);
+
+  // Add `module`, which must be fully materialized. Functions added next
+  // belong to it.
+  void AddModule(const llvm::Module &module, uint64_t context_index);
+
+  // Add a module as the `bitcode` it was read from, e.g. when its function
+  // bodies were never read. Functions added next belong to it.
+  void AddModuleBitcode(llvm::StringRef bitcode, uint64_t context_index);
+
+  // Add the function at `function_index` in the last added module.
+  // Instructions added next belong to it.
+  void AddFunction(uint32_t function_index, const ValueIds &ids,
+                   bool body_indexed);
+
+  // Add the next instruction of the last added function.
+  void AddInstruction(const ValueIds &ids);
+
+  void AddVersion(const FunctionVersion &version);
+
+  void AddPinned(ValueId function_id);
+
+  // Returns false if the file could not be written.
+  bool Write(const std::string &path) const;
+};
+
+// A snapshot mapped into memory. The records are read in place and stay
+// valid as long as the reader.
+class SnapshotReader {
+ private:
+  std::unique_ptr<llvm::MemoryBuffer> buffer;
+  const SnapshotHeader *header{nullptr};
+  llvm::ArrayRef<SnapshotModule> modules;
+  llvm::ArrayRef<SnapshotFunction> functions;
+  llvm::ArrayRef<ValueIds> instructions;
+  llvm::ArrayRef<SnapshotVersion> versions;
+  llvm::ArrayRef<ValueId> pinned;
+
+  SnapshotReader() = default;
+
+ public:
+  // Map the snapshot at `path` and check that its sections are consistent
+  // and that every id in them was allocated before `value_id_counter`.
+  static Result<std::unique_ptr<SnapshotReader>, SnapshotError> Open(
+      const std::string &path);
+
+  [[nodiscard]] const SnapshotHeader &GetHeader() const { return *header; }
+  [[nodiscard]] llvm::ArrayRef<SnapshotModule> GetModules() const {
+    return modules;
+  }
+  [[nodiscard]] llvm::ArrayRef<SnapshotFunction> GetFunctions() const {
+    return functions;
+  }
+  [[nodiscard]] llvm::ArrayRef<ValueIds> GetInstructions() const {
+    return instructions;
+  }
+  [[nodiscard]] llvm::ArrayRef<SnapshotVersion> GetVersions() const {
+    return versions;
+  }
+  [[nodiscard]] llvm::ArrayRef<ValueId> GetPinned() const { return pinned; }
+
+  // The bitcode of `module`, one of `GetModules()`.
+  [[nodiscard]] llvm::MemoryBufferRef GetBitcode(
+      const SnapshotModule &module) const;
+
+  // Take the mapped file over, e.g. for lazily loaded modules that keep
+  // reading their bitcode from it. The reader cannot be used anymore.
+  std::unique_ptr<llvm::MemoryBuffer> TakeBuffer();
+};
+
+}  // namespace magnifier
@@ -0,0 +1,137 @@
+/*
+ * Copyright (c) 2021-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#include "ValueIdTable.h"
+
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/InstIterator.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Metadata.h>
+
+#include <cassert>
+
+namespace magnifier {
+
+ValueId &ValueIds::operator[](ValueIdKind kind) {
+  switch (kind) {
+    case ValueIdKind::kOriginal:
+      return original;
+    case ValueIdKind::kDerived:
+      return derived;
+    case ValueIdKind::kBlock:
+      return block;
+    case ValueIdKind::kSubstitution:
+      return substitution;
+  }
+  assert(false);
+  return derived;
+}
+
+ValueId ValueIds::operator[](ValueIdKind kind) const {
+  return const_cast<ValueIds &>(*this)[kind];
+}
+
+bool ValueIds::empty() const {
+  return derived == kInvalidValueId && original == kInvalidValueId &&
+         block == kInvalidValueId && substitution == kInvalidValueId;
+}
+
+MetadataKinds::MetadataKinds(llvm::LLVMContext &context)
+    : derived(context.getMDKindID("explorer.id")),
+      original(context.getMDKindID("explorer.source_id")),
+      block(context.getMDKindID("explorer.block_id")),
+      substitution(context.getMDKindID("explorer.substitution_kind_id")) {}
+
+unsigned MetadataKinds::operator[](ValueIdKind kind) const {
+  switch (kind) {
+    case ValueIdKind::kOriginal:
+      return original;
+    case ValueIdKind::kDerived:
+      return derived;
+    case ValueIdKind::kBlock:
+      return block;
+    case ValueIdKind::kSubstitution:
+      return substitution;
+  }
+  assert(false);
+  return 0;  // An invalid metadata id.
+}
+
+llvm::MDNode *CreateIdNode(llvm::LLVMContext &context, ValueId id) {
+  return llvm::MDNode::get(
+      context, llvm::ConstantAsMetadata::get(llvm::ConstantInt::get(
+                   context, llvm::APInt(64, id, false))));
+}
+
+ValueId ReadIdNode(const llvm::MDNode *mdnode) {
+  return llvm::cast<llvm::ConstantInt>(
+             llvm::cast<llvm::ConstantAsMetadata>(mdnode->getOperand(0))
+                 ->getValue())
+      ->getZExtValue();
+}
+
+ValueId ValueIdTable::Get(const llvm::Value &value, ValueIdKind kind) const {
+  auto it = ids.find(&value);
+  if (it == ids.end()) {
+    return kInvalidValueId;
+  }
+  return it->second[kind];
+}
+
+const ValueIds *ValueIdTable::Find(const llvm::Value &value) const {
+  auto it = ids.find(&value);
+  if (it == ids.end()) {
+    return nullptr;
+  }
+  return &it->second;
+}
+
+ValueIds &ValueIdTable::GetOrCreate(const llvm::Value &value) {
+  return ids[&value];
+}
+
+void ValueIdTable::Set(const llvm::Value &value, ValueIdKind kind,
+                       ValueId id) {
+  ids[&value][kind] = id;
+}
+
+void ValueIdTable::Remove(const llvm::Value &value, ValueIdKind kind) {
+  auto it = ids.find(&value);
+  if (it == ids.end()) {
+    return;
+  }
+  it->second[kind] = kInvalidValueId;
+  if (it->second.empty()) {
+    ids.erase(it);
+  }
+}
+
+void ValueIdTable::Copy(const llvm::Value &from, const llvm::Value &to) {
+  auto it = ids.find(&from);
+  if (it == ids.end()) {
+    ids.erase(&to);
+    return;
+  }
+  // Copy out first; inserting `to` may rehash and invalidate `it`.
+  ValueIds from_ids = it->second;
+  ids[&to] = from_ids;
+}
+
+void ValueIdTable::Reserve(size_t count) { ids.reserve(ids.size() + count); }
+
+void ValueIdTable::Forget(const llvm::Value &value) { ids.erase(&value); }
+
+void ValueIdTable::ForgetFunction(const llvm::Function &function) {
+  ids.erase(&function);
+  for (const llvm::Instruction &instruction : llvm::instructions(function)) {
+    ids.erase(&instruction);
+  }
+}
+
+}  // namespace magnifier
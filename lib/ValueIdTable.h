@@ -0,0 +1,97 @@
+/*
+ * Copyright (c) 2021-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <llvm/ADT/DenseMap.h>
+#include <magnifier/BitcodeExplorer.h>
+
+#include <cstddef>
+
+namespace llvm {
+class Function;
+class LLVMContext;
+class MDNode;
+class Value;
+}  // namespace llvm
+
+namespace magnifier {
+
+// Every id that can be attached to a single function or instruction.
+struct ValueIds {
+  ValueId derived{kInvalidValueId};
+  ValueId original{kInvalidValueId};
+  ValueId block{kInvalidValueId};
+  ValueId substitution{kInvalidValueId};
+
+  [[nodiscard]] ValueId &operator[](ValueIdKind kind);
+  [[nodiscard]] ValueId operator[](ValueIdKind kind) const;
+
+  [[nodiscard]] bool empty() const;
+};
+
+// The `!explorer.*` metadata kinds that ids are written to by
+// `BitcodeExplorer::WriteMetadata`. Kinds are registered per
+// `llvm::LLVMContext`, so they have to be looked up for each context.
+struct MetadataKinds {
+  unsigned derived;       // `!explorer.id`
+  unsigned original;      // `!explorer.source_id`
+  unsigned block;         // `!explorer.block_id`
+  unsigned substitution;  // `!explorer.substitution_kind_id`
+
+  explicit MetadataKinds(llvm::LLVMContext &context);
+
+  [[nodiscard]] unsigned operator[](ValueIdKind kind) const;
+};
+
+// Wrap `id` into a metadata node so that it can be attached to a value.
+llvm::MDNode *CreateIdNode(llvm::LLVMContext &context, ValueId id);
+
+// Unwrap an id created by `CreateIdNode`.
+ValueId ReadIdNode(const llvm::MDNode *mdnode);
+
+// Explorer-owned side table from functions and instructions to their ids.
+// It replaces per-value `!explorer.*` metadata, which had to be uniqued in
+// and could never be freed from the `LLVMContext`. The table does not track
+// the lifetime of its keys, so entries must be forgotten before their value is
+// destroyed.
+class ValueIdTable {
+ private:
+  llvm::DenseMap<const llvm::Value *, ValueIds> ids;
+
+ public:
+  // Returns the id of `kind` for `value`, or `kInvalidValueId`.
+  [[nodiscard]] ValueId Get(const llvm::Value &value, ValueIdKind kind) const;
+
+  // Returns all the ids of `value`, or `nullptr` if it has none.
+  [[nodiscard]] const ValueIds *Find(const llvm::Value &value) const;
+
+  // Returns all the ids of `value`, creating an empty entry if needed.
+  ValueIds &GetOrCreate(const llvm::Value &value);
+
+  void Set(const llvm::Value &value, ValueIdKind kind, ValueId id);
+
+  // Clear the id of `kind`. The entry is dropped once it holds no ids.
+  void Remove(const llvm::Value &value, ValueIdKind kind);
+
+  // Give `to` the same ids as `from`, e.g. after cloning `from`.
+  void Copy(const llvm::Value &from, const llvm::Value &to);
+
+  // Make room for `count` more entries.
+  void Reserve(size_t count);
+
+  // Drop every id of `value`.
+  void Forget(const llvm::Value &value);
+
+  // Drop every id of `function` and of all of its instructions.
+  void ForgetFunction(const llvm::Function &function);
+
+  [[nodiscard]] size_t size() const { return ids.size(); }
+};
+
+}  // namespace magnifier
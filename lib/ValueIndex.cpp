@@ -0,0 +1,131 @@
+/*
+ * Copyright (c) 2021-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#include "ValueIndex.h"
+
+#include <llvm/IR/BasicBlock.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Instruction.h>
+
+#include <cassert>
+
+namespace magnifier {
+
+const ValueIndex::Entry *ValueIndex::Find(ValueId id) const {
+  size_t chunk_index = id >> kChunkBits;
+  if (chunk_index >= chunks.size() || !chunks[chunk_index].entries) {
+    return nullptr;
+  }
+  return &chunks[chunk_index].entries[id & (kChunkSize - 1)];
+}
+
+void ValueIndex::Insert(ValueId id, IndexedValueKind kind,
+                        llvm::Value *value) {
+  assert(id != kInvalidValueId && value != nullptr);
+
+  size_t chunk_index = id >> kChunkBits;
+  if (chunk_index >= chunks.size()) {
+    chunks.resize(chunk_index + 1);
+  }
+
+  Chunk &chunk = chunks[chunk_index];
+  if (!chunk.entries) {
+    chunk.entries = std::make_unique<Entry[]>(kChunkSize);
+  }
+
+  Entry &entry = chunk.entries[id & (kChunkSize - 1)];
+  if (!entry.getPointer()) {
+    chunk.live++;
+  }
+  entry.setPointerAndInt(value, kind);
+}
+
+void ValueIndex::Erase(ValueId id) {
+  size_t chunk_index = id >> kChunkBits;
+  if (chunk_index >= chunks.size() || !chunks[chunk_index].entries) {
+    return;
+  }
+
+  Chunk &chunk = chunks[chunk_index];
+  Entry &entry = chunk.entries[id & (kChunkSize - 1)];
+  if (!entry.getPointer()) {
+    return;
+  }
+
+  entry = Entry();
+
+  // Ids are never reused, so an empty chunk can be given back right away.
+  if (--chunk.live == 0) {
+    chunk.entries.reset();
+  }
+}
+
+llvm::Function *ValueIndex::GetFunction(ValueId id) const {
+  const Entry *entry = Find(id);
+  if (!entry || entry->getInt() != IndexedValueKind::kFunction) {
+    return nullptr;
+  }
+  return llvm::cast_or_null<llvm::Function>(entry->getPointer());
+}
+
+llvm::Instruction *ValueIndex::GetInstruction(ValueId id) const {
+  const Entry *entry = Find(id);
+  if (!entry || entry->getInt() != IndexedValueKind::kInstruction) {
+    return nullptr;
+  }
+  return llvm::cast_or_null<llvm::Instruction>(entry->getPointer());
+}
+
+llvm::BasicBlock *ValueIndex::GetBlock(ValueId id) const {
+  const Entry *entry = Find(id);
+  if (!entry || entry->getInt() != IndexedValueKind::kBlock) {
+    return nullptr;
+  }
+  return llvm::cast_or_null<llvm::BasicBlock>(entry->getPointer());
+}
+
+llvm::Argument *ValueIndex::GetArgument(ValueId id) const {
+  const Entry *entry = Find(id);
+  if (!entry || entry->getInt() != IndexedValueKind::kArgument) {
+    return nullptr;
+  }
+
+  // Argument ids directly follow their function id, i.e. an argument id is
+  // `function_id + argno + 1`. Walk back to the function slot to recover the
+  // argument number.
+  auto *function = llvm::cast<llvm::Function>(entry->getPointer());
+  for (unsigned argno = 0; argno < function->arg_size() && argno < id;
+       ++argno) {
+    const Entry *function_entry = Find(id - argno - 1);
+    if (function_entry &&
+        function_entry->getInt() == IndexedValueKind::kFunction) {
+      return function_entry->getPointer() == function ? function->getArg(argno)
+                                                      : nullptr;
+    }
+  }
+  return nullptr;
+}
+
+llvm::Function *ValueIndex::GetOwningFunction(ValueId id) const {
+  const Entry *entry = Find(id);
+  if (!entry || !entry->getPointer()) {
+    return nullptr;
+  }
+  switch (entry->getInt()) {
+    case IndexedValueKind::kFunction:
+    case IndexedValueKind::kArgument:
+      return llvm::cast<llvm::Function>(entry->getPointer());
+    case IndexedValueKind::kInstruction:
+      return llvm::cast<llvm::Instruction>(entry->getPointer())->getFunction();
+    case IndexedValueKind::kBlock:
+      return llvm::cast<llvm::BasicBlock>(entry->getPointer())->getParent();
+  }
+  return nullptr;
+}
+
+}  // namespace magnifier
@@ -0,0 +1,86 @@
+/*
+ * Copyright (c) 2021-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <llvm/ADT/PointerIntPair.h>
+#include <magnifier/BitcodeExplorer.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace llvm {
+class Argument;
+class BasicBlock;
+class Function;
+class Instruction;
+class Value;
+}  // namespace llvm
+
+namespace magnifier {
+
+// The kind of value an index slot refers to.
+enum class IndexedValueKind : unsigned {
+  kFunction,
+  kInstruction,
+  kBlock,
+  kArgument,  // The slot holds the owning function, not the argument itself.
+};
+
+// A dense table from `ValueId`s to the values they identify. Value ids are
+// handed out by an increment only counter, so the table is a list of
+// fixed-size chunks indexed directly by id. Each slot is a single tagged
+// pointer; no value handles are registered on the values, so entries must be
+// erased explicitly before their value is destroyed.
+class ValueIndex {
+ private:
+  using Entry = llvm::PointerIntPair<llvm::Value *, 2, IndexedValueKind>;
+
+  static constexpr unsigned kChunkBits = 12;
+  static constexpr size_t kChunkSize = size_t(1) << kChunkBits;
+
+  struct Chunk {
+    std::unique_ptr<Entry[]> entries;
+    // Number of non-empty entries. A chunk is released once it drops to zero.
+    uint32_t live{0};
+  };
+
+  std::vector<Chunk> chunks;
+
+  // Returns the entry for `id` or `nullptr` if the slot was never allocated.
+  [[nodiscard]] const Entry *Find(ValueId id) const;
+
+ public:
+  ValueIndex() = default;
+
+  ValueIndex(const ValueIndex &) = delete;
+  ValueIndex &operator=(const ValueIndex &) = delete;
+
+  // Map `id` to `value`. `value` must be an `llvm::Function` for `kFunction`
+  // and `kArgument`, an `llvm::Instruction` for `kInstruction` and an
+  // `llvm::BasicBlock` for `kBlock`.
+  void Insert(ValueId id, IndexedValueKind kind, llvm::Value *value);
+
+  // Clear the slot for `id`. Erasing an empty slot is a no-op.
+  void Erase(ValueId id);
+
+  // Typed lookups. Each returns `nullptr` if `id` is not mapped to a value of
+  // the requested kind.
+  [[nodiscard]] llvm::Function *GetFunction(ValueId id) const;
+  [[nodiscard]] llvm::Instruction *GetInstruction(ValueId id) const;
+  [[nodiscard]] llvm::BasicBlock *GetBlock(ValueId id) const;
+  [[nodiscard]] llvm::Argument *GetArgument(ValueId id) const;
+
+  // Returns the function that `id` is, or that its argument, block or
+  // instruction belongs to, or `nullptr` if `id` is not mapped.
+  [[nodiscard]] llvm::Function *GetOwningFunction(ValueId id) const;
+};
+
+}  // namespace magnifier
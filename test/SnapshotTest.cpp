@@ -0,0 +1,276 @@
+/*
+ * Copyright (c) 2021-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+// Checks that snapshots and module cache entries give back the ids and the
+// version history they were written with. Exits with a non-zero status if any
+// check fails.
+
+#include <llvm/ADT/SmallString.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/AsmParser/Parser.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/SourceMgr.h>
+#include <llvm/Support/raw_ostream.h>
+#include <magnifier/BitcodeExplorer.h>
+#include <magnifier/ISubstitutionObserver.h>
+#include <magnifier/ModuleCache.h>
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+
+#include "lib/Snapshot.h"
+
+namespace {
+
+constexpr char kCallerModule[] = R"(
+define i32 @callee(i32 %x) {
+  %r = mul i32 %x, 3
+  ret i32 %r
+}
+
+define i32 @caller(i32 %a, i32 %b) {
+  %c = call i32 @callee(i32 %a)
+  %s = add i32 %c, %b
+  ret i32 %s
+}
+)";
+
+constexpr char kOtherModule[] = R"(
+define i32 @other(i32 %x) {
+  %r = add i32 %x, 1
+  ret i32 %r
+}
+)";
+
+int failure_count = 0;
+
+#define CHECK(condition)                                         \
+  do {                                                           \
+    if (!(condition)) {                                          \
+      llvm::errs() << __FILE__ << ":" << __LINE__                \
+                   << ": check failed: " #condition "\n";        \
+      failure_count++;                                           \
+    }                                                            \
+  } while (false)
+
+class SubstitutionObserver : public magnifier::ISubstitutionObserver {
+ public:
+  llvm::Value *PerformSubstitution(llvm::Instruction *, llvm::Value *,
+                                   llvm::Value *new_val,
+                                   magnifier::SubstitutionKind) override {
+    return new_val;
+  }
+};
+
+// The bitcode of the module written as textual IR in `ir`.
+std::unique_ptr<llvm::MemoryBuffer> Assemble(llvm::StringRef ir) {
+  llvm::LLVMContext context;
+  llvm::SMDiagnostic error;
+  std::unique_ptr<llvm::Module> module =
+      llvm::parseAssemblyString(ir, error, context);
+  if (!module) {
+    error.print("SnapshotTest", llvm::errs());
+    return nullptr;
+  }
+  llvm::SmallVector<char, 0> bitcode;
+  llvm::raw_svector_ostream os(bitcode);
+  llvm::WriteBitcodeToFile(*module, os);
+  return llvm::MemoryBuffer::getMemBufferCopy(
+      llvm::StringRef(bitcode.data(), bitcode.size()));
+}
+
+// Every function of `explorer` with its version and printed body, i.e. what a
+// client can tell about its ids.
+std::string Describe(magnifier::BitcodeExplorer &explorer) {
+  std::string description;
+  llvm::raw_string_ostream os(description);
+  for (const magnifier::FunctionInfo &info :
+       explorer.ListFunctions(magnifier::kInvalidValueId, SIZE_MAX)
+           .functions) {
+    os << info.function_id << " " << info.name << " parent "
+       << info.parent_id;
+    if (std::optional<magnifier::FunctionVersion> version =
+            explorer.GetFunctionVersion(info.function_id)) {
+      os << " lineage " << version->lineage_id << " operation "
+         << static_cast<int>(version->operation);
+    }
+    os << "\n";
+    explorer.PrintFunction(info.function_id, os);
+  }
+  return os.str();
+}
+
+// Returns the id of the function called `name`, or `kInvalidValueId`.
+magnifier::ValueId FindFunction(const magnifier::BitcodeExplorer &explorer,
+                                llvm::StringRef name) {
+  for (const magnifier::FunctionInfo &info :
+       explorer.ListFunctions(magnifier::kInvalidValueId, SIZE_MAX)
+           .functions) {
+    if (info.name == name) {
+      return info.function_id;
+    }
+  }
+  return magnifier::kInvalidValueId;
+}
+
+// A snapshot restores the ids, the versions and the pinned functions of the
+// explorer it was saved from, and ids allocated afterwards match too.
+void CheckSnapshotRoundTrip(const std::string &directory) {
+  llvm::SmallString<128> path(directory);
+  llvm::sys::path::append(path, "session.snap");
+
+  llvm::LLVMContext context;
+  magnifier::BitcodeExplorer explorer(context);
+  CHECK(explorer.LoadModule(Assemble(kCallerModule)).Succeeded());
+
+  SubstitutionObserver observer;
+  magnifier::ValueId caller_id = FindFunction(explorer, "caller");
+  auto substituted =
+      explorer.SubstituteArgumentWithValue(caller_id + 1, 5, observer);
+  CHECK(substituted.Succeeded());
+  if (!substituted.Succeeded()) {
+    return;
+  }
+  auto optimized = explorer.OptimizeFunction(substituted.Value(),
+                                             llvm::OptimizationLevel::O2);
+  CHECK(optimized.Succeeded());
+  CHECK(explorer.PinFunction(substituted.Value()));
+  CHECK(!explorer.SaveSnapshot(std::string(path)));
+
+  llvm::LLVMContext restored_context;
+  magnifier::BitcodeExplorer restored(restored_context);
+  CHECK(restored.RestoreSnapshot(std::string(path)).Succeeded());
+  CHECK(Describe(restored) == Describe(explorer));
+  CHECK(restored.UnpinFunction(substituted.Value()));
+
+  auto next = explorer.SubstituteArgumentWithValue(caller_id + 2, 7, observer);
+  auto restored_next =
+      restored.SubstituteArgumentWithValue(caller_id + 2, 7, observer);
+  CHECK(next.Succeeded() && restored_next.Succeeded() &&
+        next.Value() == restored_next.Value());
+}
+
+// A snapshot whose function records claim instructions for a body that was
+// not indexed is rejected, and the explorer stays empty.
+void CheckCorruptSnapshotIsRejected(const std::string &directory) {
+  llvm::SmallString<128> path(directory);
+  llvm::sys::path::append(path, "corrupt.snap");
+
+  {
+    llvm::LLVMContext context;
+    magnifier::BitcodeExplorer explorer(context);
+    CHECK(explorer.LoadModule(Assemble(kCallerModule)).Succeeded());
+    CHECK(!explorer.SaveSnapshot(std::string(path)));
+  }
+
+  llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> file =
+      llvm::MemoryBuffer::getFile(path);
+  CHECK(file);
+  if (!file) {
+    return;
+  }
+  std::string bytes((*file)->getBuffer());
+
+  // Clear `body_indexed` of the first function with instructions
+  magnifier::SnapshotHeader header;
+  std::memcpy(&header, bytes.data(), sizeof(header));
+  size_t offset = sizeof(magnifier::SnapshotHeader) +
+                  header.module_count * sizeof(magnifier::SnapshotModule);
+  bool corrupted = false;
+  for (uint64_t i = 0; i < header.function_count && !corrupted; ++i) {
+    magnifier::SnapshotFunction function;
+    std::memcpy(&function, bytes.data() + offset, sizeof(function));
+    if (function.body_indexed && function.instruction_count != 0) {
+      function.body_indexed = 0;
+      std::memcpy(bytes.data() + offset, &function, sizeof(function));
+      corrupted = true;
+    }
+    offset += sizeof(magnifier::SnapshotFunction);
+  }
+  CHECK(corrupted);
+
+  std::error_code error;
+  {
+    llvm::raw_fd_ostream os(path, error);
+    CHECK(!error);
+    os << bytes;
+  }
+
+  llvm::LLVMContext context;
+  magnifier::BitcodeExplorer restored(context);
+  auto restore_result = restored.RestoreSnapshot(std::string(path));
+  CHECK(!restore_result.Succeeded() &&
+        restore_result.Error() == magnifier::SnapshotError::kInvalidSnapshot);
+  CHECK(FindFunction(restored, "caller") == magnifier::kInvalidValueId);
+}
+
+// A module restored from the cache after other modules were loaded gets the
+// same ids as when it is parsed and indexed there.
+void CheckCacheShiftsIds(const std::string &directory, bool lazy) {
+  llvm::SmallString<128> cache_path(directory);
+  llvm::sys::path::append(cache_path, lazy ? "cache-lazy" : "cache");
+  magnifier::ModuleCache cache{std::string(cache_path)};
+
+  magnifier::LoadOptions options;
+  options.lazy = lazy;
+  magnifier::LoadOptions cached_options = options;
+  cached_options.cache = &cache;
+
+  // Fill the cache with the module loaded first, i.e. with ids from 1
+  {
+    llvm::LLVMContext context;
+    magnifier::BitcodeExplorer explorer(context);
+    CHECK(explorer.LoadModule(Assemble(kCallerModule), cached_options)
+              .Succeeded());
+    CHECK(explorer.GetStats().module_cache_misses == 1);
+  }
+
+  llvm::LLVMContext context;
+  magnifier::BitcodeExplorer cached(context);
+  CHECK(cached.LoadModule(Assemble(kOtherModule), options).Succeeded());
+  CHECK(cached.LoadModule(Assemble(kCallerModule), cached_options)
+            .Succeeded());
+  CHECK(cached.GetStats().module_cache_hits == 1);
+
+  llvm::LLVMContext parsed_context;
+  magnifier::BitcodeExplorer parsed(parsed_context);
+  CHECK(parsed.LoadModule(Assemble(kOtherModule), options).Succeeded());
+  CHECK(parsed.LoadModule(Assemble(kCallerModule), options).Succeeded());
+
+  CHECK(FindFunction(cached, "caller") != magnifier::kInvalidValueId);
+  CHECK(Describe(cached) == Describe(parsed));
+}
+
+}  // namespace
+
+int main() {
+  llvm::SmallString<128> directory;
+  if (llvm::sys::fs::createUniqueDirectory("magnifier-test", directory)) {
+    llvm::errs() << "Cannot create a temporary directory\n";
+    return 1;
+  }
+
+  CheckSnapshotRoundTrip(std::string(directory));
+  CheckCorruptSnapshotIsRejected(std::string(directory));
+  CheckCacheShiftsIds(std::string(directory), /*lazy=*/false);
+  CheckCacheShiftsIds(std::string(directory), /*lazy=*/true);
+
+  (void)llvm::sys::fs::remove_directories(directory);
+  if (failure_count != 0) {
+    llvm::errs() << failure_count << " checks failed\n";
+    return 1;
+  }
+  return 0;
+}